@@ -0,0 +1,37 @@
+#include <chrono>
+#include "asset_loader.h"
+
+ModelHandle load_model_async(const std::string &filename, int maps) {
+    ModelHandle handle;
+    for (auto map : {Model::DIFFUSE_MAP, Model::NORMAL_MAP, Model::SPECULAR_MAP}) {
+        if (!(maps & map)) continue;
+        std::string path = Model::texture_path(filename, map);
+        if (path.empty()) continue;
+        handle.textures.push_back(std::async(std::launch::async, [path] {
+            TexturePool::instance().acquire(path);
+        }).share());
+    }
+    handle.geometry = std::async(std::launch::async, [filename] {
+        return std::shared_ptr<const Model>(std::make_shared<Model>(filename.c_str()));
+    }).share();
+    return handle;
+}
+
+bool ModelHandle::geometry_ready() const {
+    return geometry.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+bool ModelHandle::textures_ready() const {
+    for (auto const &t : textures) {
+        if (t.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return false;
+    }
+    return true;
+}
+
+std::shared_ptr<const Model> ModelHandle::get() const {
+    return geometry.get();
+}
+
+void ModelHandle::wait_textures() const {
+    for (auto const &t : textures) t.wait();
+}
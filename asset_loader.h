@@ -0,0 +1,30 @@
+#ifndef ASSET_LOADER_H
+#define ASSET_LOADER_H
+
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+#include "model.h"
+
+// A model whose geometry and textures are being loaded in the background.
+// Geometry becomes available as soon as the OBJ is parsed; textures are decoded
+// concurrently into the TexturePool and picked up by the model on first sample,
+// so rendering can start before they finish and only blocks if a shader samples
+// a map that is still decoding.
+class ModelHandle {
+    std::shared_future<std::shared_ptr<const Model>> geometry;
+    std::vector<std::shared_future<void>> textures;
+
+    friend ModelHandle load_model_async(const std::string &filename, int maps);
+public:
+    [[nodiscard]] bool geometry_ready() const;
+    [[nodiscard]] bool textures_ready() const;
+    [[nodiscard]] std::shared_ptr<const Model> get() const;
+    void wait_textures() const;
+};
+
+// maps is a mask of Model::TextureMap selecting which textures to decode eagerly
+ModelHandle load_model_async(const std::string &filename, int maps = Model::ALL_MAPS);
+
+#endif //ASSET_LOADER_H
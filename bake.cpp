@@ -0,0 +1,117 @@
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+#include "bake.h"
+#include "profiler.h"
+#include "scheduler.h"
+
+namespace {
+
+// a texel whose center lies on a face, with the weights of the face's second and third vertex
+struct Texel {
+    int x, y, face;
+    float b1, b2;
+};
+
+// the texels of every face's UV triangle; where charts overlap the first face keeps the texel
+std::vector<Texel> cover_texels(Model const& model, int size) {
+    std::vector<Texel> texels;
+    std::vector<uint8_t> taken(static_cast<size_t>(size) * size);
+    for (int f = 0; f < static_cast<int>(model.number_of_faces()); f++) {
+        Vec2f uv[3] = {model.uv_at(f, 0) * size, model.uv_at(f, 1) * size, model.uv_at(f, 2) * size};
+        const float area = (uv[1].x - uv[0].x) * (uv[2].y - uv[0].y) - (uv[2].x - uv[0].x) * (uv[1].y - uv[0].y);
+        if (area == 0) continue;
+        int x0 = std::max(0, static_cast<int>(std::floor(std::min({uv[0].x, uv[1].x, uv[2].x}))));
+        int x1 = std::min(size - 1, static_cast<int>(std::ceil(std::max({uv[0].x, uv[1].x, uv[2].x}))));
+        int y0 = std::max(0, static_cast<int>(std::floor(std::min({uv[0].y, uv[1].y, uv[2].y}))));
+        int y1 = std::min(size - 1, static_cast<int>(std::ceil(std::max({uv[0].y, uv[1].y, uv[2].y}))));
+        for (int y = y0; y <= y1; y++) {
+            for (int x = x0; x <= x1; x++) {
+                const float px = x + .5f, py = y + .5f;
+                float b1 = ((px - uv[0].x) * (uv[2].y - uv[0].y) - (uv[2].x - uv[0].x) * (py - uv[0].y)) / area;
+                float b2 = ((uv[1].x - uv[0].x) * (py - uv[0].y) - (px - uv[0].x) * (uv[1].y - uv[0].y)) / area;
+                uint8_t& texel = taken[static_cast<size_t>(y) * size + x];
+                if (b1 < 0 || b2 < 0 || b1 + b2 > 1 || texel) continue;
+                texel = 1;
+                texels.push_back({x, y, f, b1, b2});
+            }
+        }
+    }
+    return texels;
+}
+
+// grows the baked texels by one ring per pass, each new texel the mean of its baked neighbors
+void pad_charts(TGAImage& image, std::vector<uint8_t>& baked, int passes) {
+    const int size = image.get_width();
+    for (int pass = 0; pass < passes; pass++) {
+        std::vector<std::pair<int, TGAColor>> ring;
+        for (int y = 0; y < size; y++) {
+            for (int x = 0; x < size; x++) {
+                if (baked[y * size + x]) continue;
+                int sum[3] = {}, n = 0;
+                for (auto [dx, dy] : {std::pair{-1, 0}, {1, 0}, {0, -1}, {0, 1}}) {
+                    int nx = x + dx, ny = y + dy;
+                    if (nx < 0 || ny < 0 || nx >= size || ny >= size || !baked[ny * size + nx]) continue;
+                    TGAColor c = image.get(nx, ny);
+                    for (int i = 0; i < 3; i++) sum[i] += c.raw[i];
+                    n++;
+                }
+                if (n) ring.emplace_back(y * size + x, TGAColor(sum[2] / n, sum[1] / n, sum[0] / n));
+            }
+        }
+        for (auto const& [index, color] : ring) {
+            image.set(index % size, index / size, color);
+            baked[index] = 1;
+        }
+    }
+}
+
+} // namespace
+
+TGAImage bake_lighting(Model const& model, Bvh const& bvh, BakeOptions const& options) {
+    PROFILE_SCOPE("bake lighting");
+    const int size = options.size;
+    const std::vector<Texel> texels = cover_texels(model, size);
+    const int packets = (options.ao_samples + RAY_PACKET - 1) / RAY_PACKET;
+    const Vec3f light = options.light.normalized();
+    // rays start this far off the surface, so they don't hit the face they leave
+    constexpr float offset = 1e-3f;
+
+    TGAImage image(size, size, TGAImage::RGB);
+    Scheduler::instance().parallel_for(0, static_cast<int>(texels.size()), 64, [&](int first, int last) {
+        std::uniform_real_distribution<float> uniform(0, 1);
+        for (int i = first; i < last; i++) {
+            Texel const& texel = texels[i];
+            const float b0 = 1 - texel.b1 - texel.b2;
+            Vec3f p = model.vertex_at(texel.face, 0) * b0 + model.vertex_at(texel.face, 1) * texel.b1
+                    + model.vertex_at(texel.face, 2) * texel.b2;
+            Vec3f n = (model.normal_at(texel.face, 0) * b0 + model.normal_at(texel.face, 1) * texel.b1
+                    + model.normal_at(texel.face, 2) * texel.b2).normalized();
+            const Vec3f origin = p + n * offset;
+
+            // cosine-weighted directions around n, so the occlusion is weighted like diffuse light
+            Vec3f t = (std::abs(n.x) > .9f ? Vec3f(0, 1, 0) : Vec3f(1, 0, 0)).cross(n).normalized();
+            Vec3f b = n.cross(t);
+            std::minstd_rand random(texel.y * size + texel.x + 1);
+            int blocked = 0;
+            for (int k = 0; k < packets; k++) {
+                RayPacket packet;
+                for (int lane = 0; lane < RAY_PACKET; lane++) {
+                    float r = std::sqrt(uniform(random)), phi = 2 * static_cast<float>(M_PI) * uniform(random);
+                    Vec3f direction = t * (r * std::cos(phi)) + b * (r * std::sin(phi)) + n * std::sqrt(std::max(0.f, 1 - r * r));
+                    packet.set(lane, {origin, direction, options.ao_distance});
+                }
+                blocked += __builtin_popcount(bvh.occluded(packet));
+            }
+            const float ao = 1 - static_cast<float>(blocked) / (packets * RAY_PACKET);
+            const bool lit = n.dot(light) > 0 && !bvh.occluded(Ray{origin, light});
+            image.set(texel.x, texel.y, TGAColor(static_cast<unsigned char>(255 * ao), lit ? 255 : 0, 0));
+        }
+    });
+
+    std::vector<uint8_t> baked(static_cast<size_t>(size) * size);
+    for (auto const& texel : texels) baked[texel.y * size + texel.x] = 1;
+    pad_charts(image, baked, options.padding);
+    return image;
+}
@@ -0,0 +1,28 @@
+#ifndef BAKE_H
+#define BAKE_H
+
+#include "bvh.h"
+#include "model.h"
+#include "tgaimage.h"
+#include "vec.h"
+
+struct BakeOptions {
+    // edge of the square texture in texels
+    int size = 512;
+    // hemisphere rays per texel, rounded up to whole packets
+    int ao_samples = 64;
+    // occluders further than this from the surface don't darken it
+    float ao_distance = 0.5f;
+    // direction towards a directional light, as lightDirection of the shaders
+    Vec3f light = Vec3f(1, 1, 0);
+    // texel rings filled in around every UV chart, so lookups at the seams stay in baked texels
+    int padding = 2;
+};
+
+// Bakes lighting terms into the UV space of the model, sampled like its diffuse map: red is
+// the ambient occlusion, 255 for an open hemisphere, green 255 where the light reaches the
+// surface and 0 where the model shadows it. Texels are spread over the Scheduler threads and
+// seeded by position, so the result does not depend on the thread count.
+TGAImage bake_lighting(Model const& model, Bvh const& bvh, BakeOptions const& options = {});
+
+#endif //BAKE_H
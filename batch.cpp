@@ -0,0 +1,151 @@
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include "batch.h"
+#include "image_codec.h"
+#include "image_pool.h"
+#include "pipeline.h"
+#include "profiler.h"
+#include "scheduler.h"
+#include "utils.h"
+
+static bool parse_vec(const std::string &text, Vec3f &v) {
+    char end;
+    return std::sscanf(text.c_str(), "%f,%f,%f%c", &v.x, &v.y, &v.z, &end) == 3;
+}
+
+bool parse_job(const std::string &line, RenderJob &job, std::string &error) {
+    std::istringstream fields(line);
+    std::string field;
+    while (fields >> field) {
+        auto eq = field.find('=');
+        if (eq == std::string::npos) {
+            error = "expected key=value, got \"" + field + "\"";
+            return false;
+        }
+        std::string key = field.substr(0, eq), value = field.substr(eq + 1);
+        bool ok = true;
+        if (key == "model") {
+            job.model = value;
+        } else if (key == "output") {
+            job.output = value;
+        } else if (key == "size") {
+            char end;
+            ok = std::sscanf(value.c_str(), "%dx%d%c", &job.width, &job.height, &end) == 2
+                 && job.width > 0 && job.height > 0;
+        } else if (key == "eye") {
+            ok = parse_vec(value, job.eye);
+        } else if (key == "target") {
+            ok = parse_vec(value, job.target);
+        } else if (key == "up") {
+            ok = parse_vec(value, job.up);
+        } else if (key == "light") {
+            ok = parse_vec(value, job.light);
+        } else if (key == "shader") {
+            if (value == "gouraud") job.shader = GOURAUD_SHADER;
+            else if (value == "toon") job.shader = TOON_SHADER;
+            else if (value == "phong") job.shader = PHONG_SHADER;
+            else ok = false;
+        } else {
+            error = "unknown key \"" + key + "\"";
+            return false;
+        }
+        if (!ok) {
+            error = "bad value for " + key + ": \"" + value + "\"";
+            return false;
+        }
+    }
+    if (job.model.empty() || job.output.empty()) {
+        error = "model and output are required";
+        return false;
+    }
+    return true;
+}
+
+bool read_manifest(const std::string &filename, std::vector<RenderJob> &jobs, std::string &error) {
+    std::ifstream in(filename);
+    if (!in) {
+        error = "can't open " + filename;
+        return false;
+    }
+    std::string line;
+    for (int number = 1; std::getline(in, line); number++) {
+        auto first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#') continue;
+        RenderJob job;
+        if (!parse_job(line, job, error)) {
+            error = filename + ":" + std::to_string(number) + ": " + error;
+            return false;
+        }
+        jobs.push_back(std::move(job));
+    }
+    return true;
+}
+
+ModelHandle ModelCache::get(const std::string &filename) {
+    std::lock_guard lock(mutex);
+    auto found = models.find(filename);
+    if (found == models.end()) {
+        // what PhongShader samples; the other shaders use no maps
+        found = models.emplace(filename, load_model_async(filename, Model::DIFFUSE_MAP | Model::NORMAL_MAP)).first;
+    }
+    return found->second;
+}
+
+size_t ModelCache::size() const {
+    std::lock_guard lock(mutex);
+    return models.size();
+}
+
+void render_job(const RenderJob &job, const Model &model, ColorTarget &framebuffer, DepthTarget &zbuffer) {
+    auto view = view_transform(job.target, job.eye, job.up);
+    auto perspective = perspective_transform(-1, 1, 1);
+    auto mvpscr = viewport_transform(job.width, job.height, 255) * perspective * view;
+
+    auto shader = make_shader(job.shader);
+    shader->set_uniforms({view, perspective, job.eye, job.light});
+    draw_shaded(model, *shader, mvpscr, framebuffer, zbuffer);
+}
+
+PooledImage render_image(const RenderJob &job, const Model &model) {
+    ColorTarget framebuffer(job.width, job.height);
+    DepthTarget zbuffer(job.width, job.height);
+    render_job(job, model, framebuffer, zbuffer);
+
+    auto image = ImagePool::instance().acquire(job.width, job.height, TGAImage::RGB);
+    resolve(framebuffer, *image);
+    image->flip_vertically();
+    return image;
+}
+
+std::vector<JobResult> run_batch(const std::vector<RenderJob> &jobs, ModelCache &cache) {
+    std::vector<JobResult> results(jobs.size());
+    // start every load up front so parsing overlaps with the first renders
+    std::vector<ModelHandle> handles;
+    handles.reserve(jobs.size());
+    for (auto const &job : jobs) {
+        handles.push_back(cache.get(job.model));
+    }
+
+    Scheduler::TaskGroup group;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        group.run([&, i] {
+            PROFILE_SCOPE("job");
+            using clock = std::chrono::steady_clock;
+            auto start = clock::now();
+            auto model = handles[i].get();
+            auto loaded = clock::now();
+            JobResult &result = results[i];
+            result.wait_ms = std::chrono::duration<double, std::milli>(loaded - start).count();
+
+            RenderJob const &job = jobs[i];
+            auto image = render_image(job, *model);
+            result.ok = image->write_image_file(job.output.c_str(), encoder_for(job.output.c_str()));
+            result.render_ms = std::chrono::duration<double, std::milli>(clock::now() - loaded).count();
+        });
+    }
+    group.wait();
+    return results;
+}
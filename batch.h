@@ -0,0 +1,64 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "asset_loader.h"
+#include "image_pool.h"
+#include "render_target.h"
+#include "shaders.h"
+#include "vec.h"
+
+// One image of a batch: a model seen from a camera and lit by a directional light.
+// The defaults are the view of model_render_perspective_textured.
+struct RenderJob {
+    std::string model;
+    std::string output;
+    int width = 800;
+    int height = 800;
+    Vec3f eye = Vec3f(0.5, 0.5, 1);
+    Vec3f target = Vec3f(0, 0, -0.5);
+    Vec3f up = Vec3f(0, 1, 0);
+    Vec3f light = Vec3f(1, 1, 0);
+    ShaderType shader = PHONG_SHADER;
+};
+
+// Parses one manifest line of whitespace separated key=value fields, e.g.
+//   model=obj/african_head.obj output=head.png size=400x400 eye=1,0.3,1 shader=toon
+// Keys are model and output (both required), size, eye, target, up, light and shader
+// (gouraud, toon or phong); the others keep their defaults. The output is encoded as its
+// extension says. Returns false and describes the problem in error.
+bool parse_job(const std::string &line, RenderJob &job, std::string &error);
+
+// reads one job per line; blank lines and lines starting with # are skipped
+bool read_manifest(const std::string &filename, std::vector<RenderJob> &jobs, std::string &error);
+
+// Loads each model file once and hands the same read-only Model to every job that uses it.
+class ModelCache {
+    std::map<std::string, ModelHandle> models;
+    mutable std::mutex mutex;
+public:
+    // starts loading on the first request for a file
+    ModelHandle get(const std::string &filename);
+    [[nodiscard]] size_t size() const;
+};
+
+// draws the job's model into the targets, which have the job's size and are cleared
+void render_job(const RenderJob &job, const Model &model, ColorTarget &framebuffer, DepthTarget &zbuffer);
+
+// renders the job and returns its color image top row first, ready to encode
+PooledImage render_image(const RenderJob &job, const Model &model);
+
+struct JobResult {
+    double wait_ms = 0;   // until the model geometry was there
+    double render_ms = 0; // drawing, resolving and writing the image
+    bool ok = false;
+};
+
+// Renders every job into its output as a Scheduler task, so jobs run side by side and
+// each one spreads its faces over the threads that are left. Results are in job order.
+std::vector<JobResult> run_batch(const std::vector<RenderJob> &jobs, ModelCache &cache);
+
+#endif //BATCH_H
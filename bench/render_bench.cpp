@@ -0,0 +1,707 @@
+// Renderer benchmark suite, a program of its own:
+//   g++ -std=c++20 -O2 -pthread -I. bench/render_bench.cpp $(ls *.cpp | grep -v '^main.cpp$\|^matrix.cpp$') -o render_bench
+//   ./render_bench [--assets dir] [--threads 1,4] [--repeats 3] [--filter text]
+//                  [--json out.json] [--baseline base.json] [--tolerance 0.25]
+// Scenarios use african_head and diablo3_pose from the assets directory (obj/ by default;
+// the texture benchmarks are skipped when the *_diffuse.tga files are not there) and
+// synthetic meshes written to the temp directory: a fine sphere, a grid of tiny triangles
+// and a stack of screen-filling quads. Every scenario reports the best of its repeats.
+// Raster and shading scenarios run at every thread count, but for raster/triangle, which
+// draws on the calling thread alone and runs only at 1 thread; the Phong head also at 512
+// and 2048 pixels. The *_prepass shading scenarios lay down depth first (draw_shaded's
+// z-prepass). Ray casting and baking run through the Bvh of the real models and the sphere.
+// The instancing scenarios draw 1 to 10000 copies of african_head; the scene scenarios put
+// 1024 to 16384 of them in a SceneGraph field and time its build, refit, culling and drawing.
+// The incremental scenarios turn one head of a still 7 x 7 grid a step per frame. The
+// progressive ones time render_progressive's Gouraud preview alone and through to the last
+// Phong tile, against shade/phong. shade/phong_rate2 and _rate4 shade 2 x 2 and 4 x 4 blocks.
+// The lights scenarios light the models with 1 to 1000 point and spot lights, forward+ with
+// per-tile light lists (lights/tiled, lights/binning for the binning pass alone) against
+// trying every light at every pixel (lights/every).
+// --json writes the results; a run with --baseline compares against such a file and exits
+// with 1 when any scenario is slower than the baseline by more than the tolerance, or when a
+// baseline scenario the filter lets through did not run.
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "bake.h"
+#include "bvh.h"
+#include "gl.h"
+#include "image_codec.h"
+#include "instancing.h"
+#include "lights.h"
+#include "model.h"
+#include "pipeline.h"
+#include "progressive.h"
+#include "scene.h"
+#include "scheduler.h"
+#include "shaders.h"
+#include "tgaimage.h"
+#include "utils.h"
+
+struct Result {
+    std::string name;
+    int threads;
+    double ms;
+};
+
+struct Options {
+    std::string assets = "obj";
+    std::vector<int> threads;
+    int repeats = 3;
+    std::string filter;
+    std::string json;
+    std::string baseline;
+    double tolerance = 0.25;
+};
+
+static Options options;
+static std::vector<Result> results;
+static volatile float sink;
+
+// runs f once to warm up, then repeats times, and records the fastest run
+template <typename F> static void run(const std::string &name, int threads, F const &f) {
+    if (!options.filter.empty() && name.find(options.filter) == std::string::npos) return;
+    f();
+    double best = 1e30;
+    for (int r = 0; r < options.repeats; r++) {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+    results.push_back({name, threads, best});
+    std::printf("%-44s %3d  %10.3f ms\n", name.c_str(), threads, best);
+    std::fflush(stdout);
+}
+
+static std::string thread_suffix(int threads) {
+    return "/t" + std::to_string(threads);
+}
+
+// --- synthetic meshes --------------------------------------------------------------
+
+static void write_vertex(std::ofstream &obj, Vec3f p, Vec3f n, float u, float v) {
+    obj << "v " << p.x << " " << p.y << " " << p.z << "\n";
+    obj << "vt " << u << " " << v << "\n";
+    obj << "vn " << n.x << " " << n.y << " " << n.z << "\n";
+}
+
+static void write_quad(std::ofstream &obj, int a, int b, int c, int d) {
+    obj << "f " << a << "/" << a << "/" << a << " " << b << "/" << b << "/" << b << " " << c << "/" << c << "/" << c << "\n";
+    obj << "f " << a << "/" << a << "/" << a << " " << c << "/" << c << "/" << c << " " << d << "/" << d << "/" << d << "\n";
+}
+
+// rings x segments quads on the unit sphere scaled into the view
+static void write_sphere(const std::string &path, int rings, int segments) {
+    std::ofstream obj(path);
+    for (int r = 0; r <= rings; r++) {
+        float theta = static_cast<float>(M_PI) * r / rings;
+        for (int s = 0; s <= segments; s++) {
+            float phi = 2 * static_cast<float>(M_PI) * s / segments;
+            Vec3f n(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+            write_vertex(obj, n * 0.8f, n, static_cast<float>(s) / segments, static_cast<float>(r) / rings);
+        }
+    }
+    for (int r = 0; r < rings; r++) {
+        for (int s = 0; s < segments; s++) {
+            int a = r * (segments + 1) + s + 1;
+            write_quad(obj, a, a + segments + 1, a + segments + 2, a + 1);
+        }
+    }
+}
+
+// n x n quads over the view with jittered depth, each a few pixels across
+static void write_grid(const std::string &path, int n) {
+    std::ofstream obj(path);
+    std::mt19937 random(7);
+    std::uniform_real_distribution<float> jitter(-0.05f, 0.05f);
+    for (int y = 0; y <= n; y++) {
+        for (int x = 0; x <= n; x++) {
+            float u = static_cast<float>(x) / n, v = static_cast<float>(y) / n;
+            write_vertex(obj, Vec3f(u * 1.6f - 0.8f, v * 1.6f - 0.8f, jitter(random)), Vec3f(0, 0, 1), u, v);
+        }
+    }
+    for (int y = 0; y < n; y++) {
+        for (int x = 0; x < n; x++) {
+            int a = y * (n + 1) + x + 1;
+            write_quad(obj, a, a + 1, a + n + 2, a + n + 1);
+        }
+    }
+}
+
+// layers quads covering the whole view, back to front, for fill rate and overdraw
+static void write_layers(const std::string &path, int layers) {
+    std::ofstream obj(path);
+    for (int l = 0; l < layers; l++) {
+        float z = -0.5f + static_cast<float>(l) / layers;
+        write_vertex(obj, Vec3f(-2, -2, z), Vec3f(0, 0, 1), 0, 0);
+        write_vertex(obj, Vec3f(2, -2, z), Vec3f(0, 0, 1), 1, 0);
+        write_vertex(obj, Vec3f(2, 2, z), Vec3f(0, 0, 1), 1, 1);
+        write_vertex(obj, Vec3f(-2, 2, z), Vec3f(0, 0, 1), 0, 1);
+        write_quad(obj, 4 * l + 1, 4 * l + 2, 4 * l + 3, 4 * l + 4);
+    }
+}
+
+// --- scenarios ---------------------------------------------------------------------
+
+struct Scene {
+    std::string name;
+    std::string path;
+    std::unique_ptr<Model> model;
+};
+
+// the camera of model_render_perspective_textured
+static Mat4x4f scene_view() {
+    return view_transform(Vec3f(0, 0, -0.5), Vec3f(0.5, 0.5, 1), Vec3f(0, 1, 0));
+}
+
+static void bench_parse(Scene const &scene) {
+    std::cerr.setstate(std::ios::failbit); // the Model constructor reports every load
+    run("parse/" + scene.name, 1, [&] {
+        Model model(scene.path.c_str());
+        sink = static_cast<float>(model.number_of_faces());
+    });
+    std::cerr.clear();
+}
+
+static void bench_decode(Scene const &scene) {
+    std::string path = Model::texture_path(scene.path, Model::DIFFUSE_MAP);
+    if (!std::filesystem::exists(path)) return;
+    std::cerr.setstate(std::ios::failbit); // read_tga_file reports every load
+    run("decode/" + scene.name + "_diffuse", 1, [&] {
+        TGAImage image;
+        image.read_tga_file(path.c_str());
+        sink = static_cast<float>(image.get_width());
+    });
+    std::cerr.clear();
+}
+
+static void bench_transform(Scene const &scene) {
+    Model const &model = *scene.model;
+    auto mvpscr = viewport_transform(1024, 1024, 255) * perspective_transform(-1, 1, 1) * scene_view();
+    run("transform/" + scene.name, 1, [&] {
+        float sum = 0;
+        for (size_t f = 0; f < model.number_of_faces(); f++) {
+            for (int j = 0; j < 3; j++) {
+                Vec3f v = transform(into_homo(model.vertex_at(f, j)), mvpscr);
+                sum += v.x + v.y + v.z;
+            }
+        }
+        sink = sum;
+    });
+}
+
+// the projected faces of a scene, as every rasterizer benchmark draws them
+static std::vector<ScreenTriangle> project(Model const &model, int size) {
+    auto mvpscr = viewport_transform(size, size, 255) * perspective_transform(-1, 1, 1) * scene_view();
+    std::vector<ScreenTriangle> triangles(model.number_of_faces());
+    for (size_t f = 0; f < triangles.size(); f++) {
+        for (int j = 0; j < 3; j++) {
+            auto [x, y, z] = transform(into_homo(model.vertex_at(f, j)), mvpscr).view();
+            triangles[f][j] = Vec3i(x, y, z);
+        }
+    }
+    return triangles;
+}
+
+static void bench_raster(Scene const &scene, int size, int threads) {
+    std::string suffix = "/" + scene.name + "/" + std::to_string(size) + thread_suffix(threads);
+    auto triangles = project(*scene.model, size);
+    std::vector<TGAColor> colors(triangles.size());
+    std::mt19937 random(1);
+    for (auto &color : colors) color = TGAColor(random() % 255, random() % 255, random() % 255, 255);
+
+    // the barycentric rasterizer writing a TGAImage directly, without depth. It does not
+    // clip its bounding box, so it only runs on scenes that stay inside the view, and is
+    // single-threaded, so only at 1 thread
+    TGAImage image(size, size, TGAImage::RGB);
+    if (scene.name != "layers" && threads == 1) run("raster/triangle" + suffix, threads, [&] {
+        image.clear();
+        for (auto const &t : triangles) {
+            triangle(t[0].x, t[0].y, t[0].z, t[1].x, t[1].y, t[1].z, t[2].x, t[2].y, t[2].z, image,
+                     [](double alpha, double, double) {
+                auto z = static_cast<unsigned char>(255 * alpha);
+                return TGAColor(z, z, z, 255);
+            });
+        }
+    });
+
+    ColorTarget framebuffer(size, size);
+    DepthTarget zbuffer(size, size);
+    run("raster/triangle_with_z" + suffix, threads, [&] {
+        framebuffer.clear();
+        zbuffer.clear();
+        draw_faces(static_cast<int>(triangles.size()), framebuffer, zbuffer,
+                   [&](int face, ScreenTriangle &t) { t = triangles[face]; },
+                   [&](int face, ScreenTriangle const &t, ScreenRect const &clip, ColorTarget &fb, DepthTarget &zb) {
+            TGAColor color = colors[face];
+            triangle_with_z(t[0].x, t[0].y, t[0].z, t[1].x, t[1].y, t[1].z, t[2].x, t[2].y, t[2].z, fb, zb, clip,
+                            [color](double, double, double) { return color; });
+        });
+    });
+
+    // the same faces into depth alone, as a z-prepass or shadow map draws them
+    run("raster/depth_triangle" + suffix, threads, [&] {
+        zbuffer.clear();
+        draw_faces(static_cast<int>(triangles.size()), framebuffer, zbuffer,
+                   [&](int face, ScreenTriangle &t) { t = triangles[face]; },
+                   [&](int, ScreenTriangle const &t, ScreenRect const &clip, ColorTarget &, DepthTarget &zb) {
+            depth_triangle(t[0].x, t[0].y, t[0].z, t[1].x, t[1].y, t[1].z, t[2].x, t[2].y, t[2].z, zb, clip);
+        });
+    });
+}
+
+static void bench_shade(Scene const &scene, ShaderType type, const char *shader_name, int size, int threads,
+                        bool prepass = false) {
+    auto view = scene_view();
+    auto perspective = perspective_transform(-1, 1, 1);
+    auto shader = make_shader(type);
+    shader->set_uniforms({view, perspective, Vec3f(0.5, 0.5, 1), Vec3f(1, 1, 0)});
+    auto mvpscr = viewport_transform(size, size, 255) * perspective * view;
+    ColorTarget framebuffer(size, size);
+    DepthTarget zbuffer(size, size);
+    std::string name = std::string("shade/") + shader_name + (prepass ? "_prepass/" : "/") + scene.name;
+    run(name + "/" + std::to_string(size) + thread_suffix(threads), threads, [&] {
+        framebuffer.clear();
+        zbuffer.clear();
+        draw_shaded(*scene.model, *shader, mvpscr, framebuffer, zbuffer, prepass);
+    });
+}
+
+// draw_shaded_rates with one rate for the whole frame
+static void bench_shade_rate(Scene const &scene, int rate, int size, int threads) {
+    PhongShader shader;
+    shader.set_uniforms({scene_view(), perspective_transform(-1, 1, 1), Vec3f(0.5, 0.5, 1), Vec3f(1, 1, 0)});
+    auto mvpscr = viewport_transform(size, size, 255) * shader.mvp;
+    ColorTarget framebuffer(size, size);
+    DepthTarget zbuffer(size, size);
+    ShadingRates rates(zbuffer.get_tiles_x(), zbuffer.get_tiles_y(), rate);
+    std::string name = "shade/phong_rate" + std::to_string(rate) + "/" + scene.name;
+    run(name + "/" + std::to_string(size) + thread_suffix(threads), threads, [&] {
+        framebuffer.clear();
+        zbuffer.clear();
+        sink = static_cast<float>(draw_shaded_rates(*scene.model, shader, mvpscr, framebuffer, zbuffer, rates));
+    });
+}
+
+static void bench_encode(Scene const &scene) {
+    constexpr int size = 1024;
+    ColorTarget framebuffer(size, size);
+    DepthTarget zbuffer(size, size);
+    PhongShader shader;
+    shader.set_uniforms({scene_view(), perspective_transform(-1, 1, 1), Vec3f(0.5, 0.5, 1), Vec3f(1, 1, 0)});
+    draw_shaded(*scene.model, shader, viewport_transform(size, size, 255) * shader.mvp, framebuffer, zbuffer, false);
+    TGAImage image(size, size, TGAImage::RGB);
+    resolve(framebuffer, image);
+
+    std::vector<unsigned char> out;
+    auto encode = [&](const char *name, ImageEncoder const &encoder) {
+        run(std::string("encode/") + name + "/" + scene.name, 1, [&] {
+            out.clear();
+            encoder.encode(image, out);
+            sink = static_cast<float>(out.size());
+        });
+    };
+    encode("tga_rle", TgaEncoder(true));
+    encode("tga_raw", TgaEncoder(false));
+    encode("qoi", QoiEncoder());
+    encode("png", PngEncoder(true));
+}
+
+static void bench_bvh(Scene const &scene) {
+    run("bvh/build/" + scene.name, 1, [&] {
+        Bvh bvh(*scene.model);
+        sink = static_cast<float>(bvh.node_count());
+    });
+}
+
+// 64k rays in packets from shared origins around the model towards points inside its
+// bounds, so the packets stay about as coherent as the hemisphere of a baked texel
+static void bench_rays(Scene const &scene, int threads) {
+    Bvh bvh(*scene.model);
+    std::mt19937 random(5);
+    std::uniform_real_distribution<float> unit(-1, 1);
+    std::vector<Ray> rays;
+    for (int i = 0; i < 65536 / RAY_PACKET; i++) {
+        Vec3f origin = Vec3f(unit(random), unit(random), unit(random)).normalized() * 2.f;
+        for (int k = 0; k < RAY_PACKET; k++) {
+            Vec3f target(unit(random) * .8f, unit(random) * .8f, unit(random) * .8f);
+            rays.push_back({origin, target - origin});
+        }
+    }
+    std::vector<RayHit> hits;
+    std::vector<uint8_t> blocked;
+    run("raycast/closest/" + scene.name + thread_suffix(threads), threads, [&] {
+        bvh.intersect(rays, hits);
+        sink = hits[0].t;
+    });
+    run("raycast/occluded/" + scene.name + thread_suffix(threads), threads, [&] {
+        bvh.occluded(rays, blocked);
+        sink = blocked[0];
+    });
+    BakeOptions bake;
+    bake.size = 128;
+    bake.ao_samples = 16;
+    run("bake/" + scene.name + "/128" + thread_suffix(threads), threads, [&] {
+        sink = static_cast<float>(bake_lighting(*scene.model, bvh, bake).get_width());
+    });
+}
+
+// a grid of n copies of the model over a view a little narrower than the grid, so the edge
+// columns are culled; draw_instanced against a draw_shaded call per copy up to 1000 copies
+static void bench_instances(Scene const &scene, int threads) {
+    constexpr int size = 1024;
+    InstancedMesh mesh(*scene.model);
+    auto vpscr = viewport_transform(size, size, 255) * perspective_transform(-1, 1, 1)
+               * view_transform(Vec3f(0, 0, 0), Vec3f(0, 0, 2), Vec3f(0, 1, 0));
+    ColorTarget framebuffer(size, size);
+    DepthTarget zbuffer(size, size);
+    GouraudShader shader;
+    shader.lightDirection = Vec3f(1, 1, 1).normalized();
+    for (int count : {1, 10, 100, 1000, 10000}) {
+        const int side = static_cast<int>(std::ceil(std::sqrt(count)));
+        std::vector<Instance> instances(count);
+        for (int i = 0; i < count; i++) {
+            float x = -1.8f + 3.6f * (i % side + .5f) / side, y = -1.8f + 3.6f * (i / side + .5f) / side;
+            instances[i].transform = model_transform(Vec3f(x, y, 0), .4f * i, 1.6f / side);
+        }
+        std::string suffix = "/" + scene.name + "/" + std::to_string(count) + thread_suffix(threads);
+        run("instanced" + suffix, threads, [&] {
+            framebuffer.clear();
+            zbuffer.clear();
+            draw_instanced(mesh, instances, vpscr, Vec3f(1, 1, 1), framebuffer, zbuffer);
+        });
+        if (count > 1000) continue;
+        run("instanced_naive" + suffix, threads, [&] {
+            framebuffer.clear();
+            zbuffer.clear();
+            for (auto const &instance : instances) {
+                draw_shaded(*scene.model, shader, vpscr * instance.transform, framebuffer, zbuffer, false);
+            }
+        });
+    }
+}
+
+// a square field of copies of the model seen from above one edge, as main's --scene draws it:
+// tree against per-object culling, and drawing in id order against front to back (_sorted)
+static void bench_scene(Scene const &scene, int threads) {
+    constexpr int size = 1024;
+    auto mesh = std::make_shared<const InstancedMesh>(*scene.model);
+    ColorTarget framebuffer(size, size);
+    DepthTarget zbuffer(size, size);
+    for (int count : {1024, 4096, 16384}) {
+        const int side = static_cast<int>(std::ceil(std::sqrt(count)));
+        std::vector<Vec3f> positions;
+        SceneGraph graph;
+        for (int i = 0; i < count; i++) {
+            positions.emplace_back(i % side - side / 2, 0, i / side - side / 2);
+            graph.add(mesh, model_transform(positions.back(), .4f * i, .4f));
+        }
+        const float edge = side / 2.f + 2;
+        auto vpscr = camera_transform(Vec3f(0, 2.5f, -edge), Vec3f(0, 0, 10 - edge), Vec3f(0, 1, 0), size, size,
+                                      1, 2 * edge);
+        std::string suffix = "/" + scene.name + "/" + std::to_string(count) + thread_suffix(threads);
+        SceneStats stats;
+        run("scene/build" + suffix, threads, [&] {
+            graph.remove(graph.add(mesh, Mat4x4f::identity<4>()));
+            graph.update();
+        });
+        float turn = 0;
+        run("scene/refit" + suffix, threads, [&] {
+            turn += .1f;
+            for (int i = 0; i < count; i++) graph.move(i, model_transform(positions[i], .4f * i + turn, .4f));
+            graph.update();
+        });
+        run("scene/cull_bvh" + suffix, threads, [&] {
+            sink = static_cast<float>(graph.visible(vpscr, framebuffer.bounds(), false, stats).size());
+        });
+        run("scene/cull_linear" + suffix, threads, [&] {
+            sink = static_cast<float>(graph.visible_linear(vpscr, framebuffer.bounds(), stats).size());
+        });
+        if (count > 4096) continue;
+        run("scene/draw" + suffix, threads, [&] {
+            framebuffer.clear();
+            zbuffer.clear();
+            graph.draw(vpscr, Vec3f(1, 1, 1), framebuffer, zbuffer, false);
+        });
+        run("scene/draw_sorted" + suffix, threads, [&] {
+            framebuffer.clear();
+            zbuffer.clear();
+            graph.draw(vpscr, Vec3f(1, 1, 1), framebuffer, zbuffer, true);
+        });
+        run("scene/draw_occluded" + suffix, threads, [&] {
+            framebuffer.clear();
+            zbuffer.clear();
+            graph.draw(vpscr, Vec3f(1, 1, 1), framebuffer, zbuffer, true, true);
+        });
+    }
+}
+
+// main's --incremental turntable: a frame of draw_incremental against a full redraw
+static void bench_incremental(Scene const &scene, int threads) {
+    constexpr int size = 1024;
+    constexpr int side = 7;
+    auto mesh = std::make_shared<const InstancedMesh>(*scene.model);
+    SceneGraph graph;
+    for (int i = 0; i < side * side; i++) {
+        graph.add(mesh, model_transform(Vec3f(i % side - side / 2, 0, i / side - side / 2), .4f * i, .4f));
+    }
+    auto vpscr = camera_transform(Vec3f(0, 3, -6), Vec3f(0, 0, 0), Vec3f(0, 1, 0), size, size, 1, 12);
+    ColorTarget framebuffer(size, size);
+    DepthTarget zbuffer(size, size);
+    float turn = 0;
+    std::string suffix = "/" + scene.name + thread_suffix(threads);
+    run("incremental/turntable" + suffix, threads, [&] {
+        turn += .1f;
+        graph.move(side * side / 2, model_transform(Vec3f(0, 0, 0), turn, .4f));
+        graph.draw_incremental(vpscr, Vec3f(1, 1, 1), framebuffer, zbuffer);
+    });
+    run("incremental/full" + suffix, threads, [&] {
+        turn += .1f;
+        graph.move(side * side / 2, model_transform(Vec3f(0, 0, 0), turn, .4f));
+        framebuffer.clear();
+        zbuffer.clear();
+        graph.draw(vpscr, Vec3f(1, 1, 1), framebuffer, zbuffer);
+    });
+}
+
+static void bench_progressive(Scene const &scene, int threads) {
+    constexpr int size = 1024;
+    GouraudShader preview;
+    PhongShader shader;
+    preview.set_uniforms({scene_view(), perspective_transform(-1, 1, 1), Vec3f(0.5, 0.5, 1), Vec3f(1, 1, 0)});
+    shader.set_uniforms({scene_view(), perspective_transform(-1, 1, 1), Vec3f(0.5, 0.5, 1), Vec3f(1, 1, 0)});
+    auto progress = [&](TGAImage const &image, int, int) { sink = image.get_width(); };
+    ProgressiveOptions first;
+    first.first_ms = 1e6;
+    // any deadline ends the call right after the preview
+    first.deadline_ms = 1e-6;
+    ProgressiveOptions full;
+    full.first_ms = 1e6;
+    std::string suffix = "/" + scene.name + "/" + std::to_string(size) + thread_suffix(threads);
+    run("progressive/first" + suffix, threads, [&] {
+        render_progressive(*scene.model, preview, shader, shader.mvp, size, size, first, progress);
+    });
+    run("progressive/full" + suffix, threads, [&] {
+        render_progressive(*scene.model, preview, shader, shader.mvp, size, size, full, progress);
+    });
+}
+
+// count lights around the model as in model_render_lights: points, every fourth a spot
+static std::vector<Light> scatter_lights(int count) {
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> unit(0, 1);
+    std::vector<Light> lights;
+    for (int i = 0; i < count; i++) {
+        const float a = 2 * static_cast<float>(M_PI) * unit(random), y = 2 * unit(random) - 1;
+        const float r = std::sqrt(1 - y * y) * (.8f + .4f * unit(random));
+        const Vec3f position(r * std::cos(a), y, r * std::sin(a));
+        const Vec3f color(.2f + .6f * unit(random), .2f + .6f * unit(random), .2f + .6f * unit(random));
+        lights.push_back(i % 4 == 3 ? Light::spot(position, -position, color, .6f, .2f, .4f)
+                                    : Light::point(position, color, .3f));
+    }
+    return lights;
+}
+
+// LitShader with 1 to 1000 lights: draw_lit's per-tile lists, its light binning alone, and
+// every light at every pixel through draw_shaded with the z-prepass
+static void bench_lights(Scene const &scene, int threads) {
+    constexpr int size = 1024;
+    const Vec3f eye(0.5, 0.5, 1);
+    LitShader shader;
+    shader.set_uniforms({scene_view(), perspective_transform(-1, 1, 1), eye, Vec3f(1, 1, 0)});
+    auto mvpscr = camera_transform(eye, Vec3f(0, 0, -0.5), Vec3f(0, 1, 0), size, size, .2f, 3);
+    ColorTarget framebuffer(size, size);
+    DepthTarget zbuffer(size, size);
+    LightGrid grid;
+    for (int count : {1, 10, 100, 1000}) {
+        std::vector<Light> lights = scatter_lights(count);
+        shader.lights = &lights;
+        std::string suffix = "/" + std::to_string(count) + "/" + scene.name + "/" + std::to_string(size)
+                           + thread_suffix(threads);
+        run("lights/tiled" + suffix, threads, [&] {
+            framebuffer.clear();
+            zbuffer.clear();
+            draw_lit(*scene.model, shader, mvpscr, framebuffer, zbuffer, grid);
+        });
+        // the depth of the last run stays for the binning
+        run("lights/binning" + suffix, threads, [&] {
+            grid.build(lights, mvpscr, zbuffer);
+            sink = static_cast<float>(grid.entries());
+        });
+        run("lights/every" + suffix, threads, [&] {
+            framebuffer.clear();
+            zbuffer.clear();
+            draw_shaded(*scene.model, shader, mvpscr, framebuffer, zbuffer, true);
+        });
+    }
+}
+
+// --- results -----------------------------------------------------------------------
+
+static bool write_json(const std::string &path) {
+    std::ofstream out(path);
+    out << "{\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        char ms[32];
+        std::snprintf(ms, sizeof(ms), "%.4f", results[i].ms);
+        out << "    {\"name\": \"" << results[i].name << "\", \"threads\": " << results[i].threads
+            << ", \"ms\": " << ms << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+    return static_cast<bool>(out);
+}
+
+// reads the one-result-per-line files write_json produces
+static std::map<std::string, double> read_json(const std::string &path) {
+    std::map<std::string, double> baseline;
+    std::ifstream in(path);
+    for (std::string line; std::getline(in, line);) {
+        auto name = line.find("\"name\": \"");
+        auto ms = line.find("\"ms\": ");
+        if (name == std::string::npos || ms == std::string::npos) continue;
+        name += 9;
+        baseline[line.substr(name, line.find('"', name) - name)] = std::atof(line.c_str() + ms + 6);
+    }
+    return baseline;
+}
+
+// true when nothing got slower than the baseline by more than the tolerance and every
+// baseline scenario the filter lets through ran
+static bool compare(const std::map<std::string, double> &baseline) {
+    bool passed = true;
+    std::printf("\n%-44s %10s %10s %8s\n", "scenario", "base ms", "ms", "change");
+    for (auto const &[name, ms] : baseline) {
+        if (!options.filter.empty() && name.find(options.filter) == std::string::npos) continue;
+        bool ran = std::any_of(results.begin(), results.end(), [&](auto const &result) { return result.name == name; });
+        if (ran) continue;
+        passed = false;
+        std::printf("%-44s %10.3f %10s %8s  MISSING\n", name.c_str(), ms, "-", "");
+    }
+    for (auto const &result : results) {
+        auto found = baseline.find(result.name);
+        if (found == baseline.end()) continue;
+        double change = result.ms / found->second - 1;
+        // differences below 50 us are timer noise, whatever their ratio
+        bool regressed = change > options.tolerance && result.ms - found->second > 0.05;
+        passed = passed && !regressed;
+        std::printf("%-44s %10.3f %10.3f %+7.1f%%%s\n", result.name.c_str(), found->second, result.ms, 100 * change,
+                    regressed ? "  REGRESSION" : "");
+    }
+    return passed;
+}
+
+static std::vector<int> parse_list(const std::string &text) {
+    std::vector<int> list;
+    std::stringstream items(text);
+    for (std::string item; std::getline(items, item, ',');) list.push_back(std::max(1, std::atoi(item.c_str())));
+    return list;
+}
+
+int main(int argc, char **argv) {
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string flag = argv[i], value = argv[i + 1];
+        if (flag == "--assets") options.assets = value;
+        else if (flag == "--threads") options.threads = parse_list(value);
+        else if (flag == "--repeats") options.repeats = std::max(1, std::atoi(value.c_str()));
+        else if (flag == "--filter") options.filter = value;
+        else if (flag == "--json") options.json = value;
+        else if (flag == "--baseline") options.baseline = value;
+        else if (flag == "--tolerance") options.tolerance = std::atof(value.c_str());
+        else {
+            std::cerr << "unknown option " << flag << std::endl;
+            return 1;
+        }
+    }
+    if (options.threads.empty()) {
+        options.threads = {1};
+        int hardware = static_cast<int>(std::thread::hardware_concurrency());
+        if (hardware > 1) options.threads.push_back(hardware);
+    }
+
+    auto temp = std::filesystem::temp_directory_path();
+    std::vector<Scene> scenes;
+    for (const char *name : {"african_head", "diablo3_pose"}) {
+        scenes.push_back({name, options.assets + "/" + name + ".obj", nullptr});
+    }
+    write_sphere((temp / "bench_sphere.obj").string(), 256, 512);
+    write_grid((temp / "bench_grid.obj").string(), 400);
+    write_layers((temp / "bench_layers.obj").string(), 8);
+    scenes.push_back({"sphere", (temp / "bench_sphere.obj").string(), nullptr});
+    scenes.push_back({"grid", (temp / "bench_grid.obj").string(), nullptr});
+    scenes.push_back({"layers", (temp / "bench_layers.obj").string(), nullptr});
+
+    std::cerr.setstate(std::ios::failbit);
+    for (auto &scene : scenes) scene.model = std::make_unique<Model>(scene.path.c_str());
+    std::cerr.clear();
+    for (auto const &scene : scenes) {
+        if (scene.model->number_of_faces() == 0) {
+            std::cerr << "can't load " << scene.path << std::endl;
+            return 1;
+        }
+    }
+
+    std::printf("%-44s %3s  %13s\n", "scenario", "thr", "best");
+    Scheduler::instance().set_threads(1);
+    for (auto const &scene : scenes) bench_parse(scene);
+    for (auto const &scene : scenes) bench_decode(scene);
+    for (auto const &scene : scenes) bench_transform(scene);
+    for (auto const &scene : scenes) bench_bvh(scene);
+    bench_encode(scenes[0]);
+
+    for (int threads : options.threads) {
+        Scheduler::instance().set_threads(threads);
+        for (auto const &scene : scenes) bench_raster(scene, 1024, threads);
+        // every shader on the real models, the cheapest one for the load of the synthetic meshes;
+        // the z-prepass where shading is expensive or overdraw high
+        for (auto const &scene : scenes) {
+            bench_shade(scene, GOURAUD_SHADER, "gouraud", 1024, threads);
+            if (scene.name == "layers") bench_shade(scene, GOURAUD_SHADER, "gouraud", 1024, threads, true);
+            if (scene.name == "african_head" || scene.name == "diablo3_pose") {
+                bench_shade(scene, TOON_SHADER, "toon", 1024, threads);
+                bench_shade(scene, PHONG_SHADER, "phong", 1024, threads);
+                bench_shade(scene, PHONG_SHADER, "phong", 1024, threads, true);
+                bench_progressive(scene, threads);
+                for (int rate : {2, 4}) bench_shade_rate(scene, rate, 1024, threads);
+                bench_lights(scene, threads);
+            }
+        }
+        for (int size : {512, 2048}) bench_shade(scenes[0], PHONG_SHADER, "phong", size, threads);
+        for (auto const &scene : scenes) {
+            if (scene.name != "grid" && scene.name != "layers") bench_rays(scene, threads);
+        }
+        bench_instances(scenes[0], threads);
+        bench_scene(scenes[0], threads);
+        bench_incremental(scenes[0], threads);
+    }
+
+    if (!options.json.empty() && !write_json(options.json)) {
+        std::cerr << "can't write " << options.json << std::endl;
+        return 1;
+    }
+    if (!options.baseline.empty()) {
+        auto baseline = read_json(options.baseline);
+        if (baseline.empty()) {
+            std::cerr << "no results in " << options.baseline << std::endl;
+            return 1;
+        }
+        if (!compare(baseline)) {
+            std::printf("\nslower than the baseline by more than %.0f%%, or missing from this run\n",
+                        100 * options.tolerance);
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,137 @@
+// Load generator for the render server (main --serve socket), a program of its own:
+//   g++ -std=c++20 -O2 -pthread bench/render_client.cpp -o render_client
+//   ./render_client socket [connections] [repeat] [--save] < requests.txt
+// Every connection sends the request lines repeat times, one at a time, and waits for each
+// reply. It reports the reply latencies as seen by the client and the request rate; with
+// --save returned images are written to reply_<connection>_<n> files. A "stats" line
+// prints the server's histograms.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+static bool read_exact(int fd, char *out, size_t size) {
+    while (size) {
+        ssize_t n = ::read(fd, out, size);
+        if (n <= 0) return false;
+        out += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool read_line(int fd, std::string &line) {
+    line.clear();
+    char c;
+    while (read_exact(fd, &c, 1)) {
+        if (c == '\n') return true;
+        line += c;
+    }
+    return false;
+}
+
+// the extension a "-.png" style output asks for
+static std::string reply_extension(const std::string &request) {
+    auto at = request.find("output=-");
+    if (at == std::string::npos) return ".tga";
+    std::string ext = request.substr(at + 8, request.find(' ', at) - at - 8);
+    return ext.empty() ? ".tga" : ext;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " socket [connections] [repeat] [--save] < requests.txt" << std::endl;
+        return 1;
+    }
+    const bool save = std::string(argv[argc - 1]) == "--save";
+    if (save) argc--;
+    const int connections = argc > 2 ? std::max(1, std::atoi(argv[2])) : 1;
+    const int repeat = argc > 3 ? std::max(1, std::atoi(argv[3])) : 1;
+
+    std::vector<std::string> requests;
+    for (std::string line; std::getline(std::cin, line);) {
+        if (!line.empty() && line[0] != '#') requests.push_back(line);
+    }
+
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, argv[1], sizeof(address.sun_path) - 1);
+
+    std::vector<std::vector<double>> latencies(connections);
+    std::vector<int> errors(connections);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> clients;
+    for (int c = 0; c < connections; c++) {
+        clients.emplace_back([&, c] {
+            int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0) {
+                std::perror("connect");
+                errors[c]++;
+                return;
+            }
+            std::string header;
+            std::vector<char> body;
+            int n = 0;
+            for (int r = 0; r < repeat; r++) {
+                for (auto const &request : requests) {
+                    auto sent = std::chrono::steady_clock::now();
+                    std::string line = request + "\n";
+                    if (::write(fd, line.data(), line.size()) != static_cast<ssize_t>(line.size()) || !read_line(fd, header)) {
+                        errors[c]++;
+                        ::close(fd);
+                        return;
+                    }
+                    size_t bytes = 0;
+                    if (header.rfind("ok ", 0) == 0 || header.rfind("stats ", 0) == 0) {
+                        bytes = std::strtoull(header.c_str() + header.find(' ') + 1, nullptr, 10);
+                    }
+                    body.resize(bytes);
+                    if (!read_exact(fd, body.data(), bytes)) {
+                        errors[c]++;
+                        ::close(fd);
+                        return;
+                    }
+                    if (header.rfind("stats ", 0) == 0) {
+                        std::cerr.write(body.data(), body.size());
+                        continue;
+                    }
+                    latencies[c].push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - sent).count());
+                    if (header.rfind("ok ", 0) != 0) {
+                        std::cerr << header << std::endl;
+                        errors[c]++;
+                    } else if (save && bytes) {
+                        std::string name = "reply_" + std::to_string(c) + "_" + std::to_string(n) + reply_extension(request);
+                        if (FILE *out = std::fopen(name.c_str(), "wb")) {
+                            std::fwrite(body.data(), 1, body.size(), out);
+                            std::fclose(out);
+                        }
+                    }
+                    n++;
+                }
+            }
+            ::close(fd);
+        });
+    }
+    for (auto &client : clients) client.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<double> all;
+    int failed = 0;
+    for (int c = 0; c < connections; c++) {
+        all.insert(all.end(), latencies[c].begin(), latencies[c].end());
+        failed += errors[c];
+    }
+    std::sort(all.begin(), all.end());
+    auto at = [&](double p) { return all.empty() ? 0 : all[std::min(all.size() - 1, static_cast<size_t>(p * all.size()))]; };
+    std::printf("requests %zu  errors %d  %.1f req/s  p50 %.2f ms  p90 %.2f ms  p99 %.2f ms  max %.2f ms\n",
+                all.size(), failed, all.size() / seconds, at(.5), at(.9), at(.99), all.empty() ? 0 : all.back());
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,73 @@
+// Scaling benchmark for the task scheduler, a program of its own:
+//   g++ -std=c++20 -O2 -pthread -I. bench/scheduler_bench.cpp scheduler.cpp -o scheduler_bench
+//   ./scheduler_bench [max threads]
+// For 1 up to max threads it reports the cost of an empty parallel_for, the throughput of
+// a compute-bound loop at a few grain sizes, and a nested loop of uneven inner ranges.
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include "scheduler.h"
+
+template <typename F> static double best_ms(int repeats, F const &f) {
+    double best = 1e30;
+    for (int r = 0; r < repeats; r++) {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+// a few hundred nanoseconds of floating point work per item
+static float work(int i) {
+    float x = static_cast<float>(i);
+    for (int k = 0; k < 64; k++) x = std::sqrt(x * x + 1.f);
+    return x;
+}
+
+int main(int argc, char **argv) {
+    int max_threads = argc > 1 ? std::atoi(argv[1]) : static_cast<int>(std::thread::hardware_concurrency());
+    max_threads = std::max(max_threads, 1);
+    constexpr int items = 1 << 20;
+    std::vector<float> out(items);
+
+    std::printf("threads  empty_us  grain64_ms  grain4096_ms  nested_ms  speedup\n");
+    double base = 0;
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        Scheduler scheduler(threads);
+
+        double empty = best_ms(50, [&] {
+            for (int i = 0; i < 100; i++) scheduler.parallel_for(0, 1024, 1, [](int, int) {});
+        }) * 10; // microseconds per call
+
+        auto loop = [&](int grain) {
+            return best_ms(5, [&] {
+                scheduler.parallel_for(0, items, grain, [&](int first, int last) {
+                    for (int i = first; i < last; i++) out[i] = work(i);
+                });
+            });
+        };
+        double fine = loop(64);
+        double coarse = loop(4096);
+
+        // outer ranges of very different sizes, each splitting again
+        double nested = best_ms(5, [&] {
+            scheduler.parallel_for(0, 64, 1, [&](int first, int last) {
+                for (int o = first; o < last; o++) {
+                    int n = (o % 8 + 1) * items / 288;
+                    scheduler.parallel_for(0, n, 256, [&](int b, int e) {
+                        for (int i = b; i < e; i++) out[i] = work(i + o);
+                    });
+                }
+            });
+        });
+
+        if (threads == 1) base = coarse;
+        std::printf("%7d  %8.2f  %10.2f  %12.2f  %9.2f  %7.2f\n", threads, empty, fine, coarse, nested, base / coarse);
+        if (threads < max_threads && threads * 2 > max_threads) threads = max_threads / 2;
+    }
+    return 0;
+}
@@ -0,0 +1,391 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "bvh.h"
+#include "profiler.h"
+#include "scheduler.h"
+
+// SAH split candidates per axis
+constexpr int SAH_BINS = 16;
+// nodes this small always become leaves, larger ones only when no split pays off
+constexpr int MIN_LEAF = 2;
+constexpr int MAX_LEAF = 16;
+// nodes this deep become leaves whatever their size, so lopsided splits of clustered faces
+// can't outgrow the traversal stack
+constexpr int MAX_DEPTH = 64;
+// hits closer than this are the surface a ray starts from
+constexpr float RAY_EPSILON = 1e-5f;
+
+void RayPacket::set(int lane, Ray const& ray) {
+    ox[lane] = ray.origin.x;
+    oy[lane] = ray.origin.y;
+    oz[lane] = ray.origin.z;
+    dx[lane] = ray.direction.x;
+    dy[lane] = ray.direction.y;
+    dz[lane] = ray.direction.z;
+    t_max[lane] = ray.t_max;
+}
+
+namespace {
+
+struct Box {
+    float lo[3] = {INFINITY, INFINITY, INFINITY};
+    float hi[3] = {-INFINITY, -INFINITY, -INFINITY};
+
+    void grow(const float p[3]) {
+        for (int a = 0; a < 3; a++) {
+            lo[a] = std::min(lo[a], p[a]);
+            hi[a] = std::max(hi[a], p[a]);
+        }
+    }
+    void grow(Box const& b) {
+        for (int a = 0; a < 3; a++) {
+            lo[a] = std::min(lo[a], b.lo[a]);
+            hi[a] = std::max(hi[a], b.hi[a]);
+        }
+    }
+    [[nodiscard]] float area() const {
+        float x = hi[0] - lo[0], y = hi[1] - lo[1], z = hi[2] - lo[2];
+        return x < 0 ? 0 : 2 * (x * y + y * z + z * x);
+    }
+};
+
+// a packet prepared for traversal: inverse directions for the slab tests
+struct Lanes {
+    alignas(16) float o[3][RAY_PACKET];
+    alignas(16) float d[3][RAY_PACKET];
+    alignas(16) float inv[3][RAY_PACKET];
+};
+
+} // namespace
+
+struct Bvh::Build {
+    std::vector<Box> bounds;
+    std::vector<float> centroids;
+    std::vector<int> order;
+    std::vector<Node> &nodes;
+    int max_depth = 0;
+
+    int node(int first, int count, int depth);
+};
+
+int Bvh::Build::node(int first, int count, int depth) {
+    max_depth = std::max(max_depth, depth);
+    const int index = static_cast<int>(nodes.size());
+    nodes.push_back({});
+    Box box, centers;
+    for (int i = first; i < first + count; i++) {
+        box.grow(bounds[order[i]]);
+        centers.grow(&centroids[3 * order[i]]);
+    }
+    for (int a = 0; a < 3; a++) {
+        nodes[index].lo[a] = box.lo[a];
+        nodes[index].hi[a] = box.hi[a];
+    }
+    auto leaf = [&] {
+        nodes[index].first = first;
+        nodes[index].count = count;
+        return index;
+    };
+    if (count <= MIN_LEAF || depth >= MAX_DEPTH) {
+        return leaf();
+    }
+
+    // cheapest split over the bins of every axis: each side costs its area times its faces
+    float best_cost = INFINITY;
+    int best_axis = -1, best_split = 0;
+    for (int a = 0; a < 3; a++) {
+        const float extent = centers.hi[a] - centers.lo[a];
+        if (extent <= 0) continue;
+        const float scale = SAH_BINS / extent;
+        Box bins[SAH_BINS];
+        int counts[SAH_BINS] = {};
+        for (int i = first; i < first + count; i++) {
+            int bin = std::min(SAH_BINS - 1, static_cast<int>((centroids[3 * order[i] + a] - centers.lo[a]) * scale));
+            bins[bin].grow(bounds[order[i]]);
+            counts[bin]++;
+        }
+        float right_area[SAH_BINS];
+        int right_count[SAH_BINS];
+        Box right;
+        int n = 0;
+        for (int b = SAH_BINS - 1; b > 0; b--) {
+            right.grow(bins[b]);
+            n += counts[b];
+            right_area[b] = right.area();
+            right_count[b] = n;
+        }
+        Box left;
+        n = 0;
+        for (int b = 1; b < SAH_BINS; b++) {
+            left.grow(bins[b - 1]);
+            n += counts[b - 1];
+            float cost = left.area() * n + right_area[b] * right_count[b];
+            if (n && right_count[b] && cost < best_cost) {
+                best_cost = cost;
+                best_axis = a;
+                best_split = b;
+            }
+        }
+    }
+    if (best_axis < 0 || (best_cost >= box.area() * count && count <= MAX_LEAF)) {
+        return leaf();
+    }
+
+    const float lo = centers.lo[best_axis], scale = SAH_BINS / (centers.hi[best_axis] - lo);
+    auto middle = std::partition(order.begin() + first, order.begin() + first + count, [&](int face) {
+        return std::min(SAH_BINS - 1, static_cast<int>((centroids[3 * face + best_axis] - lo) * scale)) < best_split;
+    });
+    const int left_count = static_cast<int>(middle - order.begin()) - first;
+    node(first, left_count, depth + 1);
+    int right = node(first + left_count, count - left_count, depth + 1);
+    nodes[index].first = right;
+    // inner nodes keep their split axis in count, so traversal can visit the near child first
+    nodes[index].count = -1 - best_axis;
+    return index;
+}
+
+Bvh::Bvh(Model const& model) {
+    PROFILE_SCOPE("bvh build");
+    const int n = static_cast<int>(model.number_of_faces());
+    Build build{std::vector<Box>(n), std::vector<float>(3 * n), std::vector<int>(n), nodes};
+    std::vector<Triangle> unordered(n);
+    for (int f = 0; f < n; f++) {
+        Vec3f v[3] = {model.vertex_at(f, 0), model.vertex_at(f, 1), model.vertex_at(f, 2)};
+        for (int a = 0; a < 3; a++) {
+            unordered[f].v0[a] = v[0][a];
+            unordered[f].e1[a] = v[1][a] - v[0][a];
+            unordered[f].e2[a] = v[2][a] - v[0][a];
+            build.centroids[3 * f + a] = (v[0][a] + v[1][a] + v[2][a]) / 3;
+        }
+        for (auto const& p : v) {
+            float xyz[3] = {p.x, p.y, p.z};
+            build.bounds[f].grow(xyz);
+        }
+        build.order[f] = f;
+    }
+    nodes.reserve(2 * n);
+    if (n) build.node(0, n, 1);
+    max_depth = build.max_depth;
+
+    triangles.resize(n);
+    faces = build.order;
+    for (int i = 0; i < n; i++) triangles[i] = unordered[faces[i]];
+}
+
+// lanes in active whose ray enters the box before t
+static inline int box_mask(const float lo[3], const float hi[3], Lanes const& r, const float* t, int active) {
+#ifdef __SSE2__
+    __m128 t_near = _mm_setzero_ps(), t_far = _mm_load_ps(t);
+    for (int a = 0; a < 3; a++) {
+        __m128 o = _mm_load_ps(r.o[a]), inv = _mm_load_ps(r.inv[a]);
+        __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(lo[a]), o), inv);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(hi[a]), o), inv);
+        t_near = _mm_max_ps(t_near, _mm_min_ps(t0, t1));
+        t_far = _mm_min_ps(t_far, _mm_max_ps(t0, t1));
+    }
+    return _mm_movemask_ps(_mm_cmple_ps(t_near, t_far)) & active;
+#else
+    int mask = 0;
+    for (int k = 0; k < RAY_PACKET; k++) {
+        float t_near = 0, t_far = t[k];
+        for (int a = 0; a < 3; a++) {
+            float t0 = (lo[a] - r.o[a][k]) * r.inv[a][k], t1 = (hi[a] - r.o[a][k]) * r.inv[a][k];
+            t_near = std::max(t_near, std::min(t0, t1));
+            t_far = std::min(t_far, std::max(t0, t1));
+        }
+        mask |= (t_near <= t_far) << k;
+    }
+    return mask & active;
+#endif
+}
+
+// Moller-Trumbore for every lane in active against one triangle: lanes hitting it before t
+// get their distance and weights written to t, u and v
+static inline int triangle_mask(const float v0[3], const float e1[3], const float e2[3], Lanes const& r,
+                                float* t, float* u, float* v, int active) {
+#ifdef __SSE2__
+    const __m128 dx = _mm_load_ps(r.d[0]), dy = _mm_load_ps(r.d[1]), dz = _mm_load_ps(r.d[2]);
+    const __m128 e1x = _mm_set1_ps(e1[0]), e1y = _mm_set1_ps(e1[1]), e1z = _mm_set1_ps(e1[2]);
+    const __m128 e2x = _mm_set1_ps(e2[0]), e2y = _mm_set1_ps(e2[1]), e2z = _mm_set1_ps(e2[2]);
+    // p = d x e2
+    __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+    __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+    __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+    __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+    __m128 inv = _mm_div_ps(_mm_set1_ps(1), det);
+    // s = o - v0, q = s x e1
+    __m128 sx = _mm_sub_ps(_mm_load_ps(r.o[0]), _mm_set1_ps(v0[0]));
+    __m128 sy = _mm_sub_ps(_mm_load_ps(r.o[1]), _mm_set1_ps(v0[1]));
+    __m128 sz = _mm_sub_ps(_mm_load_ps(r.o[2]), _mm_set1_ps(v0[2]));
+    __m128 uu = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inv);
+    __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+    __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+    __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+    __m128 vv = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inv);
+    __m128 tt = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv);
+    // comparisons with the NaNs of parallel rays fail, so those never hit
+    __m128 hit = _mm_and_ps(_mm_cmpge_ps(uu, _mm_setzero_ps()), _mm_cmpge_ps(vv, _mm_setzero_ps()));
+    hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(uu, vv), _mm_set1_ps(1)));
+    hit = _mm_and_ps(hit, _mm_cmpgt_ps(tt, _mm_set1_ps(RAY_EPSILON)));
+    hit = _mm_and_ps(hit, _mm_cmplt_ps(tt, _mm_load_ps(t)));
+    const int mask = _mm_movemask_ps(hit) & active;
+    if (mask) {
+        _mm_store_ps(t, _mm_or_ps(_mm_and_ps(hit, tt), _mm_andnot_ps(hit, _mm_load_ps(t))));
+        _mm_store_ps(u, _mm_or_ps(_mm_and_ps(hit, uu), _mm_andnot_ps(hit, _mm_load_ps(u))));
+        _mm_store_ps(v, _mm_or_ps(_mm_and_ps(hit, vv), _mm_andnot_ps(hit, _mm_load_ps(v))));
+    }
+    return mask;
+#else
+    int mask = 0;
+    for (int k = 0; k < RAY_PACKET; k++) {
+        if (!(active >> k & 1)) continue;
+        const float dx = r.d[0][k], dy = r.d[1][k], dz = r.d[2][k];
+        float px = dy * e2[2] - dz * e2[1], py = dz * e2[0] - dx * e2[2], pz = dx * e2[1] - dy * e2[0];
+        float inv = 1 / (e1[0] * px + e1[1] * py + e1[2] * pz);
+        float sx = r.o[0][k] - v0[0], sy = r.o[1][k] - v0[1], sz = r.o[2][k] - v0[2];
+        float uu = (sx * px + sy * py + sz * pz) * inv;
+        float qx = sy * e1[2] - sz * e1[1], qy = sz * e1[0] - sx * e1[2], qz = sx * e1[1] - sy * e1[0];
+        float vv = (dx * qx + dy * qy + dz * qz) * inv;
+        float tt = (e2[0] * qx + e2[1] * qy + e2[2] * qz) * inv;
+        if (uu >= 0 && vv >= 0 && uu + vv <= 1 && tt > RAY_EPSILON && tt < t[k]) {
+            t[k] = tt;
+            u[k] = uu;
+            v[k] = vv;
+            mask |= 1 << k;
+        }
+    }
+    return mask;
+#endif
+}
+
+// Walks the tree once for the whole packet, entering a node when any of its rays enters
+// it. Returns the lanes that hit something; with AnyHit a lane stops at its first hit and
+// hits is not written.
+template <bool AnyHit>
+int Bvh::traverse(RayPacket const& packet, RayHit hits[RAY_PACKET]) const {
+    Lanes r;
+    alignas(16) float t[RAY_PACKET], u[RAY_PACKET] = {}, v[RAY_PACKET] = {};
+    int face[RAY_PACKET];
+    const float* origin[3] = {packet.ox, packet.oy, packet.oz};
+    const float* direction[3] = {packet.dx, packet.dy, packet.dz};
+    int active = 0;
+    for (int k = 0; k < RAY_PACKET; k++) {
+        for (int a = 0; a < 3; a++) {
+            r.o[a][k] = origin[a][k];
+            r.d[a][k] = direction[a][k];
+            r.inv[a][k] = 1 / direction[a][k];
+        }
+        t[k] = packet.t_max[k];
+        face[k] = -1;
+        active |= (t[k] > 0) << k;
+    }
+    if (nodes.empty()) return 0;
+
+    int hit = 0;
+    // inner nodes push both children, so the stack never holds more than max_depth + 1
+    assert(max_depth <= MAX_DEPTH);
+    int stack[MAX_DEPTH + 1];
+    int top = 0;
+    stack[top++] = 0;
+    while (top) {
+        Node const& node = nodes[stack[--top]];
+        if (!box_mask(node.lo, node.hi, r, t, active)) continue;
+        if (node.count > 0) {
+            for (int i = node.first; i < node.first + node.count; i++) {
+                Triangle const& tri = triangles[i];
+                int mask = triangle_mask(tri.v0, tri.e1, tri.e2, r, t, u, v, active);
+                if (!mask) continue;
+                hit |= mask;
+                if (AnyHit) {
+                    active &= ~mask;
+                    if (!active) return hit;
+                } else {
+                    for (int k = 0; k < RAY_PACKET; k++) {
+                        if (mask >> k & 1) face[k] = faces[i];
+                    }
+                }
+            }
+            continue;
+        }
+        // the near child goes on top, judged by the first active ray along the split axis
+        const int axis = -1 - node.count;
+        const int first_active = __builtin_ctz(active);
+        const int left = static_cast<int>(&node - nodes.data()) + 1, right = node.first;
+        if (r.d[axis][first_active] >= 0) {
+            stack[top++] = right;
+            stack[top++] = left;
+        } else {
+            stack[top++] = left;
+            stack[top++] = right;
+        }
+    }
+    if (!AnyHit) {
+        for (int k = 0; k < RAY_PACKET; k++) {
+            hits[k] = face[k] < 0 ? RayHit{} : RayHit{face[k], t[k], u[k], v[k]};
+        }
+    }
+    return hit;
+}
+
+void Bvh::intersect(RayPacket const& packet, RayHit hits[RAY_PACKET]) const {
+    traverse<false>(packet, hits);
+}
+
+int Bvh::occluded(RayPacket const& packet) const {
+    return traverse<true>(packet, nullptr);
+}
+
+// single rays take a packet of their own with the other lanes switched off
+static RayPacket single(Ray const& ray) {
+    RayPacket packet{};
+    for (int k = 0; k < RAY_PACKET; k++) packet.set(k, ray);
+    for (int k = 1; k < RAY_PACKET; k++) packet.t_max[k] = 0;
+    return packet;
+}
+
+RayHit Bvh::intersect(Ray const& ray) const {
+    RayHit hits[RAY_PACKET];
+    traverse<false>(single(ray), hits);
+    return hits[0];
+}
+
+bool Bvh::occluded(Ray const& ray) const {
+    return traverse<true>(single(ray), nullptr) & 1;
+}
+
+void Bvh::intersect(std::vector<Ray> const& rays, std::vector<RayHit>& hits) const {
+    hits.resize(rays.size());
+    const int packets = static_cast<int>((rays.size() + RAY_PACKET - 1) / RAY_PACKET);
+    Scheduler::instance().parallel_for(0, packets, 64, [&](int first, int last) {
+        PROFILE_SCOPE("ray cast");
+        for (int p = first; p < last; p++) {
+            RayPacket packet{};
+            RayHit packet_hits[RAY_PACKET];
+            const size_t base = static_cast<size_t>(p) * RAY_PACKET;
+            const int n = static_cast<int>(std::min<size_t>(RAY_PACKET, rays.size() - base));
+            for (int k = 0; k < n; k++) packet.set(k, rays[base + k]);
+            traverse<false>(packet, packet_hits);
+            std::copy(packet_hits, packet_hits + n, hits.begin() + base);
+        }
+    });
+}
+
+void Bvh::occluded(std::vector<Ray> const& rays, std::vector<uint8_t>& blocked) const {
+    blocked.resize(rays.size());
+    const int packets = static_cast<int>((rays.size() + RAY_PACKET - 1) / RAY_PACKET);
+    Scheduler::instance().parallel_for(0, packets, 64, [&](int first, int last) {
+        PROFILE_SCOPE("ray cast");
+        for (int p = first; p < last; p++) {
+            RayPacket packet{};
+            const size_t base = static_cast<size_t>(p) * RAY_PACKET;
+            const int n = static_cast<int>(std::min<size_t>(RAY_PACKET, rays.size() - base));
+            for (int k = 0; k < n; k++) packet.set(k, rays[base + k]);
+            const int mask = traverse<true>(packet, nullptr);
+            for (int k = 0; k < n; k++) blocked[base + k] = mask >> k & 1;
+        }
+    });
+}
@@ -0,0 +1,82 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "model.h"
+#include "vec.h"
+
+// a ray from origin along direction, which need not be normalized; only hits with t in
+// (0, t_max) count, t in units of direction
+struct Ray {
+    Vec3f origin;
+    Vec3f direction;
+    float t_max = std::numeric_limits<float>::max();
+};
+
+struct RayHit {
+    int face = -1; // -1 when nothing was hit
+    float t = 0;
+    // barycentric weights of the face's second and third vertex at the hit
+    float u = 0, v = 0;
+};
+
+// rays traced together through the tree, one SSE lane each
+constexpr int RAY_PACKET = 4;
+
+// RAY_PACKET rays in SoA layout; unused lanes get t_max 0
+struct RayPacket {
+    alignas(16) float ox[RAY_PACKET], oy[RAY_PACKET], oz[RAY_PACKET];
+    alignas(16) float dx[RAY_PACKET], dy[RAY_PACKET], dz[RAY_PACKET];
+    alignas(16) float t_max[RAY_PACKET];
+
+    void set(int lane, Ray const& ray);
+};
+
+// Bounding volume hierarchy over the faces of a model, built with the surface area heuristic
+// over binned centroids. Queries are read-only and may run on any number of threads.
+// Packets work best for rays that start close together, like the hemisphere of one texel
+class Bvh {
+public:
+    explicit Bvh(Model const& model);
+
+    // the closest hit along the ray
+    [[nodiscard]] RayHit intersect(Ray const& ray) const;
+    // whether anything lies along the ray, stopping at the first hit found
+    [[nodiscard]] bool occluded(Ray const& ray) const;
+
+    void intersect(RayPacket const& packet, RayHit hits[RAY_PACKET]) const;
+    // bit i set when ray i of the packet is blocked
+    [[nodiscard]] int occluded(RayPacket const& packet) const;
+
+    // whole batches in packets over the Scheduler threads
+    void intersect(std::vector<Ray> const& rays, std::vector<RayHit>& hits) const;
+    void occluded(std::vector<Ray> const& rays, std::vector<uint8_t>& blocked) const;
+
+    [[nodiscard]] size_t node_count() const { return nodes.size(); }
+    [[nodiscard]] int depth() const { return max_depth; }
+
+private:
+    // leaves have count > 0 triangles from first; inner nodes have their children at
+    // index + 1 and first
+    struct Node {
+        float lo[3], hi[3];
+        int first, count;
+    };
+    // the first vertex and the edges to the other two, as Moller-Trumbore wants them
+    struct Triangle {
+        float v0[3], e1[3], e2[3];
+    };
+    struct Build;
+
+    std::vector<Node> nodes;
+    std::vector<Triangle> triangles;
+    // the model face of each entry of triangles
+    std::vector<int> faces;
+    int max_depth = 0;
+
+    template <bool AnyHit> int traverse(RayPacket const& packet, RayHit hits[RAY_PACKET]) const;
+};
+
+#endif //BVH_H
@@ -0,0 +1,215 @@
+#include <iostream>
+#include "command_buffer.h"
+#include "gl.h"
+#include "image_codec.h"
+#include "profiler.h"
+#include "utils.h"
+
+bool Fence::ready() const {
+    return !done.valid() || done.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+void Fence::wait() const {
+    if (done.valid()) done.get();
+}
+
+void CommandBuffer::begin_frame(int width, int height) {
+    commands.emplace_back(BeginFrame{width, height});
+}
+
+void CommandBuffer::bind_model(std::shared_ptr<const Model> model) {
+    std::promise<std::shared_ptr<const Model>> ready;
+    ready.set_value(std::move(model));
+    commands.emplace_back(BindModel{ready.get_future().share()});
+}
+
+void CommandBuffer::bind_model(ModelHandle const &handle) {
+    commands.emplace_back(BindModel{std::async(std::launch::deferred, [handle] { return handle.get(); }).share()});
+}
+
+void CommandBuffer::set_shader(ShaderType type) {
+    commands.emplace_back(SetShader{type});
+}
+
+void CommandBuffer::set_uniforms(Uniforms const &uniforms) {
+    commands.emplace_back(SetUniforms{uniforms});
+}
+
+void CommandBuffer::draw() {
+    commands.emplace_back(Draw{});
+}
+
+void CommandBuffer::present(std::string filename) {
+    commands.emplace_back(Present{std::move(filename), nullptr});
+}
+
+void CommandBuffer::present(Presenter presenter) {
+    commands.emplace_back(Present{"", std::move(presenter)});
+}
+
+FrameExecutor::FrameExecutor()
+: submitted(SIZE_MAX), prepared(1), rasterized(1) {
+    vertex_thread = std::thread(&FrameExecutor::vertex_stage, this);
+    raster_thread = std::thread(&FrameExecutor::raster_stage, this);
+    present_thread = std::thread(&FrameExecutor::present_stage, this);
+}
+
+FrameExecutor::~FrameExecutor() {
+    // each stage closes the queue after it once its input runs dry
+    submitted.close();
+    vertex_thread.join();
+    raster_thread.join();
+    present_thread.join();
+}
+
+Fence FrameExecutor::submit(CommandBuffer buffer) {
+    auto fence = std::make_shared<std::promise<void>>();
+    Fence result;
+    result.done = fence->get_future().share();
+    submitted.push({std::move(buffer), std::move(fence)});
+    return result;
+}
+
+int FrameExecutor::frames_presented() const {
+    return presented.load();
+}
+
+void FrameExecutor::fail(std::exception_ptr thrown) {
+    std::lock_guard lock(error_mutex);
+    if (!error) error = std::move(thrown);
+}
+
+std::exception_ptr FrameExecutor::failure() const {
+    std::lock_guard lock(error_mutex);
+    return error;
+}
+
+void FrameExecutor::vertex_stage() {
+    Submission submission;
+    while (submitted.pop(submission)) {
+        std::shared_future<std::shared_ptr<const Model>> model;
+        ShaderType shader_type = PHONG_SHADER;
+        Uniforms uniforms{};
+        std::unique_ptr<Frame> frame;
+
+        try {
+            for (auto &command : submission.buffer.commands) {
+                if (failure()) break;
+                if (auto *begin = std::get_if<CommandBuffer::BeginFrame>(&command)) {
+                    frame = std::make_unique<Frame>();
+                    frame->width = begin->width;
+                    frame->height = begin->height;
+                } else if (auto *bind = std::get_if<CommandBuffer::BindModel>(&command)) {
+                    model = bind->model;
+                } else if (auto *set = std::get_if<CommandBuffer::SetShader>(&command)) {
+                    shader_type = set->type;
+                } else if (auto *set = std::get_if<CommandBuffer::SetUniforms>(&command)) {
+                    uniforms = set->uniforms;
+                } else if (std::holds_alternative<CommandBuffer::Draw>(command)) {
+                    if (!frame || !model.valid()) {
+                        std::cerr << "draw without a frame or a model, skipped\n";
+                        continue;
+                    }
+                    PreparedDraw draw;
+                    draw.model = model.get();
+                    if (!draw.model) {
+                        std::cerr << "draw of a model that did not load, skipped\n";
+                        continue;
+                    }
+                    draw.shader = make_shader(shader_type);
+                    draw.shader->set_uniforms(uniforms);
+                    draw.varyings = Varyings(draw.model->number_of_faces(), draw.shader->varyings());
+                    auto mvpscr = viewport_transform(frame->width, frame->height, 255) * (uniforms.projection * uniforms.view);
+                    Model const &m = *draw.model;
+                    Shader const &shader = *draw.shader;
+                    bin_faces(m.number_of_faces(), {0, 0, frame->width, frame->height}, [&](int face_id, ScreenTriangle &coords) {
+                        VertexData vd = draw.varyings.reset(face_id);
+                        for (int j = 0; j < 3; j++) {
+                            auto [x, y, z] = transform(shader.eval_vertex(m, face_id, j, vd), mvpscr).view();
+                            coords[j] = Vec3i(x, y, z);
+                        }
+                    }, draw.faces);
+                    frame->draws.push_back(std::move(draw));
+                } else if (auto *present = std::get_if<CommandBuffer::Present>(&command)) {
+                    if (!frame) {
+                        std::cerr << "present without a frame, skipped\n";
+                        continue;
+                    }
+                    frame->present = std::move(*present);
+                    prepared.push(std::move(frame));
+                }
+            }
+        } catch (...) {
+            fail(std::current_exception());
+        }
+        if (frame && !failure()) std::cerr << "frame without present dropped\n";
+
+        // the fence trails the buffer's frames through the later stages
+        auto marker = std::make_unique<Frame>();
+        marker->fence = std::move(submission.fence);
+        prepared.push(std::move(marker));
+    }
+    prepared.close();
+}
+
+void FrameExecutor::raster_stage() {
+    std::unique_ptr<Frame> frame;
+    while (prepared.pop(frame)) {
+        if (!frame->fence) {
+            if (failure()) continue;
+            try {
+                if (!framebuffer || framebuffer->get_width() != frame->width || framebuffer->get_height() != frame->height) {
+                    framebuffer = std::make_unique<ColorTarget>(frame->width, frame->height);
+                    zbuffer = std::make_unique<DepthTarget>(frame->width, frame->height);
+                } else {
+                    framebuffer->clear();
+                    zbuffer->clear();
+                }
+                for (auto &draw : frame->draws) {
+                    raster_bins(draw.faces, [&](int face_id, ScreenTriangle const &coords, ScreenRect const &clip) {
+                        shading_triangle(coords[0].x, coords[0].y, coords[0].z,
+                                         coords[1].x, coords[1].y, coords[1].z,
+                                         coords[2].x, coords[2].y, coords[2].z,
+                                         *draw.model, *framebuffer, *zbuffer, clip, *draw.shader, draw.varyings[face_id]);
+                    });
+                }
+                frame->draws.clear();
+                frame->image.emplace(ImagePool::instance().acquire(frame->width, frame->height, TGAImage::RGB));
+                resolve(*framebuffer, **frame->image);
+            } catch (...) {
+                fail(std::current_exception());
+                continue;
+            }
+        }
+        rasterized.push(std::move(frame));
+    }
+    rasterized.close();
+}
+
+void FrameExecutor::present_stage() {
+    std::unique_ptr<Frame> frame;
+    while (rasterized.pop(frame)) {
+        if (frame->fence) {
+            if (auto thrown = failure()) frame->fence->set_exception(thrown);
+            else frame->fence->set_value();
+            continue;
+        }
+        if (failure()) continue;
+        PROFILE_SCOPE("present");
+        TGAImage &image = **frame->image;
+        try {
+            if (frame->present.presenter) {
+                frame->present.presenter(image);
+            } else {
+                image.flip_vertically();
+                if (!image.write_image_file(frame->present.filename.c_str(), encoder_for(frame->present.filename.c_str()))) {
+                    std::cerr << "can't write " << frame->present.filename << "\n";
+                }
+            }
+        } catch (...) {
+            fail(std::current_exception());
+            continue;
+        }
+        presented++;
+    }
+}
@@ -0,0 +1,177 @@
+#ifndef COMMAND_BUFFER_H
+#define COMMAND_BUFFER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <variant>
+#include <vector>
+#include "asset_loader.h"
+#include "image_pool.h"
+#include "pipeline.h"
+#include "shaders.h"
+
+// Signals that everything recorded in a submitted command buffer has been presented.
+class Fence {
+    std::shared_future<void> done;
+
+    friend class FrameExecutor;
+public:
+    [[nodiscard]] bool ready() const;
+    // rethrows the exception that stopped the executor, if one did before the buffer finished
+    void wait() const;
+};
+
+// A recorded list of frames for a FrameExecutor; recording does no work. Bound state
+// (model, shader, uniforms) applies to every later draw in the buffer, across frames.
+class CommandBuffer {
+public:
+    // receives the color image with row 0 at the bottom, on the executor's present thread;
+    // the image is the presenter's to keep or swap for another of the same size
+    using Presenter = std::function<void(TGAImage &)>;
+
+    // starts a frame with cleared color and depth targets
+    void begin_frame(int width, int height);
+    void bind_model(std::shared_ptr<const Model> model);
+    // the model is waited for by the first draw that uses it
+    void bind_model(ModelHandle const &handle);
+    void set_shader(ShaderType type);
+    void set_uniforms(Uniforms const &uniforms);
+    // draws every face of the bound model with the bound shader and uniforms
+    void draw();
+    // ends the frame by writing it top-down to filename, encoded as its extension says
+    void present(std::string filename);
+    void present(Presenter presenter);
+
+    [[nodiscard]] size_t size() const { return commands.size(); }
+
+private:
+    friend class FrameExecutor;
+
+    struct BeginFrame {
+        int width, height;
+    };
+    struct BindModel {
+        std::shared_future<std::shared_ptr<const Model>> model;
+    };
+    struct SetShader {
+        ShaderType type;
+    };
+    struct SetUniforms {
+        Uniforms uniforms;
+    };
+    struct Draw {
+    };
+    struct Present {
+        std::string filename;
+        Presenter presenter;
+    };
+    using Command = std::variant<BeginFrame, BindModel, SetShader, SetUniforms, Draw, Present>;
+
+    std::vector<Command> commands;
+};
+
+// Runs submitted command buffers in order on three stage threads: vertex processing and
+// binning, then rasterization and resolve, then encoding and presenting. Stages hand
+// frames on through queues one frame deep, so while frame N is rasterized frame N+1 is in
+// the vertex stage and frame N-1 is being encoded. Each stage spreads its own work over
+// the Scheduler. The first exception a stage throws, say from a model that failed to load
+// or from a presenter, stops the pipeline: later frames are dropped and the fences of the
+// buffers not finished by then rethrow it.
+class FrameExecutor {
+public:
+    FrameExecutor();
+    FrameExecutor(const FrameExecutor &) = delete;
+    FrameExecutor &operator=(const FrameExecutor &) = delete;
+    // finishes everything submitted
+    ~FrameExecutor();
+
+    Fence submit(CommandBuffer buffer);
+    [[nodiscard]] int frames_presented() const;
+
+private:
+    // blocking FIFO between two stages, push waits while it holds capacity items
+    template <typename T> class StageQueue {
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::deque<T> items;
+        size_t capacity;
+        bool closed = false;
+
+    public:
+        explicit StageQueue(size_t capacity) : capacity(capacity) {}
+
+        void push(T item) {
+            std::unique_lock lock(mutex);
+            changed.wait(lock, [this] { return items.size() < capacity; });
+            items.push_back(std::move(item));
+            changed.notify_all();
+        }
+
+        // false once the queue is closed and empty
+        bool pop(T &item) {
+            std::unique_lock lock(mutex);
+            changed.wait(lock, [this] { return closed || !items.empty(); });
+            if (items.empty()) return false;
+            item = std::move(items.front());
+            items.pop_front();
+            changed.notify_all();
+            return true;
+        }
+
+        void close() {
+            std::lock_guard lock(mutex);
+            closed = true;
+            changed.notify_all();
+        }
+    };
+
+    struct Submission {
+        CommandBuffer buffer;
+        std::shared_ptr<std::promise<void>> fence;
+    };
+
+    // one draw after the vertex stage
+    struct PreparedDraw {
+        std::shared_ptr<const Model> model;
+        std::unique_ptr<Shader> shader;
+        Varyings varyings;
+        BinnedFaces faces;
+    };
+
+    // a frame on its way through the stages, or only the fence of a finished buffer
+    struct Frame {
+        int width = 0, height = 0;
+        std::vector<PreparedDraw> draws;
+        CommandBuffer::Present present;
+        std::optional<PooledImage> image;
+        std::shared_ptr<std::promise<void>> fence;
+    };
+
+    StageQueue<Submission> submitted;
+    StageQueue<std::unique_ptr<Frame>> prepared;
+    StageQueue<std::unique_ptr<Frame>> rasterized;
+    std::unique_ptr<ColorTarget> framebuffer;
+    std::unique_ptr<DepthTarget> zbuffer;
+    std::atomic<int> presented{0};
+    mutable std::mutex error_mutex;
+    std::exception_ptr error;
+    std::thread vertex_thread, raster_thread, present_thread;
+
+    // keeps the first exception of any stage
+    void fail(std::exception_ptr thrown);
+    [[nodiscard]] std::exception_ptr failure() const;
+    void vertex_stage();
+    void raster_stage();
+    void present_stage();
+};
+
+#endif //COMMAND_BUFFER_H
@@ -0,0 +1,212 @@
+#include <cctype>
+#include <iostream>
+#include <utility>
+#include "frame_sink.h"
+#include "image_codec.h"
+
+// splits a file name pattern at its one %d or %0Nd; false when it has no such conversion,
+// another one, or any other %
+static bool split_pattern(std::string const &pattern, std::string &prefix, int &digits, std::string &suffix) {
+    const size_t at = pattern.find('%');
+    if (at == std::string::npos) return false;
+    size_t end = at + 1;
+    digits = 0;
+    if (end < pattern.size() && pattern[end] == '0') {
+        end++;
+        if (end >= pattern.size() || !std::isdigit(static_cast<unsigned char>(pattern[end]))) return false;
+        for (; end < pattern.size() && std::isdigit(static_cast<unsigned char>(pattern[end])) && digits < 100; end++) {
+            digits = digits * 10 + (pattern[end] - '0');
+        }
+    }
+    if (end >= pattern.size() || pattern[end] != 'd' || pattern.find('%', end) != std::string::npos) return false;
+    prefix = pattern.substr(0, at);
+    suffix = pattern.substr(end + 1);
+    return true;
+}
+
+FrameSink::FrameSink(Format format, std::string target, int width, int height, int bytespp, size_t queue_depth)
+: format(format), target(std::move(target)), digits(0), width(width), height(height), stream(nullptr),
+  piped(false), failed(false), closing(false), written(0) {
+    if (format == TGA_SEQUENCE) {
+        if (!split_pattern(this->target, prefix, digits, suffix)) {
+            std::cerr << "frame pattern " << this->target << " needs exactly one %d or %0Nd and no other %\n";
+            digits = -1;
+            failed = true;
+        }
+    } else {
+        if (this->target == "-") {
+            stream = stdout;
+        } else if (!this->target.empty() && this->target[0] == '|') {
+            stream = popen(this->target.c_str() + 1, "w");
+            piped = true;
+        } else {
+            stream = fopen(this->target.c_str(), "wb");
+        }
+        if (!stream) {
+            std::cerr << "can't open frame stream " << this->target << "\n";
+            failed = true;
+        }
+    }
+    buffers.reserve(queue_depth + 1);
+    for (size_t i = 0; i < queue_depth + 1; i++) {
+        buffers.push_back(ImagePool::instance().acquire(width, height, bytespp));
+        free_buffers.push_back(&*buffers.back());
+    }
+    writer = std::thread(&FrameSink::run, this);
+}
+
+FrameSink::~FrameSink() {
+    close();
+}
+
+TGAImage &FrameSink::acquire() {
+    TGAImage *frame;
+    {
+        std::unique_lock lock(mutex);
+        buffer_free.wait(lock, [this] { return !free_buffers.empty(); });
+        frame = free_buffers.back();
+        free_buffers.pop_back();
+    }
+    frame->clear();
+    return *frame;
+}
+
+void FrameSink::submit(TGAImage &frame) {
+    {
+        std::lock_guard lock(mutex);
+        queue.push_back(&frame);
+    }
+    frame_ready.notify_one();
+}
+
+bool FrameSink::submit_swap(TGAImage &image) {
+    TGAImage *frame;
+    {
+        std::unique_lock lock(mutex);
+        buffer_free.wait(lock, [this] { return !free_buffers.empty(); });
+        frame = free_buffers.back();
+        if (image.get_width() != frame->get_width() || image.get_height() != frame->get_height() ||
+            image.get_bytespp() != frame->get_bytespp()) {
+            return false;
+        }
+        free_buffers.pop_back();
+    }
+    std::swap(*frame, image);
+    submit(*frame);
+    return true;
+}
+
+bool FrameSink::close() {
+    {
+        std::lock_guard lock(mutex);
+        closing = true;
+    }
+    frame_ready.notify_one();
+    if (writer.joinable()) writer.join();
+    if (stream) {
+        if (fflush(stream) != 0) failed = true;
+        if (piped) {
+            if (pclose(stream) != 0) failed = true;
+        } else if (stream != stdout) {
+            fclose(stream);
+        }
+        stream = nullptr;
+    }
+    return !failed;
+}
+
+int FrameSink::frames_written() const {
+    std::lock_guard lock(mutex);
+    return written;
+}
+
+bool FrameSink::ok() const {
+    std::lock_guard lock(mutex);
+    return !failed;
+}
+
+void FrameSink::run() {
+    for (int index = 0;; index++) {
+        TGAImage *frame;
+        {
+            std::unique_lock lock(mutex);
+            frame_ready.wait(lock, [this] { return closing || !queue.empty(); });
+            if (queue.empty()) return;
+            frame = queue.front();
+            queue.pop_front();
+        }
+        bool ok = write_frame(*frame, index);
+        {
+            std::lock_guard lock(mutex);
+            if (ok) written++;
+            else failed = true;
+            free_buffers.push_back(frame);
+        }
+        buffer_free.notify_one();
+    }
+}
+
+bool FrameSink::write_frame(TGAImage &frame, int index) {
+    if (format == TGA_SEQUENCE) {
+        if (digits < 0) return false;
+        std::string number = std::to_string(index);
+        if (static_cast<int>(number.size()) < digits) number.insert(0, digits - number.size(), '0');
+        const std::string name = prefix + number + suffix;
+        frame.flip_vertically();
+        return frame.write_image_file(name.c_str(), encoder_for(name.c_str()));
+    }
+    if (!stream) return false;
+    if (format == Y4M_STREAM && index == 0) {
+        fprintf(stream, "YUV4MPEG2 W%d H%d F25:1 Ip A1:1 C444\n", width, height);
+    }
+    return write_stream_frame(frame);
+}
+
+bool FrameSink::write_stream_frame(const TGAImage &frame) {
+    const int bpp = frame.get_bytespp();
+    std::vector<unsigned char> line(static_cast<size_t>(width) * 3);
+    auto bgr = [&](const unsigned char *p, unsigned char &b, unsigned char &g, unsigned char &r) {
+        b = p[0];
+        g = bpp > 1 ? p[1] : p[0];
+        r = bpp > 1 ? p[2] : p[0];
+    };
+
+    if (format == PPM_STREAM) fprintf(stream, "P6\n%d %d\n255\n", width, height);
+    if (format == Y4M_STREAM) fputs("FRAME\n", stream);
+
+    if (format == Y4M_STREAM) {
+        // planar BT.601 studio swing, one plane at a time
+        for (int plane = 0; plane < 3; plane++) {
+            for (int y = height; y--;) {
+                const unsigned char *src = frame.row(y);
+                for (int x = 0; x < width; x++, src += bpp) {
+                    unsigned char b, g, r;
+                    bgr(src, b, g, r);
+                    int v;
+                    if (plane == 0) v = 16 + ((66 * r + 129 * g + 25 * b + 128) >> 8);
+                    else if (plane == 1) v = 128 + ((-38 * r - 74 * g + 112 * b + 128) >> 8);
+                    else v = 128 + ((112 * r - 94 * g - 18 * b + 128) >> 8);
+                    line[x] = static_cast<unsigned char>(v);
+                }
+                if (fwrite(line.data(), 1, width, stream) != static_cast<size_t>(width)) return false;
+            }
+        }
+        return true;
+    }
+
+    for (int y = height; y--;) {
+        const unsigned char *src = frame.row(y);
+        unsigned char *dst = line.data();
+        for (int x = 0; x < width; x++, src += bpp, dst += 3) {
+            unsigned char b, g, r;
+            bgr(src, b, g, r);
+            if (format == PPM_STREAM) {
+                dst[0] = r; dst[1] = g; dst[2] = b;
+            } else {
+                dst[0] = b; dst[1] = g; dst[2] = r;
+            }
+        }
+        if (fwrite(line.data(), 1, line.size(), stream) != line.size()) return false;
+    }
+    return true;
+}
@@ -0,0 +1,80 @@
+#ifndef FRAME_SINK_H
+#define FRAME_SINK_H
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "image_pool.h"
+#include "tgaimage.h"
+
+// Writes a sequence of frames from a background thread.
+// The sink borrows queue_depth+1 framebuffers from the ImagePool: the renderer acquire()s
+// one, draws into it and submit()s it; the writer encodes and writes it while the next one
+// is drawn, then hands it back. Frames are expected bottom-up, the way the rasterizer
+// produces them.
+class FrameSink {
+public:
+    enum Format {
+        TGA_SEQUENCE, // one file per frame from a pattern such as "frame_%04d.tga" with a single
+                      // %d or %0Nd and no other %, encoded as QOI or PNG instead when the
+                      // pattern ends in .qoi or .png
+        PPM_STREAM,   // concatenated binary PPMs
+        Y4M_STREAM,   // YUV4MPEG2 4:4:4, readable by ffmpeg/x264 from a pipe
+        RAW_STREAM    // headerless bgr24 rows, top row first
+    };
+
+    // For streams the target is a file path, "-" for stdout or "|command" to pipe into a process.
+    // A target that can't be opened or a bad pattern leaves the sink failed: ok() is false and
+    // nothing is written.
+    FrameSink(Format format, std::string target, int width, int height, int bytespp = TGAImage::RGB,
+              size_t queue_depth = 1);
+    FrameSink(const FrameSink &) = delete;
+    FrameSink &operator=(const FrameSink &) = delete;
+    ~FrameSink();
+
+    // blocks until the writer has released a framebuffer, returns it cleared
+    TGAImage &acquire();
+    void submit(TGAImage &frame);
+    // submits an image drawn elsewhere without copying it: it trades pixels with a released
+    // framebuffer, which it is left holding. Blocks like acquire; false, and nothing
+    // submitted, when its size or format is not the sink's
+    bool submit_swap(TGAImage &image);
+    // waits for every submitted frame to be written, returns false if any write failed
+    bool close();
+    [[nodiscard]] int frames_written() const;
+    [[nodiscard]] bool ok() const;
+
+private:
+    Format format;
+    std::string target;
+    // TGA_SEQUENCE: the file names are prefix, the frame index zero-padded to digits, suffix;
+    // digits is -1 when the pattern was rejected
+    std::string prefix;
+    std::string suffix;
+    int digits;
+    int width;
+    int height;
+    FILE *stream;
+    bool piped;
+    bool failed;
+    bool closing;
+    int written;
+
+    std::vector<PooledImage> buffers;
+    std::vector<TGAImage *> free_buffers;
+    std::deque<TGAImage *> queue;
+    mutable std::mutex mutex;
+    std::condition_variable frame_ready;
+    std::condition_variable buffer_free;
+    std::thread writer;
+
+    void run();
+    bool write_frame(TGAImage &frame, int index);
+    bool write_stream_frame(const TGAImage &frame);
+};
+
+#endif //FRAME_SINK_H
@@ -1,8 +1,14 @@
 #ifndef GL_H
 #define GL_H
+#include <atomic>
 #include <functional>
+#include <utility>
 
+#include "profiler.h"
+#include "render_target.h"
+#include "scheduler.h"
 #include "shader.h"
+#include "shading_rate.h"
 #include "tgaimage.h"
 #include "vec.h"
 
@@ -43,8 +49,13 @@ inline void line(int ax, int ay, int bx, int by, TGAImage &framebuffer, const TG
     }
 }
 
+// twice the signed area, exact in integers; linear in every vertex coordinate
+inline int double_signed_triangle_area(int ax, int ay, int bx, int by, int cx, int cy) {
+    return (by - ay) * (bx + ax) + (cy - by) * (cx + bx) + (ay - cy) * (ax + cx);
+}
+
 inline double signed_triangle_area(int ax, int ay, int bx, int by, int cx, int cy) {
-    return 0.5 * ((by - ay) * (bx + ax) + (cy - by) * (cx + bx) + (ay - cy) * (ax + cx));
+    return 0.5 * double_signed_triangle_area(ax, ay, bx, by, cx, cy);
 }
 
 inline Vec3d barycentric_coords_2d(int ax, int ay, int bx, int by, int cx, int cy,
@@ -65,70 +76,302 @@ inline void triangle(int ax, int ay, int az, int bx, int by, int bz, int cx, int
     double area = signed_triangle_area(ax, ay, bx, by, cx, cy);
     // we removed back face culling because we want it be order independent
 
-#pragma omp parallel for
-    for (int x = xMin; x <= xMax; x++) {
-        for (int y = yMin; y < yMax; y++) {
-            auto [alpha, beta, gamma] = barycentric_coords_2d(ax, ay, bx, by, cx, cy, x, y, area).view();
-            if (alpha < 0 || beta < 0 || gamma < 0) {
-                continue;
+    Scheduler::instance().parallel_for(xMin, xMax + 1, 32, [&](int x0, int x1) {
+        for (int x = x0; x < x1; x++) {
+            for (int y = yMin; y < yMax; y++) {
+                auto [alpha, beta, gamma] = barycentric_coords_2d(ax, ay, bx, by, cx, cy, x, y, area).view();
+                if (alpha < 0 || beta < 0 || gamma < 0) {
+                    continue;
+                }
+                framebuffer.set(x, y, color_picker(alpha, beta, gamma));
             }
-            framebuffer.set(x, y, color_picker(alpha, beta, gamma));
         }
-    }
+    });
 }
 
-inline void triangle_with_z(int ax, int ay, int az, int bx, int by, int bz, int cx, int cy, int cz,
-                            TGAImage &framebuffer, TGAImage &zbuffer,
-                            const std::function<const TGAColor(double, double, double)>& color_picker) {
-    int xMin = std::min(ax, std::min(bx, cx));
-    int xMax = std::max(ax, std::max(bx, cx));
-    int yMin = std::min(ay, std::min(by, cy));
-    int yMax = std::max(ay, std::max(by, cy));
+// set on a thread that rasterizes into targets of its own, as draw_faces' sort-last workers
+// do; walk_tiles then keeps whole triangles on that thread instead of nesting tasks
+inline thread_local bool serial_tiles = false;
 
-    double area = signed_triangle_area(ax, ay, bx, by, cx, cy);
+// sets serial_tiles for its lifetime, so a throwing worker does not leave its thread serial
+struct SerialTiles {
+    bool saved = std::exchange(serial_tiles, true);
+    SerialTiles() = default;
+    SerialTiles(SerialTiles const&) = delete;
+    SerialTiles& operator=(SerialTiles const&) = delete;
+    ~SerialTiles() { serial_tiles = saved; }
+};
+
+// Walks the bounding box clipped to clip one 8x8 tile at a time, the layout of RenderTarget
+// for a target tiles_x tiles wide, and skips tiles lying entirely outside one edge. The
+// edge functions are the doubled sub-triangle areas of barycentric_coords_2d stepped
+// incrementally. visit receives the tile_index of every covered pixel and its three edge
+// values.
+template <typename Visit>
+inline void walk_tiles(int ax, int ay, int bx, int by, int cx, int cy, int tiles_x, ScreenRect const& clip,
+                       Visit const& visit) {
+    constexpr int TILE = RENDER_TILE;
+    int xMin = std::max(clip.x0, std::min(ax, std::min(bx, cx)));
+    int xMax = std::min(clip.x1 - 1, std::max(ax, std::max(bx, cx)));
+    int yMin = std::max(clip.y0, std::min(ay, std::min(by, cy)));
+    int yMax = std::min(clip.y1, std::max(ay, std::max(by, cy)));
+    if (xMin > xMax || yMin >= yMax) {
+        return;
+    }
+
+    const int area2 = double_signed_triangle_area(ax, ay, bx, by, cx, cy);
+    // edge values are flipped for clockwise triangles so that inside is always >= 0
+    const int sign = area2 >= 0 ? 1 : -1;
     // we removed back face culling because we want it be order independent
 
-#pragma omp parallel for
-    for (int x = xMin; x <= xMax; x++) {
-        for (int y = yMin; y < yMax; y++) {
-            auto [alpha, beta, gamma] = barycentric_coords_2d(ax, ay, bx, by, cx, cy, x, y, area).view();
-            auto z = static_cast<unsigned char>(alpha * az + beta * bz + gamma * cz);
-            if (alpha < 0 || beta < 0 || gamma < 0 || zbuffer.get(x, y).r >= z) {
+    const int dx[3] = {sign * (by - cy), sign * (cy - ay), sign * (ay - by)};
+    const int dy[3] = {sign * (cx - bx), sign * (ax - cx), sign * (bx - ax)};
+    const int origin[3] = {sign * double_signed_triangle_area(xMin, yMin, bx, by, cx, cy),
+                           sign * double_signed_triangle_area(ax, ay, xMin, yMin, cx, cy),
+                           sign * double_signed_triangle_area(ax, ay, bx, by, xMin, yMin)};
+
+    auto tile_row = [&](int ty) {
+        const int y0 = std::max(yMin, ty * TILE), y1 = std::min(yMax, ty * TILE + TILE);
+        for (int x0 = xMin; x0 <= xMax; x0 = (x0 / TILE + 1) * TILE) {
+            const int x1 = std::min(xMax, (x0 / TILE + 1) * TILE - 1);
+            int e[3];
+            bool outside = false;
+            for (int i = 0; i < 3; i++) {
+                e[i] = origin[i] + (x0 - xMin) * dx[i] + (y0 - yMin) * dy[i];
+                // the edge functions are linear, so their maximum over the tile is at a corner
+                int emax = e[i] + std::max(0, (x1 - x0) * dx[i]) + std::max(0, (y1 - 1 - y0) * dy[i]);
+                outside |= emax < 0;
+            }
+            if (outside) {
                 continue;
             }
-            zbuffer.set(x, y, {z});
-            framebuffer.set(x, y, color_picker(alpha, beta, gamma));
+            PROFILE_COUNT(PIXELS_TESTED, (x1 - x0 + 1) * (y1 - y0));
+            size_t row = tile_index(x0, y0, tiles_x);
+            for (int y = y0; y < y1; y++, row += TILE) {
+                int e0 = e[0], e1 = e[1], e2 = e[2];
+                for (int x = x0; x <= x1; x++, e0 += dx[0], e1 += dx[1], e2 += dx[2]) {
+                    if ((e0 | e1 | e2) < 0) {
+                        continue;
+                    }
+                    visit(row + (x - x0), e0, e1, e2);
+                }
+                for (int i = 0; i < 3; i++) e[i] += dy[i];
+            }
         }
+    };
+    if (serial_tiles) {
+        for (int ty = yMin / TILE; ty <= (yMax - 1) / TILE; ty++) tile_row(ty);
+        return;
     }
+    // rows of tiles are independent; small triangles stay on the calling thread
+    Scheduler::instance().parallel_for(yMin / TILE, (yMax - 1) / TILE + 1, 4, [&](int ty0, int ty1) {
+        for (int ty = ty0; ty < ty1; ty++) {
+            tile_row(ty);
+        }
+    });
+}
+
+// walk_tiles with the barycentric weights of barycentric_coords_2d, bit-identical to it;
+// pixels outside the triangle skip the divisions. fragment receives the tile_index of the
+// pixel and its weights
+template <typename Fragment>
+inline void rasterize_tiles(int ax, int ay, int bx, int by, int cx, int cy, int tiles_x, ScreenRect const& clip,
+                            Fragment const& fragment) {
+    const int area2 = double_signed_triangle_area(ax, ay, bx, by, cx, cy);
+    const double all = area2;
+    const int sign = area2 >= 0 ? 1 : -1;
+    walk_tiles(ax, ay, bx, by, cx, cy, tiles_x, clip, [&](size_t index, int e0, int e1, int e2) {
+        fragment(index, Vec3d(sign * e0 / all, sign * e1 / all, sign * e2 / all));
+    });
+}
+
+// The triangle's depth from its edge values in exact integer arithmetic, for the depth-only
+// passes: one division per pixel instead of three. It can differ from the barycentric depth
+// of shading_triangle by one step where the exact value is whole, so depth written by
+// depth_triangle is only compared against shading_triangle_equal, which uses it too.
+class DepthPlane {
+    int64_t az, bz, cz, area;
+
+public:
+    DepthPlane(int ax, int ay, int az, int bx, int by, int bz, int cx, int cy, int cz)
+    : az(az), bz(bz), cz(cz), area(std::abs(double_signed_triangle_area(ax, ay, bx, by, cx, cy))) {}
+
+    // degenerate triangles cover nothing in the depth-only passes
+    [[nodiscard]] bool empty() const { return area == 0; }
+    [[nodiscard]] unsigned char at(int e0, int e1, int e2) const {
+        return static_cast<unsigned char>((e0 * az + e1 * bz + e2 * cz) / area);
+    }
+};
+
+// draws the part of the triangle inside clip, which has to lie within the targets
+inline void triangle_with_z(int ax, int ay, int az, int bx, int by, int bz, int cx, int cy, int cz,
+                            ColorTarget &framebuffer, DepthTarget &zbuffer, ScreenRect const& clip,
+                            const std::function<const TGAColor(double, double, double)>& color_picker) {
+    rasterize_tiles(ax, ay, bx, by, cx, cy, framebuffer.get_tiles_x(), clip, [&](size_t index, Vec3d abg) {
+        auto [alpha, beta, gamma] = abg.view();
+        auto z = static_cast<unsigned char>(alpha * az + beta * bz + gamma * cz);
+        uint8_t& depth = zbuffer.data()[index];
+        if (depth >= z) {
+            PROFILE_COUNT(DEPTH_REJECTS, 1);
+            return;
+        }
+        depth = z;
+        framebuffer.data()[index] = pack_color(color_picker(alpha, beta, gamma));
+        PROFILE_COUNT(FRAGMENTS_SHADED, 1);
+        PROFILE_OVERDRAW(framebuffer, index);
+    });
+}
+
+inline void triangle_with_z(int ax, int ay, int az, int bx, int by, int bz, int cx, int cy, int cz,
+                            ColorTarget &framebuffer, DepthTarget &zbuffer,
+                            const std::function<const TGAColor(double, double, double)>& color_picker) {
+    triangle_with_z(ax, ay, az, bx, by, bz, cx, cy, cz, framebuffer, zbuffer, framebuffer.bounds(), color_picker);
 }
 
 inline void shading_triangle(int ax, int ay, int az, int bx, int by, int bz, int cx, int cy, int cz,
-                            Model const& model, TGAImage& framebuffer, TGAImage& zbuffer, Shader const& shader,
-                            VertexData const& vertex_data) {
-    int xMin = std::min(ax, std::min(bx, cx));
-    int xMax = std::max(ax, std::max(bx, cx));
-    int yMin = std::min(ay, std::min(by, cy));
-    int yMax = std::max(ay, std::max(by, cy));
+                            Model const& model, ColorTarget& framebuffer, DepthTarget& zbuffer, ScreenRect const& clip,
+                            Shader const& shader, VertexData const& vertex_data) {
+    rasterize_tiles(ax, ay, bx, by, cx, cy, framebuffer.get_tiles_x(), clip, [&](size_t index, Vec3d abg) {
+        auto [alpha, beta, gamma] = abg.view();
+        auto z = static_cast<unsigned char>(alpha * az + beta * bz + gamma * cz);
+        uint8_t& depth = zbuffer.data()[index];
+        if (depth >= z) {
+            PROFILE_COUNT(DEPTH_REJECTS, 1);
+            return;
+        }
+        auto vals = shader.eval_fragment(model, vertex_data, abg);
+        PROFILE_COUNT(FRAGMENTS_SHADED, 1);
+        if (vals.keep) {
+            depth = z;
+            framebuffer.data()[index] = pack_color(vals.color);
+            PROFILE_OVERDRAW(framebuffer, index);
+        }
+    });
+}
 
-    double area = signed_triangle_area(ax, ay, bx, by, cx, cy);
-    // we removed back face culling because we want it be order independent
+inline void shading_triangle(int ax, int ay, int az, int bx, int by, int bz, int cx, int cy, int cz,
+                            Model const& model, ColorTarget& framebuffer, DepthTarget& zbuffer, Shader const& shader,
+                            VertexData const& vertex_data) {
+    shading_triangle(ax, ay, az, bx, by, bz, cx, cy, cz, model, framebuffer, zbuffer, framebuffer.bounds(),
+                     shader, vertex_data);
+}
 
-#pragma omp parallel for
-    for (int x = xMin; x <= xMax; x++) {
-        for (int y = yMin; y < yMax; y++) {
-            auto abg = barycentric_coords_2d(ax, ay, bx, by, cx, cy, x, y, area);
-            auto [alpha, beta, gamma] = abg.view();
-            auto z = static_cast<unsigned char>(alpha * az + beta * bz + gamma * cz);
-            if (alpha < 0 || beta < 0 || gamma < 0 || zbuffer.get(x, y).r >= z) {
-                continue;
+// Shades like shading_triangle at the rates of the tiles: in a tile of rate 2 or 4 the
+// fragment shader runs once per 2 x 2 or 4 x 4 block the triangle reaches, at the first of
+// the block's pixels to pass the depth test, and its result goes to the block's other pixels
+// that pass. Depth and coverage stay per pixel. written(index, weights) follows every pixel
+// written; invocations, when given, counts the fragment shader runs.
+template <typename Written>
+inline void shading_triangle_rates(int ax, int ay, int az, int bx, int by, int bz, int cx, int cy, int cz,
+                                   Model const& model, ColorTarget& framebuffer, DepthTarget& zbuffer,
+                                   ScreenRect const& clip, Shader const& shader, VertexData const& vertex_data,
+                                   ShadingRates const& rates, Written const& written,
+                                   std::atomic<uint64_t>* invocations = nullptr) {
+    constexpr int TILE = RENDER_TILE;
+    // the block results of the tile a thread is in; walk_tiles finishes a tile on one thread
+    // before it takes another, so they only have to be told apart by triangle and tile
+    struct Blocks {
+        uint64_t triangle = ~0ull;
+        size_t tile = 0;
+        uint16_t shaded = 0;
+        FragementData values[(TILE / 2) * (TILE / 2)];
+    };
+    static std::atomic<uint64_t> triangles{0};
+    thread_local Blocks blocks;
+    const uint64_t triangle = triangles.fetch_add(1, std::memory_order_relaxed);
+    rasterize_tiles(ax, ay, bx, by, cx, cy, framebuffer.get_tiles_x(), clip, [&](size_t index, Vec3d abg) {
+        auto [alpha, beta, gamma] = abg.view();
+        auto z = static_cast<unsigned char>(alpha * az + beta * bz + gamma * cz);
+        uint8_t& depth = zbuffer.data()[index];
+        if (depth >= z) {
+            PROFILE_COUNT(DEPTH_REJECTS, 1);
+            return;
+        }
+        const size_t tile = index / (TILE * TILE);
+        const int rate = rates.at_tile(tile);
+        FragementData vals;
+        if (rate == 1) {
+            vals = shader.eval_fragment(model, vertex_data, abg);
+            PROFILE_COUNT(FRAGMENTS_SHADED, 1);
+            if (invocations) invocations->fetch_add(1, std::memory_order_relaxed);
+        } else {
+            if (blocks.triangle != triangle || blocks.tile != tile) {
+                blocks.triangle = triangle;
+                blocks.tile = tile;
+                blocks.shaded = 0;
             }
-            auto vals = shader.eval_fragment(model, vertex_data, abg);
-            if (vals.keep) {
-                zbuffer.set(x, y, {z});
-                framebuffer.set(x, y, vals.color);
+            const int texel = static_cast<int>(index % (TILE * TILE));
+            const int block = texel / TILE / rate * (TILE / rate) + texel % TILE / rate;
+            if (!(blocks.shaded >> block & 1)) {
+                blocks.values[block] = shader.eval_fragment(model, vertex_data, abg);
+                blocks.shaded |= 1 << block;
+                PROFILE_COUNT(FRAGMENTS_SHADED, 1);
+                if (invocations) invocations->fetch_add(1, std::memory_order_relaxed);
             }
+            vals = blocks.values[block];
         }
+        if (vals.keep) {
+            depth = z;
+            framebuffer.data()[index] = pack_color(vals.color);
+            PROFILE_OVERDRAW(framebuffer, index);
+            written(index, abg);
+        }
+    });
+}
+
+// depth-only raster for z-prepasses and shadow maps: no weights, varyings or color
+inline void depth_triangle(int ax, int ay, int az, int bx, int by, int bz, int cx, int cy, int cz,
+                           DepthTarget &zbuffer, ScreenRect const& clip) {
+    const DepthPlane plane(ax, ay, az, bx, by, bz, cx, cy, cz);
+    if (plane.empty()) {
+        return;
     }
+    uint8_t* depth = zbuffer.data();
+    walk_tiles(ax, ay, bx, by, cx, cy, zbuffer.get_tiles_x(), clip, [&](size_t index, int e0, int e1, int e2) {
+        unsigned char z = plane.at(e0, e1, e2);
+        if (depth[index] >= z) {
+            PROFILE_COUNT(DEPTH_REJECTS, 1);
+            return;
+        }
+        depth[index] = z;
+    });
+}
+
+// Shades the pixels where the triangle is the one depth_triangle left in zbuffer, so every
+// visible pixel is shaded once. Shaders that discard fragments need the plain path, since
+// the prepass cannot know which fragments they drop. fragment(index, weights) returns the
+// FragementData of the pixel at tile_index index.
+template <typename Fragment>
+inline void shading_triangle_equal(int ax, int ay, int az, int bx, int by, int bz, int cx, int cy, int cz,
+                                   ColorTarget& framebuffer, DepthTarget const& zbuffer, ScreenRect const& clip,
+                                   Fragment const& fragment) {
+    const DepthPlane plane(ax, ay, az, bx, by, bz, cx, cy, cz);
+    if (plane.empty()) {
+        return;
+    }
+    const int area2 = double_signed_triangle_area(ax, ay, bx, by, cx, cy);
+    const double all = area2;
+    const int sign = area2 >= 0 ? 1 : -1;
+    const uint8_t* depth = zbuffer.data();
+    walk_tiles(ax, ay, bx, by, cx, cy, framebuffer.get_tiles_x(), clip, [&](size_t index, int e0, int e1, int e2) {
+        if (depth[index] != plane.at(e0, e1, e2)) {
+            PROFILE_COUNT(DEPTH_REJECTS, 1);
+            return;
+        }
+        FragementData vals = fragment(index, Vec3d(sign * e0 / all, sign * e1 / all, sign * e2 / all));
+        PROFILE_COUNT(FRAGMENTS_SHADED, 1);
+        if (vals.keep) {
+            framebuffer.data()[index] = pack_color(vals.color);
+            PROFILE_OVERDRAW(framebuffer, index);
+        }
+    });
+}
+
+inline void shading_triangle_equal(int ax, int ay, int az, int bx, int by, int bz, int cx, int cy, int cz,
+                                   Model const& model, ColorTarget& framebuffer, DepthTarget const& zbuffer,
+                                   ScreenRect const& clip, Shader const& shader, VertexData const& vertex_data) {
+    shading_triangle_equal(ax, ay, az, bx, by, bz, cx, cy, cz, framebuffer, zbuffer, clip,
+                           [&](size_t, Vec3d const& abg) { return shader.eval_fragment(model, vertex_data, abg); });
 }
 
 #endif
\ No newline at end of file
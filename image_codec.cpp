@@ -0,0 +1,410 @@
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include "image_codec.h"
+
+namespace {
+
+void put_u32_be(std::vector<unsigned char> &out, uint32_t v) {
+    out.push_back(v >> 24);
+    out.push_back(v >> 16);
+    out.push_back(v >> 8);
+    out.push_back(v);
+}
+
+uint32_t get_u32_be(const unsigned char *p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+
+// one BGR/BGRA/gray pixel expanded to r, g, b, a
+struct Rgba {
+    unsigned char r, g, b, a;
+};
+
+Rgba fetch(const unsigned char *p, int bytespp) {
+    if (bytespp == 1) return {p[0], p[0], p[0], 255};
+    return {p[2], p[1], p[0], static_cast<unsigned char>(bytespp == 4 ? p[3] : 255)};
+}
+
+} // namespace
+
+TgaEncoder::TgaEncoder(bool rle) : rle(rle) {
+}
+
+void TgaEncoder::encode(const TGAImage &img, std::vector<unsigned char> &out) const {
+    img.encode_tga(out, rle);
+}
+
+const char *TgaEncoder::extension() const {
+    return ".tga";
+}
+
+// QOI
+
+namespace {
+
+constexpr unsigned char QOI_OP_INDEX = 0x00;
+constexpr unsigned char QOI_OP_DIFF = 0x40;
+constexpr unsigned char QOI_OP_LUMA = 0x80;
+constexpr unsigned char QOI_OP_RUN = 0xc0;
+constexpr unsigned char QOI_OP_RGB = 0xfe;
+constexpr unsigned char QOI_OP_RGBA = 0xff;
+constexpr unsigned char QOI_MASK = 0xc0;
+constexpr unsigned char QOI_END[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+int qoi_hash(Rgba const &c) {
+    return (c.r * 3 + c.g * 5 + c.b * 7 + c.a * 11) & 63;
+}
+
+bool operator==(Rgba const &a, Rgba const &b) {
+    return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+}
+
+} // namespace
+
+void QoiEncoder::encode(const TGAImage &img, std::vector<unsigned char> &out) const {
+    const int width = img.get_width();
+    const int height = img.get_height();
+    const int bytespp = img.get_bytespp();
+    const int channels = bytespp == TGAImage::RGBA ? 4 : 3;
+
+    out.clear();
+    // worst case is an RGBA op per pixel
+    out.reserve(14 + static_cast<size_t>(width) * height * (channels + 1) + sizeof(QOI_END));
+    out.insert(out.end(), {'q', 'o', 'i', 'f'});
+    put_u32_be(out, width);
+    put_u32_be(out, height);
+    out.push_back(channels);
+    out.push_back(0); // sRGB with linear alpha
+
+    Rgba index[64] = {};
+    Rgba prev = {0, 0, 0, 255};
+    int run = 0;
+    for (int y = 0; y < height; y++) {
+        const unsigned char *p = img.row(y);
+        for (int x = 0; x < width; x++, p += bytespp) {
+            Rgba px = fetch(p, bytespp);
+            if (px == prev) {
+                run++;
+                if (run == 62) {
+                    out.push_back(QOI_OP_RUN | (run - 1));
+                    run = 0;
+                }
+                continue;
+            }
+            if (run > 0) {
+                out.push_back(QOI_OP_RUN | (run - 1));
+                run = 0;
+            }
+            int h = qoi_hash(px);
+            if (index[h] == px) {
+                out.push_back(QOI_OP_INDEX | h);
+            } else {
+                index[h] = px;
+                if (px.a == prev.a) {
+                    signed char vr = px.r - prev.r;
+                    signed char vg = px.g - prev.g;
+                    signed char vb = px.b - prev.b;
+                    signed char vg_r = vr - vg;
+                    signed char vg_b = vb - vg;
+                    if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+                        out.push_back(QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2));
+                    } else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 && vg_b > -9 && vg_b < 8) {
+                        out.push_back(QOI_OP_LUMA | (vg + 32));
+                        out.push_back((vg_r + 8) << 4 | (vg_b + 8));
+                    } else {
+                        out.insert(out.end(), {QOI_OP_RGB, px.r, px.g, px.b});
+                    }
+                } else {
+                    out.insert(out.end(), {QOI_OP_RGBA, px.r, px.g, px.b, px.a});
+                }
+            }
+            prev = px;
+        }
+    }
+    if (run > 0) out.push_back(QOI_OP_RUN | (run - 1));
+    out.insert(out.end(), QOI_END, QOI_END + sizeof(QOI_END));
+}
+
+const char *QoiEncoder::extension() const {
+    return ".qoi";
+}
+
+bool decode_qoi(const unsigned char *in, size_t size, TGAImage &img) {
+    if (size < 14 + sizeof(QOI_END) || memcmp(in, "qoif", 4) != 0) {
+        std::cerr << "not a qoi file\n";
+        return false;
+    }
+    uint32_t width = get_u32_be(in + 4);
+    uint32_t height = get_u32_be(in + 8);
+    int channels = in[12];
+    // TGAImage sizes its buffer in int, so the bytes of the image must fit one
+    if (width == 0 || height == 0 || width > 32767 || height > 32767 || (channels != 3 && channels != 4) ||
+        uint64_t(width) * height * channels > INT_MAX) {
+        std::cerr << "bad qoi header\n";
+        return false;
+    }
+    const int bytespp = channels == 4 ? TGAImage::RGBA : TGAImage::RGB;
+    img = TGAImage(width, height, bytespp);
+    unsigned char *dst = img.buffer();
+    const unsigned char *end = in + size - sizeof(QOI_END);
+    const unsigned char *p = in + 14;
+
+    Rgba index[64] = {};
+    Rgba px = {0, 0, 0, 255};
+    int run = 0;
+    size_t npixels = size_t(width) * height;
+    for (size_t i = 0; i < npixels; i++, dst += bytespp) {
+        if (run > 0) {
+            run--;
+        } else if (p < end) {
+            unsigned char op = *p++;
+            if (op == QOI_OP_RGB) {
+                if (end - p < 3) return false;
+                px.r = p[0]; px.g = p[1]; px.b = p[2];
+                p += 3;
+            } else if (op == QOI_OP_RGBA) {
+                if (end - p < 4) return false;
+                px.r = p[0]; px.g = p[1]; px.b = p[2]; px.a = p[3];
+                p += 4;
+            } else if ((op & QOI_MASK) == QOI_OP_INDEX) {
+                px = index[op];
+            } else if ((op & QOI_MASK) == QOI_OP_DIFF) {
+                px.r += ((op >> 4) & 3) - 2;
+                px.g += ((op >> 2) & 3) - 2;
+                px.b += (op & 3) - 2;
+            } else if ((op & QOI_MASK) == QOI_OP_LUMA) {
+                if (p >= end) return false;
+                unsigned char b2 = *p++;
+                int vg = (op & 0x3f) - 32;
+                px.r += vg - 8 + ((b2 >> 4) & 0x0f);
+                px.g += vg;
+                px.b += vg - 8 + (b2 & 0x0f);
+            } else {
+                run = op & 0x3f;
+            }
+            index[qoi_hash(px)] = px;
+        } else {
+            std::cerr << "truncated qoi data\n";
+            return false;
+        }
+        dst[0] = px.b;
+        dst[1] = px.g;
+        dst[2] = px.r;
+        if (bytespp == 4) dst[3] = px.a;
+    }
+    return true;
+}
+
+// PNG
+
+namespace {
+
+struct Crc32Table {
+    uint32_t t[256];
+    Crc32Table() {
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++) c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            t[n] = c;
+        }
+    }
+};
+
+uint32_t crc32(const unsigned char *p, size_t n, uint32_t crc = 0) {
+    static const Crc32Table table;
+    crc = ~crc;
+    while (n--) crc = table.t[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+uint32_t adler32(const unsigned char *p, size_t n) {
+    uint32_t a = 1, b = 0;
+    while (n) {
+        size_t chunk = n < 5552 ? n : 5552;
+        n -= chunk;
+        while (chunk--) {
+            a += *p++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+void png_chunk(std::vector<unsigned char> &out, const char *type, const unsigned char *data, size_t size) {
+    put_u32_be(out, size);
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data, data + size);
+    put_u32_be(out, crc32(out.data() + start, size + 4));
+}
+
+// LSB-first bit packer for deflate
+class BitWriter {
+    std::vector<unsigned char> &out;
+    uint64_t bits = 0;
+    int count = 0;
+public:
+    explicit BitWriter(std::vector<unsigned char> &out) : out(out) {
+    }
+    void put(uint32_t value, int n) {
+        bits |= uint64_t(value) << count;
+        count += n;
+        while (count >= 8) {
+            out.push_back(bits & 0xff);
+            bits >>= 8;
+            count -= 8;
+        }
+    }
+    // Huffman codes are defined most significant bit first
+    void put_code(uint32_t code, int n) {
+        uint32_t rev = 0;
+        for (int i = 0; i < n; i++) rev |= ((code >> i) & 1) << (n - 1 - i);
+        put(rev, n);
+    }
+    void flush() {
+        if (count > 0) out.push_back(bits & 0xff);
+        bits = 0;
+        count = 0;
+    }
+};
+
+// the fixed literal/length code, bit-reversed once so symbols can be emitted with a single put
+struct FixedLiteralCodes {
+    uint16_t code[288];
+    uint8_t length[288];
+    FixedLiteralCodes() {
+        for (int sym = 0; sym < 288; sym++) {
+            uint32_t c;
+            int n;
+            if (sym < 144) c = 0x30 + sym, n = 8;
+            else if (sym < 256) c = 0x190 + sym - 144, n = 9;
+            else if (sym < 280) c = sym - 256, n = 7;
+            else c = 0xc0 + sym - 280, n = 8;
+            uint32_t rev = 0;
+            for (int i = 0; i < n; i++) rev |= ((c >> i) & 1) << (n - 1 - i);
+            code[sym] = rev;
+            length[sym] = n;
+        }
+    }
+};
+
+void put_fixed_literal(BitWriter &bw, int sym) {
+    static const FixedLiteralCodes codes;
+    bw.put(codes.code[sym], codes.length[sym]);
+}
+
+void put_fixed_match(BitWriter &bw, int length) {
+    static const int base[] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                               35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    static const int extra[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    int i = 28;
+    while (base[i] > length) i--;
+    put_fixed_literal(bw, 257 + i);
+    if (extra[i]) bw.put(length - base[i], extra[i]);
+    bw.put_code(0, 5); // distance code 0: distance 1
+}
+
+void deflate_fixed(const std::vector<unsigned char> &in, std::vector<unsigned char> &out) {
+    out.reserve(out.size() + in.size() + in.size() / 8 + 16);
+    BitWriter bw(out);
+    bw.put(1, 1); // final block
+    bw.put(1, 2); // fixed Huffman codes
+    size_t i = 0;
+    while (i < in.size()) {
+        size_t run = 0;
+        if (i > 0) {
+            while (i + run < in.size() && run < 258 && in[i + run] == in[i - 1]) run++;
+        }
+        if (run >= 3) {
+            put_fixed_match(bw, static_cast<int>(run));
+            i += run;
+        } else {
+            put_fixed_literal(bw, in[i++]);
+        }
+    }
+    put_fixed_literal(bw, 256);
+    bw.flush();
+}
+
+void deflate_stored(const std::vector<unsigned char> &in, std::vector<unsigned char> &out) {
+    out.reserve(out.size() + in.size() + (in.size() / 65535 + 1) * 5);
+    size_t pos = 0;
+    do {
+        size_t n = std::min<size_t>(in.size() - pos, 65535);
+        out.push_back(pos + n == in.size() ? 1 : 0);
+        out.push_back(n & 0xff);
+        out.push_back(n >> 8);
+        out.push_back(~n & 0xff);
+        out.push_back((~n >> 8) & 0xff);
+        out.insert(out.end(), in.begin() + pos, in.begin() + pos + n);
+        pos += n;
+    } while (pos < in.size());
+}
+
+} // namespace
+
+PngEncoder::PngEncoder(bool compress) : compress(compress) {
+}
+
+void PngEncoder::encode(const TGAImage &img, std::vector<unsigned char> &out) const {
+    const int width = img.get_width();
+    const int height = img.get_height();
+    const int bytespp = img.get_bytespp();
+    const size_t linebytes = static_cast<size_t>(width) * bytespp;
+
+    // rows in PNG channel order, each prefixed with the Sub filter type
+    std::vector<unsigned char> filtered((linebytes + 1) * height);
+    unsigned char *dst = filtered.data();
+    for (int y = 0; y < height; y++) {
+        const unsigned char *src = img.row(y);
+        *dst++ = 1;
+        unsigned char *line = dst;
+        for (int x = 0; x < width; x++, src += bytespp, dst += bytespp) {
+            if (bytespp == 1) {
+                dst[0] = src[0];
+            } else {
+                dst[0] = src[2];
+                dst[1] = src[1];
+                dst[2] = src[0];
+                if (bytespp == 4) dst[3] = src[3];
+            }
+        }
+        for (size_t i = linebytes; i-- > static_cast<size_t>(bytespp);) line[i] -= line[i - bytespp];
+    }
+
+    std::vector<unsigned char> zlib = {0x78, 0x01};
+    if (compress) deflate_fixed(filtered, zlib);
+    else deflate_stored(filtered, zlib);
+    put_u32_be(zlib, adler32(filtered.data(), filtered.size()));
+
+    static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    out.assign(signature, signature + sizeof(signature));
+    std::vector<unsigned char> ihdr;
+    put_u32_be(ihdr, width);
+    put_u32_be(ihdr, height);
+    ihdr.push_back(8); // bit depth
+    ihdr.push_back(bytespp == 1 ? 0 : bytespp == 3 ? 2 : 6);
+    ihdr.insert(ihdr.end(), {0, 0, 0}); // deflate, adaptive filtering, no interlace
+    png_chunk(out, "IHDR", ihdr.data(), ihdr.size());
+    png_chunk(out, "IDAT", zlib.data(), zlib.size());
+    png_chunk(out, "IEND", nullptr, 0);
+}
+
+const char *PngEncoder::extension() const {
+    return ".png";
+}
+
+const ImageEncoder &encoder_for(const char *filename) {
+    static const TgaEncoder tga;
+    static const QoiEncoder qoi;
+    static const PngEncoder png;
+    const char *dot = strrchr(filename, '.');
+    if (dot && !strcmp(dot, qoi.extension())) return qoi;
+    if (dot && !strcmp(dot, png.extension())) return png;
+    return tga;
+}
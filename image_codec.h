@@ -0,0 +1,47 @@
+#ifndef IMAGE_CODEC_H
+#define IMAGE_CODEC_H
+
+#include <cstddef>
+#include <vector>
+#include "tgaimage.h"
+
+// Serializes a TGAImage into a complete file image. Rows are written top row first,
+// i.e. row(0) is the top of the picture, matching what write_tga_file produces.
+class ImageEncoder {
+public:
+    virtual ~ImageEncoder() = default;
+    virtual void encode(const TGAImage &img, std::vector<unsigned char> &out) const = 0;
+    [[nodiscard]] virtual const char *extension() const = 0;
+};
+
+class TgaEncoder final : public ImageEncoder {
+    bool rle;
+public:
+    explicit TgaEncoder(bool rle = true);
+    void encode(const TGAImage &img, std::vector<unsigned char> &out) const override;
+    [[nodiscard]] const char *extension() const override;
+};
+
+// "Quite OK Image" format, single pass with a 64-entry color cache
+class QoiEncoder final : public ImageEncoder {
+public:
+    void encode(const TGAImage &img, std::vector<unsigned char> &out) const override;
+    [[nodiscard]] const char *extension() const override;
+};
+
+// PNG with Sub-filtered rows, either deflated with fixed Huffman codes and
+// distance-1 runs (fast, no dictionary search) or stored uncompressed
+class PngEncoder final : public ImageEncoder {
+    bool compress;
+public:
+    explicit PngEncoder(bool compress = true);
+    void encode(const TGAImage &img, std::vector<unsigned char> &out) const override;
+    [[nodiscard]] const char *extension() const override;
+};
+
+// picks the encoder matching the file extension, TGA with RLE when unknown
+const ImageEncoder &encoder_for(const char *filename);
+
+bool decode_qoi(const unsigned char *in, size_t size, TGAImage &img);
+
+#endif //IMAGE_CODEC_H
@@ -0,0 +1,247 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+#include "image_kernels.h"
+#include "scheduler.h"
+
+static inline void swap_pixel(unsigned char *a, unsigned char *b, int bytespp) {
+    for (int t = 0; t < bytespp; t++) std::swap(a[t], b[t]);
+}
+
+#ifdef __SSE2__
+static inline __m128i reverse_bytes(__m128i v) {
+    v = _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+#endif
+
+void reverse_pixels(unsigned char *row, int width, int bytespp) {
+    unsigned char *left = row;
+    unsigned char *right = row + static_cast<size_t>(width) * bytespp;
+#ifdef __SSE2__
+    // 16 bytes from each end per step: 4 BGRA pixels or 16 gray ones
+    if (bytespp == 4 || bytespp == 1) {
+        while (right - left >= 32) {
+            right -= 16;
+            __m128i l = _mm_loadu_si128(reinterpret_cast<const __m128i *>(left));
+            __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i *>(right));
+            if (bytespp == 4) {
+                l = _mm_shuffle_epi32(l, _MM_SHUFFLE(0, 1, 2, 3));
+                r = _mm_shuffle_epi32(r, _MM_SHUFFLE(0, 1, 2, 3));
+            } else {
+                l = reverse_bytes(l);
+                r = reverse_bytes(r);
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(left), r);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(right), l);
+            left += 16;
+        }
+    }
+#endif
+    if (bytespp == 3) {
+        for (; right - left >= 6; left += 3) {
+            right -= 3;
+            swap_pixel(left, right, 3);
+        }
+        return;
+    }
+    for (; right - left >= 2 * bytespp; left += bytespp) {
+        right -= bytespp;
+        swap_pixel(left, right, bytespp);
+    }
+}
+
+void swap_rows(unsigned char *a, unsigned char *b, size_t nbytes) {
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= nbytes; i += 16) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(a + i), vb);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(b + i), va);
+    }
+#endif
+    for (; i < nbytes; i++) std::swap(a[i], b[i]);
+}
+
+void swap_red_blue(unsigned char *row, int width, int bytespp) {
+    if (bytespp < 3) return;
+    size_t n = static_cast<size_t>(width) * bytespp;
+    size_t i = 0;
+#ifdef __SSE2__
+    if (bytespp == 4) {
+        const __m128i keep = _mm_set1_epi32(0xff00ff00);
+        const __m128i low = _mm_set1_epi32(0x000000ff);
+        for (; i + 16 <= n; i += 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + i));
+            __m128i r = _mm_and_si128(_mm_srli_epi32(v, 16), low);
+            __m128i b = _mm_slli_epi32(_mm_and_si128(v, low), 16);
+            v = _mm_or_si128(_mm_and_si128(v, keep), _mm_or_si128(r, b));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(row + i), v);
+        }
+    }
+#endif
+    // a constant stride lets the compiler vectorize the packed 24-bit case
+    if (bytespp == 3) {
+        for (; i < n; i += 3) std::swap(row[i], row[i + 2]);
+    } else {
+        for (; i < n; i += 4) std::swap(row[i], row[i + 2]);
+    }
+}
+
+void convert_pixels(const unsigned char *src, int src_bytespp, unsigned char *dst, int dst_bytespp, int width) {
+    if (src_bytespp == dst_bytespp) {
+        memcpy(dst, src, static_cast<size_t>(width) * src_bytespp);
+        return;
+    }
+    int x = 0;
+    if (dst_bytespp == 1) {
+        for (; x < width; x++, src += src_bytespp) {
+            dst[x] = static_cast<unsigned char>((29 * src[0] + 150 * src[1] + 77 * src[2] + 128) >> 8);
+        }
+        return;
+    }
+    if (src_bytespp == 1) {
+        for (; x < width; x++, dst += dst_bytespp) {
+            dst[0] = dst[1] = dst[2] = src[x];
+            if (dst_bytespp == 4) dst[3] = 255;
+        }
+        return;
+    }
+#ifdef __SSSE3__
+    if (src_bytespp == 3) {
+        const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+        const __m128i alpha = _mm_set1_epi32(0xff000000);
+        // reads 16 bytes to use 12, so stop while a full load still fits
+        for (; x + 6 <= width; x += 4, src += 12, dst += 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_or_si128(_mm_shuffle_epi8(v, spread), alpha));
+        }
+    } else {
+        const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+        // writes 16 bytes to produce 12, same margin on the destination
+        for (; x + 6 <= width; x += 4, src += 16, dst += 12) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_shuffle_epi8(v, pack));
+        }
+    }
+#endif
+    for (; x < width; x++, src += src_bytespp, dst += dst_bytespp) {
+        dst[0] = src[0];
+        dst[1] = src[1];
+        dst[2] = src[2];
+        if (dst_bytespp == 4) dst[3] = 255;
+    }
+}
+
+void resize_box(const unsigned char *src, long src_stride, int src_width, int src_height,
+                unsigned char *dst, long dst_stride, int dst_width, int dst_height, int bytespp) {
+    // source column span [x0[i], x0[i+1]) of every destination column, never empty
+    std::vector<int> x0(dst_width + 1);
+    for (int x = 0; x <= dst_width; x++) x0[x] = static_cast<int>(static_cast<long>(x) * src_width / dst_width);
+    for (int x = 0; x < dst_width; x++) x0[x + 1] = std::max(x0[x + 1], x0[x] + 1);
+
+    Scheduler::instance().parallel_for(0, dst_height, 16, [&](int first, int last) {
+        std::vector<uint32_t> columns(static_cast<size_t>(src_width) * bytespp);
+        for (int y = first; y < last; y++) {
+            int y0 = static_cast<int>(static_cast<long>(y) * src_height / dst_height);
+            int y1 = std::max(y0 + 1, static_cast<int>(static_cast<long>(y + 1) * src_height / dst_height));
+            std::fill(columns.begin(), columns.end(), 0);
+            for (int sy = y0; sy < y1 && sy < src_height; sy++) {
+                const unsigned char *s = src + sy * src_stride;
+                for (size_t i = 0; i < columns.size(); i++) columns[i] += s[i];
+            }
+            unsigned char *d = dst + y * dst_stride;
+            for (int x = 0; x < dst_width; x++) {
+                int xa = std::min(x0[x], src_width - 1);
+                int xb = std::min(x0[x + 1], src_width);
+                uint32_t area = static_cast<uint32_t>((xb - xa) * (std::min(y1, src_height) - y0));
+                for (int t = 0; t < bytespp; t++) {
+                    uint32_t sum = 0;
+                    for (int sx = xa; sx < xb; sx++) sum += columns[sx * bytespp + t];
+                    d[x * bytespp + t] = static_cast<unsigned char>((sum + area / 2) / area);
+                }
+            }
+        }
+    });
+}
+
+void resize_bilinear(const unsigned char *src, long src_stride, int src_width, int src_height,
+                     unsigned char *dst, long dst_stride, int dst_width, int dst_height, int bytespp) {
+    // sample positions in 8-bit fixed point, pixel centers aligned
+    auto taps = [](int dst_size, int src_size, std::vector<int> &i0, std::vector<int> &i1, std::vector<uint32_t> &w) {
+        i0.resize(dst_size);
+        i1.resize(dst_size);
+        w.resize(dst_size);
+        for (int i = 0; i < dst_size; i++) {
+            float pos = (i + 0.5f) * src_size / dst_size - 0.5f;
+            pos = std::clamp(pos, 0.f, static_cast<float>(src_size - 1));
+            i0[i] = static_cast<int>(pos);
+            i1[i] = std::min(i0[i] + 1, src_size - 1);
+            w[i] = static_cast<uint32_t>((pos - i0[i]) * 256.f + 0.5f);
+        }
+    };
+    std::vector<int> xa, xb, ya, yb;
+    std::vector<uint32_t> wx, wy;
+    taps(dst_width, src_width, xa, xb, wx);
+    taps(dst_height, src_height, ya, yb, wy);
+
+    Scheduler::instance().parallel_for(0, dst_height, 16, [&](int first, int last) {
+        std::vector<uint32_t> blended(static_cast<size_t>(src_width) * bytespp);
+        for (int y = first; y < last; y++) {
+            const unsigned char *r0 = src + ya[y] * src_stride;
+            const unsigned char *r1 = src + yb[y] * src_stride;
+            uint32_t w1 = wy[y], w0 = 256 - w1;
+            for (size_t i = 0; i < blended.size(); i++) blended[i] = r0[i] * w0 + r1[i] * w1;
+            unsigned char *d = dst + y * dst_stride;
+            for (int x = 0; x < dst_width; x++) {
+                uint32_t v1 = wx[x], v0 = 256 - v1;
+                const uint32_t *c0 = blended.data() + xa[x] * bytespp;
+                const uint32_t *c1 = blended.data() + xb[x] * bytespp;
+                for (int t = 0; t < bytespp; t++) {
+                    d[x * bytespp + t] = static_cast<unsigned char>((c0[t] * v0 + c1[t] * v1 + (1u << 15)) >> 16);
+                }
+            }
+        }
+    });
+}
+
+void composite_depth(uint32_t *color, uint8_t *depth, const uint32_t *src_color, const uint8_t *src_depth, size_t n) {
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= n; i += 16) {
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(depth + i));
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src_depth + i));
+        __m128i nearest = _mm_max_epu8(d, s);
+        // s > d exactly where the maximum differs from d
+        __m128i take = _mm_andnot_si128(_mm_cmpeq_epi8(nearest, d), _mm_set1_epi8(-1));
+        if (_mm_movemask_epi8(take) == 0) continue;
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(depth + i), nearest);
+        // widen the byte mask to one 32-bit lane per texel
+        __m128i lo = _mm_unpacklo_epi8(take, take), hi = _mm_unpackhi_epi8(take, take);
+        __m128i masks[4] = {_mm_unpacklo_epi16(lo, lo), _mm_unpackhi_epi16(lo, lo),
+                            _mm_unpacklo_epi16(hi, hi), _mm_unpackhi_epi16(hi, hi)};
+        for (int k = 0; k < 4; k++) {
+            __m128i *c = reinterpret_cast<__m128i *>(color + i + 4 * k);
+            __m128i a = _mm_loadu_si128(c);
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src_color + i + 4 * k));
+            _mm_storeu_si128(c, _mm_or_si128(_mm_and_si128(masks[k], b), _mm_andnot_si128(masks[k], a)));
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        if (src_depth[i] > depth[i]) {
+            depth[i] = src_depth[i];
+            color[i] = src_color[i];
+        }
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef IMAGE_KERNELS_H
+#define IMAGE_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Row kernels on packed 8-bit pixels (1, 3 or 4 bytes per pixel, BGR(A) order).
+// SSE2 paths are always used on x86-64, SSSE3 byte shuffles when the compiler targets them.
+
+// reverses the order of the pixels of one row in place
+void reverse_pixels(unsigned char *row, int width, int bytespp);
+
+// exchanges two non-overlapping byte ranges
+void swap_rows(unsigned char *a, unsigned char *b, size_t nbytes);
+
+// exchanges the first and third channel of every pixel (BGR <-> RGB), bytespp 3 or 4
+void swap_red_blue(unsigned char *row, int width, int bytespp);
+
+// converts between grayscale, BGR and BGRA; gray is BT.601 luma, added alpha is opaque
+void convert_pixels(const unsigned char *src, int src_bytespp, unsigned char *dst, int dst_bytespp, int width);
+
+// separable resampling of a whole image; rows are addressed with signed strides.
+// box averages every source pixel a destination pixel covers and is meant for shrinking,
+// bilinear interpolates between the four nearest source pixel centers
+void resize_box(const unsigned char *src, long src_stride, int src_width, int src_height,
+                unsigned char *dst, long dst_stride, int dst_width, int dst_height, int bytespp);
+void resize_bilinear(const unsigned char *src, long src_stride, int src_width, int src_height,
+                     unsigned char *dst, long dst_stride, int dst_width, int dst_height, int bytespp);
+
+// merges n texels of a packed color and 8-bit depth buffer pair into another: a source
+// texel replaces the destination only when its depth is strictly greater
+void composite_depth(uint32_t *color, uint8_t *depth, const uint32_t *src_color, const uint8_t *src_depth, size_t n);
+
+#endif //IMAGE_KERNELS_H
@@ -0,0 +1,70 @@
+#include "image_pool.h"
+
+PooledImage::PooledImage(ImagePool *pool, TGAImage &&image) : pool(pool), image(std::move(image)) {
+}
+
+PooledImage::PooledImage(PooledImage &&other) noexcept : pool(other.pool), image(std::move(other.image)) {
+    other.pool = nullptr;
+}
+
+PooledImage &PooledImage::operator=(PooledImage &&other) noexcept {
+    if (this != &other) {
+        if (pool) pool->release(std::move(image));
+        pool = other.pool;
+        image = std::move(other.image);
+        other.pool = nullptr;
+    }
+    return *this;
+}
+
+PooledImage::~PooledImage() {
+    if (pool) pool->release(std::move(image));
+}
+
+ImagePool::ImagePool(size_t max_retained) : retained(0), max_retained(max_retained), allocations(0) {
+}
+
+ImagePool &ImagePool::instance() {
+    static ImagePool pool;
+    return pool;
+}
+
+PooledImage ImagePool::acquire(int width, int height, int bytespp) {
+    TGAImage image;
+    {
+        std::lock_guard lock(mutex);
+        auto found = free_images.find({width, height, bytespp});
+        if (found != free_images.end() && !found->second.empty()) {
+            image = std::move(found->second.back());
+            found->second.pop_back();
+            retained--;
+        } else {
+            allocations++;
+        }
+    }
+    if (image.get_width()) {
+        image.clear();
+        return {this, std::move(image)};
+    }
+    return {this, TGAImage(width, height, bytespp)};
+}
+
+void ImagePool::release(TGAImage &&image) {
+    // mapped views and moved-from images are not worth keeping
+    if (image.is_mapped() || !image.get_width()) return;
+    std::lock_guard lock(mutex);
+    if (retained >= max_retained) return;
+    free_images[{image.get_width(), image.get_height(), image.get_bytespp()}].push_back(std::move(image));
+    retained++;
+}
+
+size_t ImagePool::allocated() const {
+    std::lock_guard lock(mutex);
+    return allocations;
+}
+
+void ImagePool::trim() {
+    std::lock_guard lock(mutex);
+    free_images.clear();
+    retained = 0;
+}
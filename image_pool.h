@@ -0,0 +1,59 @@
+#ifndef IMAGE_POOL_H
+#define IMAGE_POOL_H
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <vector>
+#include "tgaimage.h"
+
+class ImagePool;
+
+// An image borrowed from an ImagePool, handed back when the handle goes away.
+class PooledImage {
+    ImagePool *pool;
+    TGAImage image;
+
+    friend class ImagePool;
+    PooledImage(ImagePool *pool, TGAImage &&image);
+public:
+    PooledImage(PooledImage &&other) noexcept;
+    PooledImage &operator=(PooledImage &&other) noexcept;
+    PooledImage(const PooledImage &) = delete;
+    PooledImage &operator=(const PooledImage &) = delete;
+    ~PooledImage();
+
+    TGAImage &operator*() { return image; }
+    TGAImage *operator->() { return &image; }
+    const TGAImage &operator*() const { return image; }
+    const TGAImage *operator->() const { return &image; }
+};
+
+// Recycles framebuffers and depth buffers of matching dimensions across frames and jobs,
+// so a batch of same-sized renders stops allocating after the first frame.
+class ImagePool {
+    using Key = std::tuple<int, int, int>;
+    std::map<Key, std::vector<TGAImage>> free_images;
+    size_t retained;
+    size_t max_retained;
+    size_t allocations;
+    mutable std::mutex mutex;
+
+    friend class PooledImage;
+    void release(TGAImage &&image);
+public:
+    explicit ImagePool(size_t max_retained = 64);
+    ImagePool(const ImagePool &) = delete;
+    ImagePool &operator=(const ImagePool &) = delete;
+
+    static ImagePool &instance();
+
+    // returns a zero-filled image, reusing a released one of the same size when possible
+    PooledImage acquire(int width, int height, int bytespp);
+    // number of images the pool had to allocate so far
+    [[nodiscard]] size_t allocated() const;
+    void trim();
+};
+
+#endif //IMAGE_POOL_H
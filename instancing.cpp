@@ -0,0 +1,156 @@
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <tuple>
+#include "instancing.h"
+#include "pipeline.h"
+#include "profiler.h"
+#include "scheduler.h"
+
+// vertices transformed per batch, which bounds the batch buffers
+constexpr int BATCH_VERTICES = 1 << 18;
+
+InstancedMesh::InstancedMesh(Model const& model) {
+    // a vertex is unique per position and normal, as faces may share positions only
+    std::map<std::tuple<size_t, float, float, float>, int> unique;
+    for (int f = 0; f < static_cast<int>(model.number_of_faces()); f++) {
+        std::vector<size_t> face = model.face_at(f);
+        for (int j = 0; j < 3; j++) {
+            Vec3f n = model.normal_at(f, j);
+            auto [at, added] = unique.try_emplace({face[j], n.x, n.y, n.z}, number_of_vertices());
+            if (added) {
+                Vec3f p = model.vertex_at(face[j]);
+                positions.insert(positions.end(), {p.x, p.y, p.z});
+                normals.insert(normals.end(), {n.x, n.y, n.z});
+            }
+            indices.push_back(at->second);
+        }
+    }
+    for (int a = 0; a < 3; a++) {
+        lo[a] = hi[a] = positions.empty() ? 0 : positions[a];
+    }
+    for (size_t i = 0; i < positions.size(); i++) {
+        lo[i % 3] = std::min(lo[i % 3], positions[i]);
+        hi[i % 3] = std::max(hi[i % 3], positions[i]);
+    }
+}
+
+// the per-instance state of one batch: screen vertices and their light intensity
+struct InstanceBatch {
+    InstancedMesh const& mesh;
+    std::vector<Mat4x4f> mvpscr;
+    std::vector<Vec3f> light;
+    std::vector<int> instance;
+    std::vector<Vec3i> screen;
+    std::vector<float> intensity;
+
+    explicit InstanceBatch(InstancedMesh const& mesh) : mesh(mesh) {}
+
+    // whether the bounds of the mesh under mvpscr reach the screen in front of the camera
+    static bool visible(InstancedMesh const& mesh, Mat4x4f const& mvpscr, ScreenRect const& screen);
+    void transform(int k);
+};
+
+bool InstanceBatch::visible(InstancedMesh const& mesh, Mat4x4f const& m, ScreenRect const& screen) {
+    float x0 = INFINITY, y0 = INFINITY, x1 = -INFINITY, y1 = -INFINITY;
+    int behind = 0;
+    for (int corner = 0; corner < 8; corner++) {
+        float p[3] = {corner & 1 ? mesh.hi[0] : mesh.lo[0], corner & 2 ? mesh.hi[1] : mesh.lo[1],
+                      corner & 4 ? mesh.hi[2] : mesh.lo[2]};
+        float w = m[3][0] * p[0] + m[3][1] * p[1] + m[3][2] * p[2] + m[3][3];
+        if (w <= 0) {
+            behind++;
+            continue;
+        }
+        float x = (m[0][0] * p[0] + m[0][1] * p[1] + m[0][2] * p[2] + m[0][3]) / w;
+        float y = (m[1][0] * p[0] + m[1][1] * p[1] + m[1][2] * p[2] + m[1][3]) / w;
+        x0 = std::min(x0, x);
+        x1 = std::max(x1, x);
+        y0 = std::min(y0, y);
+        y1 = std::max(y1, y);
+    }
+    // bounds crossing the camera plane project to no sensible rectangle, so they are kept
+    if (behind) return behind < 8;
+    return x1 >= screen.x0 && x0 < screen.x1 && y1 >= screen.y0 && y0 < screen.y1;
+}
+
+void InstanceBatch::transform(int k) {
+    Mat4x4f const& m = mvpscr[k];
+    Vec3f const& l = light[k];
+    const int vertices = mesh.number_of_vertices();
+    for (int v = 0; v < vertices; v++) {
+        const float* p = &mesh.positions[3 * v];
+        const float* n = &mesh.normals[3 * v];
+        float w = m[3][0] * p[0] + m[3][1] * p[1] + m[3][2] * p[2] + m[3][3];
+        // truncated as draw_shaded does
+        screen[k * vertices + v] = Vec3i((m[0][0] * p[0] + m[0][1] * p[1] + m[0][2] * p[2] + m[0][3]) / w,
+                                         (m[1][0] * p[0] + m[1][1] * p[1] + m[1][2] * p[2] + m[1][3]) / w,
+                                         (m[2][0] * p[0] + m[2][1] * p[1] + m[2][2] * p[2] + m[2][3]) / w);
+        intensity[k * vertices + v] = std::max(0.f, n[0] * l.x + n[1] * l.y + n[2] * l.z);
+    }
+}
+
+InstanceStats draw_instanced(InstancedMesh const& mesh, std::vector<Instance> const& instances, Mat4x4f const& vpscr,
+                             Vec3f const& light, ColorTarget& framebuffer, DepthTarget& zbuffer,
+                             std::vector<uint8_t> const* bins) {
+    PROFILE_SCOPE("draw instanced");
+    InstanceStats stats;
+    const ScreenRect screen = framebuffer.bounds();
+    const int vertices = mesh.number_of_vertices(), faces = mesh.number_of_faces();
+    const int batch_size = std::max(1, BATCH_VERTICES / std::max(1, vertices));
+    const Vec3f world_light = light.normalized();
+
+    InstanceBatch batch(mesh);
+    for (size_t next = 0; next < instances.size();) {
+        batch.mvpscr.clear();
+        batch.light.clear();
+        batch.instance.clear();
+        {
+            PROFILE_SCOPE("instance culling");
+            for (; next < instances.size() && static_cast<int>(batch.instance.size()) < batch_size; next++) {
+                Mat4x4f const& transform = instances[next].transform;
+                Mat4x4f mvpscr = vpscr * transform;
+                if (!InstanceBatch::visible(mesh, mvpscr, screen)) {
+                    stats.culled++;
+                    continue;
+                }
+                // the light in model space, so the shared normals need no transform
+                Vec3f l;
+                for (int a = 0; a < 3; a++) {
+                    l[a] = transform[0][a] * world_light.x + transform[1][a] * world_light.y + transform[2][a] * world_light.z;
+                }
+                batch.mvpscr.push_back(mvpscr);
+                batch.light.push_back(l.normalized());
+                batch.instance.push_back(static_cast<int>(next));
+            }
+        }
+        const int count = static_cast<int>(batch.instance.size());
+        if (!count) continue;
+        stats.drawn += count;
+
+        batch.screen.resize(static_cast<size_t>(count) * vertices);
+        batch.intensity.resize(static_cast<size_t>(count) * vertices);
+        Scheduler::instance().parallel_for(0, count, 1, [&](int first, int last) {
+            PROFILE_SCOPE("instance vertices");
+            for (int k = first; k < last; k++) batch.transform(k);
+        });
+
+        BinnedFaces binned;
+        bin_faces(count * faces, screen, [&](int face, ScreenTriangle& t) {
+            const int k = face / faces, f = face % faces;
+            for (int j = 0; j < 3; j++) t[j] = batch.screen[k * vertices + mesh.vertex_of(f, j)];
+        }, binned, bins);
+        raster_bins(binned, [&](int face, ScreenTriangle const& t, ScreenRect const& clip) {
+            const int k = face / faces, f = face % faces;
+            const float* intensity = &batch.intensity[k * vertices];
+            const float ia = intensity[mesh.vertex_of(f, 0)], ib = intensity[mesh.vertex_of(f, 1)],
+                        ic = intensity[mesh.vertex_of(f, 2)];
+            const TGAColor color = instances[batch.instance[k]].color;
+            triangle_with_z(t[0].x, t[0].y, t[0].z, t[1].x, t[1].y, t[1].z, t[2].x, t[2].y, t[2].z,
+                            framebuffer, zbuffer, clip, [&](double alpha, double beta, double gamma) {
+                return color * static_cast<float>(alpha * ia + beta * ib + gamma * ic);
+            });
+        });
+    }
+    return stats;
+}
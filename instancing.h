@@ -0,0 +1,59 @@
+#ifndef INSTANCING_H
+#define INSTANCING_H
+
+#include <cstdint>
+#include <vector>
+#include "matrix.h"
+#include "model.h"
+#include "render_target.h"
+#include "tgaimage.h"
+#include "vec.h"
+
+// one copy of an instanced mesh
+struct Instance {
+    // model space to world space; rotation, translation and uniform scale
+    Mat4x4f transform = Mat4x4f::identity<4>();
+    // the lit color of this copy
+    TGAColor color = TGAColor(255, 255, 255);
+};
+
+// The vertex attributes of a model fetched once for every instance drawn from it: unique
+// positions and normals in flat arrays, faces as indices into them, and the bounds the
+// per-instance culling tests
+class InstancedMesh {
+public:
+    explicit InstancedMesh(Model const& model);
+
+    [[nodiscard]] int number_of_vertices() const { return static_cast<int>(positions.size() / 3); }
+    [[nodiscard]] int number_of_faces() const { return static_cast<int>(indices.size() / 3); }
+    // the vertex of the nth corner of a face
+    [[nodiscard]] int vertex_of(int face, int nth) const { return indices[3 * face + nth]; }
+    // the corners of the model space bounds
+    [[nodiscard]] Vec3f lower() const { return Vec3f(lo[0], lo[1], lo[2]); }
+    [[nodiscard]] Vec3f upper() const { return Vec3f(hi[0], hi[1], hi[2]); }
+
+private:
+    friend struct InstanceBatch;
+    std::vector<float> positions;
+    std::vector<float> normals;
+    std::vector<int> indices;
+    float lo[3], hi[3];
+};
+
+struct InstanceStats {
+    int drawn = 0;
+    int culled = 0;
+};
+
+// Draws every instance of the mesh Gouraud-lit by a directional light in world space.
+// vpscr takes world space to the screen, as mvpscr does for draw_shaded. Instances whose
+// bounds fall outside the screen or behind the camera are skipped before any vertex work.
+// The others are drawn in batches: the Scheduler threads transform the shared vertices of
+// each instance once, then bin and rasterize the batch's faces into the shared targets.
+// The image equals drawing the instances one after the other. A mask of BIN x BIN bins, as
+// bin_faces takes, limits the drawing to the bins set in it.
+InstanceStats draw_instanced(InstancedMesh const& mesh, std::vector<Instance> const& instances, Mat4x4f const& vpscr,
+                             Vec3f const& light, ColorTarget& framebuffer, DepthTarget& zbuffer,
+                             std::vector<uint8_t> const* bins = nullptr);
+
+#endif //INSTANCING_H
@@ -0,0 +1,176 @@
+#include <algorithm>
+#include <cmath>
+#include "lights.h"
+#include "pipeline.h"
+#include "profiler.h"
+#include "shaders.h"
+
+// lights whose bounds the build pass projects per task
+constexpr int LIGHT_CHUNK = 64;
+
+Light Light::point(Vec3f const& position, Vec3f const& color, float radius) {
+    Light light;
+    light.position = position;
+    light.color = color;
+    light.radius = radius;
+    return light;
+}
+
+Light Light::spot(Vec3f const& position, Vec3f const& direction, Vec3f const& color, float radius, float inner,
+                  float outer) {
+    Light light = point(position, color, radius);
+    light.direction = direction.normalized();
+    light.cos_inner = std::cos(std::min(inner, outer));
+    light.cos_outer = std::cos(outer);
+    return light;
+}
+
+void Light::bounds(Vec3f& center, float& extent) const {
+    center = position;
+    extent = radius;
+    // cones wider than a right angle fill most of the sphere anyway
+    if (cos_outer <= 0) return;
+    if (cos_outer < std::sqrt(.5f)) {
+        // the sphere around the circle of the rim, which the apex lies within
+        center = position + direction * (radius * cos_outer);
+        extent = radius * std::sqrt(1 - cos_outer * cos_outer);
+    } else {
+        // the sphere through the apex and the rim, which the far end of a narrow cone fits in
+        center = position + direction * (radius / (2 * cos_outer));
+        extent = radius / (2 * cos_outer);
+    }
+}
+
+namespace {
+
+// a light's bounds on screen, in pixels and 8-bit depth
+struct LightRect {
+    float x0, y0, x1, y1;
+    float z0, z1;
+};
+
+// the rectangle and depth range of the corners of the box around the light's bounds; all of
+// the screen and every depth when the box crosses the camera plane
+LightRect light_rect(Light const& light, Mat4x4f const& m) {
+    Vec3f center;
+    float extent;
+    light.bounds(center, extent);
+    LightRect rect{INFINITY, INFINITY, -INFINITY, -INFINITY, INFINITY, -INFINITY};
+    for (int corner = 0; corner < 8; corner++) {
+        const float p[3] = {center.x + (corner & 1 ? extent : -extent), center.y + (corner & 2 ? extent : -extent),
+                            center.z + (corner & 4 ? extent : -extent)};
+        const float w = m[3][0] * p[0] + m[3][1] * p[1] + m[3][2] * p[2] + m[3][3];
+        if (w <= 0) return {-INFINITY, -INFINITY, INFINITY, INFINITY, -INFINITY, INFINITY};
+        const float x = (m[0][0] * p[0] + m[0][1] * p[1] + m[0][2] * p[2] + m[0][3]) / w;
+        const float y = (m[1][0] * p[0] + m[1][1] * p[1] + m[1][2] * p[2] + m[1][3]) / w;
+        const float z = (m[2][0] * p[0] + m[2][1] * p[1] + m[2][2] * p[2] + m[2][3]) / w;
+        rect.x0 = std::min(rect.x0, x);
+        rect.x1 = std::max(rect.x1, x);
+        rect.y0 = std::min(rect.y0, y);
+        rect.y1 = std::max(rect.y1, y);
+        rect.z0 = std::min(rect.z0, z);
+        rect.z1 = std::max(rect.z1, z);
+    }
+    return rect;
+}
+
+} // namespace
+
+void LightGrid::build(std::span<const Light> lights, Mat4x4f const& mvpscr, DepthTarget const& zbuffer) {
+    Scheduler& scheduler = Scheduler::instance();
+    tiles_x = (zbuffer.get_width() + LIGHT_TILE - 1) / LIGHT_TILE;
+    tiles_y = (zbuffer.get_height() + LIGHT_TILE - 1) / LIGHT_TILE;
+    const int count = static_cast<int>(lights.size());
+    std::vector<LightRect> rects(count);
+    scheduler.parallel_for(0, count, LIGHT_CHUNK, [&](int first, int last) {
+        for (int i = first; i < last; i++) rects[i] = light_rect(lights[i], mvpscr);
+    });
+
+    // every row of tiles fills lists of its own, joined in order after
+    std::vector<std::vector<int>> rows(tiles_y);
+    std::vector<size_t> counts(static_cast<size_t>(tiles_x) * tiles_y);
+    scheduler.parallel_for(0, tiles_y, 1, [&](int first, int last) {
+        PROFILE_SCOPE("light culling");
+        constexpr int SCALE = LIGHT_TILE / RENDER_TILE;
+        constexpr int TEXELS = DepthTarget::TILE_TEXELS;
+        std::vector<int> row_lights;
+        for (int ty = first; ty < last; ty++) {
+            // the lights reaching the row at all; a pixel of slack each way for the rounding of
+            // the vertices the shaded positions come from
+            const float y0 = static_cast<float>(ty * LIGHT_TILE), y1 = y0 + LIGHT_TILE;
+            row_lights.clear();
+            for (int i = 0; i < count; i++) {
+                if (rects[i].y1 + 1 >= y0 && rects[i].y0 - 1 < y1) row_lights.push_back(i);
+            }
+            for (int tx = 0; tx < tiles_x; tx++) {
+                // the depth range of what was drawn in the tile; cleared texels hold 0
+                int z0 = 256, z1 = 0;
+                for (int ry = ty * SCALE; ry < std::min(zbuffer.get_tiles_y(), (ty + 1) * SCALE); ry++) {
+                    for (int rx = tx * SCALE; rx < std::min(zbuffer.get_tiles_x(), (tx + 1) * SCALE); rx++) {
+                        const uint8_t* z = zbuffer.data() + (static_cast<size_t>(ry) * zbuffer.get_tiles_x() + rx) * TEXELS;
+                        for (int k = 0; k < TEXELS; k++) {
+                            if (!z[k]) continue;
+                            z0 = std::min<int>(z0, z[k]);
+                            z1 = std::max<int>(z1, z[k]);
+                        }
+                    }
+                }
+                if (z0 > z1) continue;
+                const float x0 = static_cast<float>(tx * LIGHT_TILE), x1 = x0 + LIGHT_TILE;
+                size_t& n = counts[static_cast<size_t>(ty) * tiles_x + tx];
+                for (int i : row_lights) {
+                    LightRect const& r = rects[i];
+                    // a drawn depth of z stands for [z, z + 1), a step of slack each way as well
+                    if (r.x1 + 1 >= x0 && r.x0 - 1 < x1 && r.z1 + 1 >= z0 && r.z0 - 1 < z1 + 1) {
+                        rows[ty].push_back(i);
+                        n++;
+                    }
+                }
+            }
+        }
+    });
+
+    offsets.assign(counts.size() + 1, 0);
+    for (size_t tile = 0; tile < counts.size(); tile++) offsets[tile + 1] = offsets[tile] + counts[tile];
+    indices.resize(offsets.back());
+    for (int ty = 0; ty < tiles_y; ty++) {
+        std::copy(rows[ty].begin(), rows[ty].end(), indices.begin() + offsets[static_cast<size_t>(ty) * tiles_x]);
+    }
+}
+
+int LightGrid::longest() const {
+    size_t most = 0;
+    for (size_t tile = 0; tile + 1 < offsets.size(); tile++) most = std::max(most, offsets[tile + 1] - offsets[tile]);
+    return static_cast<int>(most);
+}
+
+void draw_lit(Model const& model, LitShader const& shader, Mat4x4f const& mvpscr, ColorTarget& framebuffer,
+              DepthTarget& zbuffer, LightGrid& grid) {
+    Varyings varyings(model.number_of_faces(), shader.varyings());
+    BinnedFaces binned;
+    bin_faces(model.number_of_faces(), framebuffer.bounds(), [&](int face_id, ScreenTriangle& coords) {
+        VertexData vd = varyings.reset(face_id);
+        for (int j = 0; j < 3; j++) {
+            auto [x, y, z] = transform(shader.eval_vertex(model, face_id, j, vd), mvpscr).view();
+            coords[j] = Vec3i(x, y, z);
+        }
+    }, binned);
+    {
+        PROFILE_SCOPE("z prepass");
+        raster_bins(binned, [&](int, ScreenTriangle const& coords, ScreenRect const& clip) {
+            depth_triangle(coords[0].x, coords[0].y, coords[0].z,
+                           coords[1].x, coords[1].y, coords[1].z,
+                           coords[2].x, coords[2].y, coords[2].z, zbuffer, clip);
+        });
+    }
+    grid.build(shader.lights ? std::span<const Light>(*shader.lights) : std::span<const Light>(), mvpscr, zbuffer);
+    const int tiles_x = framebuffer.get_tiles_x();
+    raster_bins(binned, [&](int face_id, ScreenTriangle const& coords, ScreenRect const& clip) {
+        shading_triangle_equal(coords[0].x, coords[0].y, coords[0].z,
+                               coords[1].x, coords[1].y, coords[1].z,
+                               coords[2].x, coords[2].y, coords[2].z, framebuffer, zbuffer, clip,
+                               [&](size_t index, Vec3d const& abg) {
+            return shader.eval_fragment(model, varyings[face_id], abg, grid.at_texel(index, tiles_x));
+        });
+    });
+}
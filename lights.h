@@ -0,0 +1,84 @@
+#ifndef LIGHTS_H
+#define LIGHTS_H
+
+#include <span>
+#include <vector>
+#include "matrix.h"
+#include "model.h"
+#include "render_target.h"
+#include "vec.h"
+
+struct LitShader;
+
+// A point light, or a spot light when it has a cone. It reaches what lies within radius of
+// its position and fades to nothing there.
+struct Light {
+    Vec3f position;
+    // per channel, 1 is full
+    Vec3f color{1, 1, 1};
+    float radius = 1;
+    // spot lights shine along direction, fully within the angle of cos_inner and fading out
+    // to cos_outer; point lights keep -1 for both
+    Vec3f direction{0, 0, -1};
+    float cos_inner = -1;
+    float cos_outer = -1;
+
+    static Light point(Vec3f const& position, Vec3f const& color, float radius);
+    // inner and outer are half-angles in radians
+    static Light spot(Vec3f const& position, Vec3f const& direction, Vec3f const& color, float radius, float inner,
+                      float outer);
+
+    // the sphere holding everything the light reaches: a point light's own, a tighter one
+    // around a narrow cone
+    void bounds(Vec3f& center, float& extent) const;
+};
+
+// edge of the screen tiles the lights are binned into, 2 x 2 render tiles
+constexpr int LIGHT_TILE = 2 * RENDER_TILE;
+
+// Lists of the lights that may reach each LIGHT_TILE x LIGHT_TILE tile of a frame
+class LightGrid {
+public:
+    // Bins the lights into the tiles of zbuffer, which mvpscr drew from world space. A light
+    // goes to a tile when the screen rectangle and depth range of its bounds overlap the tile
+    // and the depths drawn in it; tiles where nothing was drawn keep no lights. One task per
+    // row of tiles. The depth test takes mvpscr's depth as the 8-bit depth zbuffer holds, so
+    // mvpscr must map the model and the lights' bounds into [0, 255], as camera_transform
+    // does with a near and far range enclosing them. viewport_transform's depth wraps past
+    // 255, and lights would silently be left out of tiles they reach.
+    void build(std::span<const Light> lights, Mat4x4f const& mvpscr, DepthTarget const& zbuffer);
+
+    [[nodiscard]] int get_tiles_x() const { return tiles_x; }
+    [[nodiscard]] int get_tiles_y() const { return tiles_y; }
+    [[nodiscard]] std::span<const int> at(int tx, int ty) const {
+        const size_t tile = static_cast<size_t>(ty) * tiles_x + tx;
+        return {indices.data() + offsets[tile], indices.data() + offsets[tile + 1]};
+    }
+    // the lights of the tile holding the texel at index in a target of render_tiles_x tiles
+    [[nodiscard]] std::span<const int> at_texel(size_t index, int render_tiles_x) const {
+        const size_t tile = index / (RENDER_TILE * RENDER_TILE);
+        constexpr int SCALE = LIGHT_TILE / RENDER_TILE;
+        return at(static_cast<int>(tile % render_tiles_x) / SCALE, static_cast<int>(tile / render_tiles_x) / SCALE);
+    }
+    // lights in all lists together, and in the longest
+    [[nodiscard]] size_t entries() const { return indices.size(); }
+    [[nodiscard]] int longest() const;
+
+private:
+    int tiles_x = 0;
+    int tiles_y = 0;
+    // the lists one after another, tile t's in [offsets[t], offsets[t + 1])
+    std::vector<size_t> offsets;
+    std::vector<int> indices;
+};
+
+// Draws every face of the model with the shader's lights, forward+: the faces are binned
+// once, a depth-only pass fills zbuffer, grid.build bins the lights into tiles by its depth
+// and the shading pass runs the fragment shader at the visible pixels with the lights of
+// their tile only. mvpscr takes world space, which is the model's, to the screen, with the
+// depth range LightGrid::build needs. Equals draw_shaded of the shader with the z-prepass,
+// which tries every light at every pixel.
+void draw_lit(Model const& model, LitShader const& shader, Mat4x4f const& mvpscr, ColorTarget& framebuffer,
+              DepthTarget& zbuffer, LightGrid& grid);
+
+#endif //LIGHTS_H
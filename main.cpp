@@ -1,14 +1,30 @@
+#include <chrono>
 #include <cmath>
+#include <csignal>
 #include <iostream>
+#include <random>
 #include <cassert>
+#include <unistd.h>
 #include "tgaimage.h"
 #include "model.h"
+#include "asset_loader.h"
+#include "bake.h"
+#include "batch.h"
+#include "command_buffer.h"
+#include "frame_sink.h"
+#include "instancing.h"
+#include "lights.h"
+#include "progressive.h"
+#include "scene.h"
+#include "server.h"
+#include "image_pool.h"
 #include <functional>
 #include <utils.h>
 
 #include "matrix.h"
 #include "shaders.h"
 #include "gl.h"
+#include "pipeline.h"
 
 
 int model_render(int argc, char **argv) {
@@ -46,6 +62,19 @@ int model_render(int argc, char **argv) {
     return 0;
 }
 
+// resolves both targets into pooled images and writes them top-down
+void write_targets(ColorTarget const& framebuffer, DepthTarget const& zbuffer,
+                   const char* framebuffer_file, const char* zbuffer_file) {
+    auto image = ImagePool::instance().acquire(framebuffer.get_width(), framebuffer.get_height(), TGAImage::RGB);
+    resolve(framebuffer, *image);
+    image->flip_vertically();
+    image->write_tga_file(framebuffer_file);
+
+    resolve(zbuffer, *image);
+    image->flip_vertically();
+    image->write_tga_file(zbuffer_file);
+}
+
 Vec3f transform_to_viewport(Vec3f v, const int width, const int height) {
     return { (v.x + 1.0f) * width/2, (v.y + 1.0f) * height/2, (v.z + 1.0f) * 255/2 };
 }
@@ -59,33 +88,33 @@ int model_render_in_z(int argc, char **argv) {
     constexpr int width = 800;
     constexpr int height = 800;
     Model model(argv[1]);
-    TGAImage framebuffer(width, height, TGAImage::RGB);
-    TGAImage     zbuffer(width, height, TGAImage::RGB);
+    ColorTarget framebuffer(width, height);
+    DepthTarget     zbuffer(width, height);
 
+    // drawn up front so the colors do not depend on how the faces are split over threads
+    std::vector<TGAColor> colors;
     for (int i = 0; i < model.number_of_faces(); i++) {
+        colors.push_back(TGAColor(rand()%255, rand()%255, rand()%255, 255));
+    }
+
+    draw_faces(model.number_of_faces(), framebuffer, zbuffer,
+               [&](int i, ScreenTriangle& coords) {
         std::vector<size_t> face = model.face_at(i);
-        std::array<Vec3i, 3> coords;
         for (int j = 0; j < 3; j++) {
             Vec3f v0 = model.vertex_at(face[j]);
             auto [x, y, z] = transform_to_viewport(v0, width, height).view();
             coords[j] = Vec3i(x, y, z);
         }
-
-        auto color = TGAColor(rand()%255, rand()%255, rand()%255, 255);
+    }, [&](int i, ScreenTriangle const& coords, ScreenRect const& clip, ColorTarget& framebuffer, DepthTarget& zbuffer) {
+        auto color = colors[i];
         triangle_with_z(coords[0].x, coords[0].y, coords[0].z,
                         coords[1].x, coords[1].y, coords[1].z,
                         coords[2].x, coords[2].y, coords[2].z,
-                        framebuffer, zbuffer,
+                        framebuffer, zbuffer, clip,
                         [&color] (double alpha, double beta, double gamma) { return color; });
-    }
-
-    framebuffer.flip_vertically();
-
-    framebuffer.write_tga_file("model_render_z_buffered.tga");
-
-    zbuffer.flip_vertically();
+    });
 
-    zbuffer.write_tga_file("model_render_z_buffer.tga");
+    write_targets(framebuffer, zbuffer, "model_render_z_buffered.tga", "model_render_z_buffer.tga");
     return 0;
 }
 
@@ -107,36 +136,35 @@ int model_render_perspective(int argc, char **argv) {
 
     auto viewport = viewport_transform(width, height, 255);
     Model model(argv[1]);
-    TGAImage framebuffer(width, height, TGAImage::RGB);
-    TGAImage     zbuffer(width, height, TGAImage::RGB);
+    ColorTarget framebuffer(width, height);
+    DepthTarget     zbuffer(width, height);
 
     auto mvp = viewport * perspective * view;
 
+    std::vector<TGAColor> colors;
     for (int i = 0; i < model.number_of_faces(); i++) {
+        colors.push_back(TGAColor(rand()%255, rand()%255, rand()%255, 255));
+    }
+
+    draw_faces(model.number_of_faces(), framebuffer, zbuffer,
+               [&](int i, ScreenTriangle& coords) {
         std::vector<size_t> face = model.face_at(i);
-        std::array<Vec3i, 3> coords;
         for (int j = 0; j < 3; j++) {
             Vec3f v0 = model.vertex_at(face[j]);
             // template<size_t C2> Matrix<T, R, C2> operator*(const Matrix<T, C, C2>& a) const;
             auto [x, y, z] = transform(v0, mvp).view();
             coords[j] = Vec3i(x, y, z);
         }
-
-        auto color = TGAColor(rand()%255, rand()%255, rand()%255, 255);
+    }, [&](int i, ScreenTriangle const& coords, ScreenRect const& clip, ColorTarget& framebuffer, DepthTarget& zbuffer) {
+        auto color = colors[i];
         triangle_with_z(coords[0].x, coords[0].y, coords[0].z,
                         coords[1].x, coords[1].y, coords[1].z,
                         coords[2].x, coords[2].y, coords[2].z,
-                        framebuffer, zbuffer,
+                        framebuffer, zbuffer, clip,
                         [&color] (double alpha, double beta, double gamma) { return color; });
-    }
-
-    framebuffer.flip_vertically();
-
-    framebuffer.write_tga_file("model_render_perspective.tga");
-
-    zbuffer.flip_vertically();
+    });
 
-    zbuffer.write_tga_file("model_render_perspective_z_buffer.tga");
+    write_targets(framebuffer, zbuffer, "model_render_perspective.tga", "model_render_perspective_z_buffer.tga");
     return 0;
 }
 
@@ -146,6 +174,10 @@ int model_render_perspective_textured(int argc, char **argv) {
         return 1;
     }
 
+    auto start = std::chrono::steady_clock::now();
+    // PhongShader samples the diffuse and normal maps only
+    auto handle = load_model_async(argv[1], Model::DIFFUSE_MAP | Model::NORMAL_MAP);
+
     Vec3f camPos = Vec3f(0.5, 0.5, 1);
     Vec3f camTowards = Vec3f(0, 0, -0.5);
     Vec3f camUp = Vec3f(0, 1, 0);
@@ -157,9 +189,10 @@ int model_render_perspective_textured(int argc, char **argv) {
     constexpr int height = 800;
 
     auto viewport = viewport_transform(width, height, 255);
-    Model model(argv[1]);
-    TGAImage framebuffer(width, height, TGAImage::RGB);
-    TGAImage     zbuffer(width, height, TGAImage::RGB);
+    ColorTarget framebuffer(width, height);
+    DepthTarget     zbuffer(width, height);
+    auto model_ptr = handle.get();
+    Model const& model = *model_ptr;
 
     auto mvpscr = viewport * perspective * view;
     auto mvp = perspective * view;
@@ -169,34 +202,505 @@ int model_render_perspective_textured(int argc, char **argv) {
     shader.mvp = mvp;
     shader.mvp_inv = mvp.inverse().transpose();
     shader.cam_pos = camPos;
-    for (int face_id = 0; face_id < model.number_of_faces(); face_id++) {
-        std::vector<size_t> face = model.face_at(face_id);
-        std::array<Vec3i, 3> coords;
-        VertexData vd{
-            {Vec3f(1, 1, 1)}
-        };
-        for (int j = 0; j < 3; j++) {
-            auto manu_coord = shader.eval_vertex(model, face_id, j, vd);
-            auto [x, y, z] = transform(manu_coord, mvpscr).view();
-            coords[j] = Vec3i(x, y, z);
+    draw_shaded(model, shader, mvpscr, framebuffer, zbuffer);
+
+    write_targets(framebuffer, zbuffer, "render_textured_uv_specular.tga", "render_textured_z_uv_specular.tga");
+    auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+    std::cerr << "# time to first frame " << elapsed.count() << " ms" << std::endl;
+    return 0;
+}
+
+// the textured render drawn progressively: a Gouraud preview at a quarter of the size within
+// first_ms, then Phong tiles until done or deadline_ms; writes the preview and the last image
+int model_render_progressive(int argc, char **argv) {
+    if (argc < 2 || argc > 4) {
+        std::cerr << "Usage: " << argv[0] << " obj/model.obj [first ms] [deadline ms]" << std::endl;
+        return 1;
+    }
+    ProgressiveOptions options;
+    if (argc > 2) options.first_ms = std::atof(argv[2]);
+    if (argc > 3) options.deadline_ms = std::atof(argv[3]);
+
+    constexpr int width = 800;
+    constexpr int height = 800;
+    auto model_ptr = load_model_async(argv[1], Model::DIFFUSE_MAP | Model::NORMAL_MAP).get();
+    Model const& model = *model_ptr;
+
+    Vec3f camPos = Vec3f(0.5, 0.5, 1);
+    auto mvp = perspective_transform(-1, 1, 1) * view_transform(Vec3f(0, 0, -0.5), camPos, Vec3f(0, 1, 0));
+    GouraudShader preview;
+    preview.lightDirection = Vec3f(1, 1, 0).normalized();
+    PhongShader shader;
+    shader.lightDirection = Vec3f(1, 1, 0);
+    shader.mvp = mvp;
+    shader.mvp_inv = mvp.inverse().transpose();
+    shader.cam_pos = camPos;
+
+    TGAImage last;
+    ProgressiveStats stats = render_progressive(model, preview, shader, mvp, width, height, options,
+                                                [&](TGAImage const& image, int refined, int) {
+        last = image;
+        if (refined) return;
+        last.flip_vertically();
+        last.write_tga_file("render_progressive_first.tga");
+    });
+    last.flip_vertically();
+    last.write_tga_file("render_progressive.tga");
+    std::cerr << "# first image after " << stats.first_ms << " ms with " << stats.coarse_faces << " of "
+              << model.number_of_faces() << " faces, " << stats.tiles_refined << " of " << stats.tiles
+              << " tiles refined after " << stats.last_ms << " ms" << std::endl;
+    return 0;
+}
+
+// the textured render at coarser shading rates against full rate: every tile at 2 x 2 and
+// at 4 x 4, the rates of a rate image when one is given, and the rates the depth and normals
+// of the previous frame of a turntable, two degrees back, call for
+int model_render_rates(int argc, char **argv) {
+    if (argc < 2 || argc > 3) {
+        std::cerr << "Usage: " << argv[0] << " obj/model.obj [rate image.tga, a pixel per 8x8 tile]" << std::endl;
+        return 1;
+    }
+    constexpr int width = 800;
+    constexpr int height = 800;
+    auto model_ptr = load_model_async(argv[1], Model::DIFFUSE_MAP | Model::NORMAL_MAP).get();
+    Model const& model = *model_ptr;
+
+    // the camera of the textured render turned about the vertical through its target
+    auto shader_at = [](float degrees) {
+        const float a = degrees * static_cast<float>(M_PI) / 180, c = std::cos(a), s = std::sin(a);
+        const Vec3f target(0, 0, -0.5), eye = target + Vec3f(.5f * c + 1.5f * s, .5f, 1.5f * c - .5f * s);
+        PhongShader shader;
+        shader.set_uniforms({view_transform(target, eye, Vec3f(0, 1, 0)), perspective_transform(-1, 1, 1), eye,
+                             Vec3f(1, 1, 0)});
+        return shader;
+    };
+    const Mat4x4f viewport = viewport_transform(width, height, 255);
+    const PhongShader shader = shader_at(0);
+    ColorTarget reference(width, height), framebuffer(width, height), normals(width, height);
+    DepthTarget zbuffer(width, height);
+    const ShadingRates full(zbuffer.get_tiles_x(), zbuffer.get_tiles_y(), 1);
+    const uint64_t all = draw_shaded_rates(model, shader, viewport * shader.mvp, reference, zbuffer, full);
+
+    auto report = [&](const char* name, ShadingRates const& rates) {
+        framebuffer.clear();
+        zbuffer.clear();
+        auto start = std::chrono::steady_clock::now();
+        uint64_t runs = draw_shaded_rates(model, shader, viewport * shader.mvp, framebuffer, zbuffer, rates);
+        auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+        std::cerr << "# " << name << ": " << runs << " of " << all << " shader runs (" << 100. * (all - runs) / all
+                  << "% saved), PSNR " << psnr(reference, framebuffer) << " dB, " << elapsed.count() << " ms"
+                  << std::endl;
+    };
+    report("full rate", full);
+    report("2x2", ShadingRates(zbuffer.get_tiles_x(), zbuffer.get_tiles_y(), 2));
+    report("4x4", ShadingRates(zbuffer.get_tiles_x(), zbuffer.get_tiles_y(), 4));
+    if (argc > 2) {
+        TGAImage image;
+        if (!image.read_tga_file(argv[2])) {
+            std::cerr << "can't read " << argv[2] << std::endl;
+            return 1;
         }
+        report("rate image", ShadingRates::from_image(image, zbuffer.get_tiles_x(), zbuffer.get_tiles_y()));
+    }
 
-        shading_triangle(coords[0].x, coords[0].y, coords[0].z,
-                        coords[1].x, coords[1].y, coords[1].z,
-                        coords[2].x, coords[2].y, coords[2].z,
-                        model, framebuffer, zbuffer, shader, vd);
+    const PhongShader previous = shader_at(-2);
+    ColorTarget previous_color(width, height);
+    zbuffer.clear();
+    draw_shaded_rates(model, previous, viewport * previous.mvp, previous_color, zbuffer, full, &normals);
+    const ShadingRates geometry = ShadingRates::from_pass(zbuffer, normals);
+    const ShadingRates content = ShadingRates::from_pass(zbuffer, normals, &previous_color);
+    report("previous frame's depth and normals", geometry);
+    report("previous frame's depth, normals and color", content);
+    write_targets(framebuffer, zbuffer, "render_rates.tga", "render_rates_z.tga");
+    return 0;
+}
+
+// the model lit by count point and spot lights scattered around it, forward+ with per-tile
+// light lists against the same shader trying every light at every pixel
+int model_render_lights(int argc, char **argv) {
+    if (argc < 2 || argc > 3) {
+        std::cerr << "Usage: " << argv[0] << " obj/model.obj [lights]" << std::endl;
+        return 1;
+    }
+    const int count = argc > 2 ? std::atoi(argv[2]) : 256;
+    constexpr int width = 800;
+    constexpr int height = 800;
+    auto model_ptr = load_model_async(argv[1], Model::DIFFUSE_MAP | Model::NORMAL_MAP).get();
+    Model const& model = *model_ptr;
+
+    // every fourth one a spot aimed at the middle of the model
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> unit(0, 1);
+    std::vector<Light> lights;
+    for (int i = 0; i < count; i++) {
+        const float a = 2 * static_cast<float>(M_PI) * unit(random), y = 2 * unit(random) - 1;
+        const float r = std::sqrt(1 - y * y) * (.8f + .4f * unit(random));
+        const Vec3f position(r * std::cos(a), y, r * std::sin(a));
+        const Vec3f color(.2f + .6f * unit(random), .2f + .6f * unit(random), .2f + .6f * unit(random));
+        lights.push_back(i % 4 == 3 ? Light::spot(position, -position, color, .6f, .2f, .4f)
+                                    : Light::point(position, color, .3f));
     }
 
-    framebuffer.flip_vertically();
+    Vec3f camPos = Vec3f(0.5, 0.5, 1);
+    LitShader shader;
+    shader.set_uniforms({view_transform(Vec3f(0, 0, -0.5), camPos, Vec3f(0, 1, 0)), perspective_transform(-1, 1, 1),
+                         camPos, Vec3f(1, 1, 0)});
+    shader.lights = &lights;
+    // the model and its lights lie between 0.2 and 3 from the camera (see LightGrid::build)
+    const Mat4x4f mvpscr = camera_transform(camPos, Vec3f(0, 0, -0.5), Vec3f(0, 1, 0), width, height, .2f, 3);
+
+    ColorTarget every(width, height), framebuffer(width, height);
+    DepthTarget zbuffer(width, height);
+    auto start = std::chrono::steady_clock::now();
+    draw_shaded(model, shader, mvpscr, every, zbuffer, true);
+    auto naive = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+    zbuffer.clear();
+    LightGrid grid;
+    start = std::chrono::steady_clock::now();
+    draw_lit(model, shader, mvpscr, framebuffer, zbuffer, grid);
+    auto tiled = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+
+    int lit = 0;
+    for (int ty = 0; ty < grid.get_tiles_y(); ty++) {
+        for (int tx = 0; tx < grid.get_tiles_x(); tx++) lit += !grid.at(tx, ty).empty();
+    }
+    std::cerr << "# " << count << " lights: every light at every pixel " << naive.count() << " ms, per-tile lists "
+              << tiled.count() << " ms, " << static_cast<double>(grid.entries()) / std::max(1, lit)
+              << " lights per lit tile on average, " << grid.longest() << " at most, PSNR against every light "
+              << psnr(every, framebuffer) << " dB" << std::endl;
+    write_targets(framebuffer, zbuffer, "render_lights.tga", "render_lights_z.tga");
+    return 0;
+}
+
+// the textured render lit by a light at (1, 1, 0) that casts shadows: a depth-only pass from
+// the light into a shadow map, then the camera pass, which PhongShader darkens where the
+// map holds something closer to the light
+int model_render_shadowed(int argc, char **argv) {
+    if (argc < 2 || argc > 3) {
+        std::cerr << "Usage: " << argv[0] << " obj/model.obj [shadow map size]" << std::endl;
+        return 1;
+    }
+    const int shadow_size = argc > 2 ? std::atoi(argv[2]) : 1024;
+
+    constexpr int width = 800;
+    constexpr int height = 800;
+
+    auto model_ptr = load_model_async(argv[1], Model::DIFFUSE_MAP | Model::NORMAL_MAP).get();
+    Model const& model = *model_ptr;
+
+    Vec3f light = Vec3f(1, 1, 0);
+    Vec3f target = Vec3f(0, 0, 0);
+    DepthTarget shadow_map(shadow_size, shadow_size);
+    // the model fits in the unit cube, so everything lies between 0.3 and 2.5 from the light
+    auto light_mvpscr = light_space_transform(light, target, Vec3f(0, 1, 0), shadow_size, .3f, 2.5f);
+    draw_depth(model, light_mvpscr, shadow_map);
+
+    Vec3f camPos = Vec3f(0.5, 0.5, 1);
+    auto view = view_transform(Vec3f(0, 0, -0.5), camPos, Vec3f(0, 1, 0));
+    auto perspective = perspective_transform(-1, 1, 1);
+    auto mvp = perspective * view;
+    PhongShader shader;
+    shader.lightDirection = light;
+    shader.mvp = mvp;
+    shader.mvp_inv = mvp.inverse().transpose();
+    shader.cam_pos = camPos;
+    shader.shadow_map = &shadow_map;
+    shader.shadow_mvpscr = light_mvpscr;
+
+    ColorTarget framebuffer(width, height);
+    DepthTarget zbuffer(width, height);
+    draw_shaded(model, shader, viewport_transform(width, height, 255) * perspective * view, framebuffer, zbuffer);
+    write_targets(framebuffer, zbuffer, "render_shadowed.tga", "render_shadowed_z.tga");
+
+    auto image = ImagePool::instance().acquire(shadow_size, shadow_size, TGAImage::RGB);
+    resolve(shadow_map, *image);
+    image->flip_vertically();
+    image->write_tga_file("render_shadow_map.tga");
+    return 0;
+}
+
+// bakes ambient occlusion and the shadow of the light at (1, 1, 0) into a texture with rays
+// cast through a BVH, then renders the model with PhongShader sampling it
+int model_render_baked(int argc, char **argv) {
+    if (argc < 2 || argc > 4) {
+        std::cerr << "Usage: " << argv[0] << " obj/model.obj [texture size] [rays per texel]" << std::endl;
+        return 1;
+    }
+    BakeOptions options;
+    if (argc > 2) options.size = std::atoi(argv[2]);
+    if (argc > 3) options.ao_samples = std::atoi(argv[3]);
+    if (options.size < 1 || options.ao_samples < 1) {
+        std::cerr << "texture size and rays per texel must be at least 1" << std::endl;
+        return 1;
+    }
+
+    constexpr int width = 800;
+    constexpr int height = 800;
 
-    framebuffer.write_tga_file("render_textured_uv_specular.tga");
+    auto model_ptr = load_model_async(argv[1], Model::DIFFUSE_MAP | Model::NORMAL_MAP).get();
+    Model const& model = *model_ptr;
 
-    zbuffer.flip_vertically();
+    auto start = std::chrono::steady_clock::now();
+    Bvh bvh(model);
+    auto built = std::chrono::steady_clock::now();
+    TGAImage light_map = bake_lighting(model, bvh, options);
+    auto baked = std::chrono::steady_clock::now();
+    std::cerr << "# bvh of " << bvh.node_count() << " nodes, depth " << bvh.depth() << ", in "
+              << std::chrono::duration<double, std::milli>(built - start).count() << " ms; baked in "
+              << std::chrono::duration<double, std::milli>(baked - built).count() << " ms" << std::endl;
+    light_map.write_tga_file("baked_lighting.tga");
 
-    zbuffer.write_tga_file("render_textured_z_uv_specular.tga");
+    Vec3f camPos = Vec3f(0.5, 0.5, 1);
+    auto view = view_transform(Vec3f(0, 0, -0.5), camPos, Vec3f(0, 1, 0));
+    auto perspective = perspective_transform(-1, 1, 1);
+    auto mvp = perspective * view;
+    PhongShader shader;
+    shader.lightDirection = options.light;
+    shader.mvp = mvp;
+    shader.mvp_inv = mvp.inverse().transpose();
+    shader.cam_pos = camPos;
+    shader.light_map = &light_map;
+
+    ColorTarget framebuffer(width, height);
+    DepthTarget zbuffer(width, height);
+    draw_shaded(model, shader, viewport_transform(width, height, 255) * perspective * view, framebuffer, zbuffer);
+    write_targets(framebuffer, zbuffer, "render_baked.tga", "render_baked_z.tga");
     return 0;
 }
 
+// a square grid of copies of the model, each turned and tinted its own way, drawn with
+// one draw_instanced; the grid is a little wider than the view, so the edge columns are culled
+int model_render_instances(int argc, char **argv) {
+    if (argc < 2 || argc > 3) {
+        std::cerr << "Usage: " << argv[0] << " obj/model.obj [instances]" << std::endl;
+        return 1;
+    }
+    const int count = argc > 2 ? std::atoi(argv[2]) : 100;
+    if (count < 1) {
+        std::cerr << "instance count must be at least 1" << std::endl;
+        return 1;
+    }
+
+    constexpr int width = 800;
+    constexpr int height = 800;
+
+    Model model(argv[1]);
+    InstancedMesh mesh(model);
+    const int side = std::max(1, static_cast<int>(std::ceil(std::sqrt(count))));
+    std::vector<Instance> instances(count);
+    for (int i = 0; i < count; i++) {
+        float x = -1.8f + 3.6f * (i % side + .5f) / side, y = -1.8f + 3.6f * (i / side + .5f) / side;
+        instances[i].transform = model_transform(Vec3f(x, y, 0), .4f * i, 1.6f / side);
+        instances[i].color = TGAColor(128 + 127 * (i % 3 == 0), 128 + 127 * (i % 3 == 1), 128 + 127 * (i % 3 == 2));
+    }
+
+    auto vpscr = viewport_transform(width, height, 255) * perspective_transform(-1, 1, 1)
+               * view_transform(Vec3f(0, 0, 0), Vec3f(0, 0, 2), Vec3f(0, 1, 0));
+    ColorTarget framebuffer(width, height);
+    DepthTarget zbuffer(width, height);
+    auto start = std::chrono::steady_clock::now();
+    InstanceStats stats = draw_instanced(mesh, instances, vpscr, Vec3f(1, 1, 1), framebuffer, zbuffer);
+    auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+    std::cerr << "# " << stats.drawn << " instances drawn, " << stats.culled << " culled, in " << elapsed.count()
+              << " ms" << std::endl;
+    write_targets(framebuffer, zbuffer, "render_instances.tga", "render_instances_z.tga");
+    return 0;
+}
+
+// a field of copies of the model in a SceneGraph, seen from above one edge; every frame turns
+// each copy a little, so the tree is refit, then culls and draws front to back, skipping the
+// copies hidden behind those in front
+int model_render_scene(int argc, char **argv) {
+    if (argc < 2 || argc > 3) {
+        std::cerr << "Usage: " << argv[0] << " obj/model.obj [objects]" << std::endl;
+        return 1;
+    }
+    const int count = argc > 2 ? std::atoi(argv[2]) : 4096;
+    constexpr int width = 800;
+    constexpr int height = 800;
+    constexpr int frames = 4;
+
+    auto mesh = std::make_shared<const InstancedMesh>(Model(argv[1]));
+    const int side = std::max(1, static_cast<int>(std::ceil(std::sqrt(count))));
+    SceneGraph scene;
+    std::vector<Vec3f> positions;
+    for (int i = 0; i < count; i++) {
+        positions.emplace_back(i % side - side / 2, 0, i / side - side / 2);
+        scene.add(mesh, model_transform(positions.back(), .4f * i, .4f),
+                  TGAColor(128 + 127 * (i % 3 == 0), 128 + 127 * (i % 3 == 1), 128 + 127 * (i % 3 == 2)));
+    }
+
+    const float edge = side / 2.f + 2;
+    auto vpscr = camera_transform(Vec3f(0, 2.5f, -edge), Vec3f(0, 0, 10 - edge), Vec3f(0, 1, 0), width, height,
+                                  1, 2 * edge);
+    ColorTarget framebuffer(width, height);
+    DepthTarget zbuffer(width, height);
+    for (int frame = 0; frame < frames; frame++) {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < count; i++) scene.move(i, model_transform(positions[i], .4f * i + .2f * frame, .4f));
+        framebuffer.clear();
+        zbuffer.clear();
+        SceneStats stats = scene.draw(vpscr, Vec3f(1, 1, 1), framebuffer, zbuffer, true, true);
+        auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+        std::cerr << "# frame " << frame << ": " << stats.objects_drawn << " objects drawn, " << stats.objects_culled
+                  << " culled, " << stats.objects_occluded << " occluded, " << stats.nodes_visited << " nodes tested, in " << elapsed.count() << " ms" << std::endl;
+    }
+    write_targets(framebuffer, zbuffer, "render_scene.tga", "render_scene_z.tga");
+    return 0;
+}
+
+// a turntable in a still scene: the middle copy of a 7 x 7 grid turns a step every frame, and
+// draw_incremental redraws only the bins around it; the last frame is written, and a full
+// redraw of it timed for comparison
+int model_render_incremental(int argc, char **argv) {
+    if (argc < 2 || argc > 3) {
+        std::cerr << "Usage: " << argv[0] << " obj/model.obj [frames]" << std::endl;
+        return 1;
+    }
+    const int frames = argc > 2 ? std::max(1, std::atoi(argv[2])) : 36;
+    constexpr int width = 800;
+    constexpr int height = 800;
+    constexpr int side = 7;
+
+    auto mesh = std::make_shared<const InstancedMesh>(Model(argv[1]));
+    SceneGraph scene;
+    for (int i = 0; i < side * side; i++) {
+        scene.add(mesh, model_transform(Vec3f(i % side - side / 2, 0, i / side - side / 2), .4f * i, .4f),
+                  TGAColor(128 + 127 * (i % 3 == 0), 128 + 127 * (i % 3 == 1), 128 + 127 * (i % 3 == 2)));
+    }
+    const int turntable = side * side / 2;
+    auto vpscr = camera_transform(Vec3f(0, 3, -6), Vec3f(0, 0, 0), Vec3f(0, 1, 0), width, height, 1, 12);
+    ColorTarget framebuffer(width, height);
+    DepthTarget zbuffer(width, height);
+    double total = 0;
+    int bins_drawn = 0, bins = 0;
+    for (int frame = 0; frame < frames; frame++) {
+        auto start = std::chrono::steady_clock::now();
+        scene.move(turntable, model_transform(Vec3f(0, 0, 0), 2 * static_cast<float>(M_PI) * frame / frames, .4f));
+        SceneStats stats = scene.draw_incremental(vpscr, Vec3f(1, 1, 1), framebuffer, zbuffer);
+        auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+        std::cerr << "# frame " << frame << ": " << stats.bins_drawn << " of " << stats.bins << " bins, "
+                  << stats.objects_drawn << " objects redrawn, in " << elapsed.count() << " ms" << std::endl;
+        // the first frame draws everything
+        if (frame == 0) continue;
+        total += elapsed.count();
+        bins_drawn += stats.bins_drawn;
+        bins += stats.bins;
+    }
+    if (frames > 1) {
+        std::cerr << "# incremental: " << 100. * bins_drawn / bins << "% of bins redrawn, "
+                  << total / (frames - 1) << " ms per frame" << std::endl;
+    }
+    write_targets(framebuffer, zbuffer, "render_incremental.tga", "render_incremental_z.tga");
+
+    auto start = std::chrono::steady_clock::now();
+    framebuffer.clear();
+    zbuffer.clear();
+    scene.draw(vpscr, Vec3f(1, 1, 1), framebuffer, zbuffer);
+    auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+    std::cerr << "# full redraw: " << elapsed.count() << " ms" << std::endl;
+    return 0;
+}
+
+// renders the model from a camera circling it; the output is a "frame_%04d.tga" pattern,
+// "-" to stream Y4M to stdout, or "|command" to pipe Y4M into an encoder
+int model_render_turntable(int argc, char **argv) {
+    if (argc < 2 || argc > 4) {
+        std::cerr << "Usage: " << argv[0] << " obj/model.obj [frames] [output]" << std::endl;
+        return 1;
+    }
+    const int frames = argc > 2 ? std::atoi(argv[2]) : 36;
+    const std::string output = argc > 3 ? argv[3] : "turntable_%04d.tga";
+    const bool streamed = output == "-" || output[0] == '|';
+
+    constexpr int width = 800;
+    constexpr int height = 800;
+
+    auto handle = load_model_async(argv[1], Model::DIFFUSE_MAP | Model::NORMAL_MAP);
+    auto perspective = perspective_transform(-1, 1, 1);
+    FrameSink sink(streamed ? FrameSink::Y4M_STREAM : FrameSink::TGA_SEQUENCE, output, width, height);
+    if (!sink.ok()) return 1;
+
+    // the whole turntable is one command buffer, so the executor overlaps vertex work,
+    // rasterization and writing of consecutive frames
+    CommandBuffer commands;
+    commands.bind_model(handle);
+    commands.set_shader(PHONG_SHADER);
+    for (int frame = 0; frame < frames; frame++) {
+        float angle = 2.f * static_cast<float>(M_PI) * frame / frames;
+        Vec3f camPos = Vec3f(std::sin(angle), 0.3f, std::cos(angle));
+        commands.begin_frame(width, height);
+        commands.set_uniforms({view_transform(Vec3f(0, 0, 0), camPos, Vec3f(0, 1, 0)), perspective, camPos, Vec3f(1, 1, 0)});
+        commands.draw();
+        commands.present([&sink](TGAImage& image) {
+            if (!sink.submit_swap(image)) std::cerr << "frame of the wrong size not written" << std::endl;
+        });
+    }
+    FrameExecutor executor;
+    try {
+        executor.submit(std::move(commands)).wait();
+    } catch (std::exception const &e) {
+        std::cerr << "turntable stopped: " << e.what() << std::endl;
+        sink.close();
+        return 1;
+    }
+    return sink.close() ? 0 : 1;
+}
+
+// renders every job of a manifest (see parse_job in batch.h), loading each model once
+int render_batch(int argc, char **argv) {
+    if (argc != 2) {
+        std::cerr << "Usage: " << argv[0] << " jobs.txt" << std::endl;
+        return 1;
+    }
+    std::vector<RenderJob> jobs;
+    std::string error;
+    if (!read_manifest(argv[1], jobs, error)) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+
+    ModelCache cache;
+    auto start = std::chrono::steady_clock::now();
+    auto results = run_batch(jobs, cache);
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int failed = 0;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        std::cerr << "# " << jobs[i].output << ": waited " << results[i].wait_ms << " ms, rendered in "
+                  << results[i].render_ms << " ms" << (results[i].ok ? "" : ", write failed") << std::endl;
+        failed += !results[i].ok;
+    }
+    std::cerr << "# " << jobs.size() << " images of " << cache.size() << " models in " << elapsed << " s, "
+              << jobs.size() / elapsed << " images/s" << std::endl;
+    return failed ? 1 : 0;
+}
+
+// keeps rendering requests (see RenderServer) from a Unix domain socket, or from stdin
+// with replies on stdout when the path is "-"
+int serve_renders(int argc, char **argv) {
+    if (argc < 2 || argc > 3) {
+        std::cerr << "Usage: " << argv[0] << " socket|- [queue capacity]" << std::endl;
+        return 1;
+    }
+    const int capacity = argc > 2 ? std::atoi(argv[2]) : 64;
+    if (capacity < 1) {
+        std::cerr << "queue capacity must be at least 1" << std::endl;
+        return 1;
+    }
+    // a client that goes away must not take the server with it
+    std::signal(SIGPIPE, SIG_IGN);
+    RenderServer server(capacity);
+    bool ok = true;
+    if (std::string(argv[1]) == "-") {
+        server.serve(STDIN_FILENO, STDOUT_FILENO);
+    } else {
+        ok = server.listen(argv[1]);
+    }
+    server.print_stats(std::cerr);
+    return ok ? 0 : 1;
+}
+
 int grayscale_barycentric_triangle(int argc, char** argv) {
     constexpr int width  = 64;
     constexpr int height = 64;
@@ -250,5 +754,38 @@ int basic_render(int argc, char** argv) {
 }
 
 int main(int argc, char **argv) {
+    if (argc > 1 && std::string(argv[1]) == "--batch") {
+        return render_batch(argc - 1, argv + 1);
+    }
+    if (argc > 1 && std::string(argv[1]) == "--serve") {
+        return serve_renders(argc - 1, argv + 1);
+    }
+    if (argc > 1 && std::string(argv[1]) == "--turntable") {
+        return model_render_turntable(argc - 1, argv + 1);
+    }
+    if (argc > 1 && std::string(argv[1]) == "--shadows") {
+        return model_render_shadowed(argc - 1, argv + 1);
+    }
+    if (argc > 1 && std::string(argv[1]) == "--bake") {
+        return model_render_baked(argc - 1, argv + 1);
+    }
+    if (argc > 1 && std::string(argv[1]) == "--instances") {
+        return model_render_instances(argc - 1, argv + 1);
+    }
+    if (argc > 1 && std::string(argv[1]) == "--scene") {
+        return model_render_scene(argc - 1, argv + 1);
+    }
+    if (argc > 1 && std::string(argv[1]) == "--incremental") {
+        return model_render_incremental(argc - 1, argv + 1);
+    }
+    if (argc > 1 && std::string(argv[1]) == "--progressive") {
+        return model_render_progressive(argc - 1, argv + 1);
+    }
+    if (argc > 1 && std::string(argv[1]) == "--rates") {
+        return model_render_rates(argc - 1, argv + 1);
+    }
+    if (argc > 1 && std::string(argv[1]) == "--lights") {
+        return model_render_lights(argc - 1, argv + 1);
+    }
     return model_render_perspective_textured(argc, argv);
 }
\ No newline at end of file
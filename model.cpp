@@ -2,8 +2,10 @@
 #include <fstream>
 #include <sstream>
 #include "model.h"
+#include "profiler.h"
 
 Model::Model(const char *filename) {
+    PROFILE_SCOPE("parse obj");
     std::ifstream in;
     in.open (filename, std::ifstream::in);
     if (in.fail()) return;
@@ -39,21 +41,25 @@ Model::Model(const char *filename) {
         }
     }
     std::cerr << "# v# " << vertices.size() << " f# "  << faces.size() << " vt# " << uv.size() << " vn# " << normals.size() << std::endl;
-    load_texture(filename, "_diffuse.tga", diffusemap);
-    load_texture(filename, "_nm.tga",      normalmap);
-    load_texture(filename, "_spec.tga",    specularmap);
+    diffusemap.path  = texture_path(filename, DIFFUSE_MAP);
+    normalmap.path   = texture_path(filename, NORMAL_MAP);
+    specularmap.path = texture_path(filename, SPECULAR_MAP);
 }
 
 Model::~Model() = default;
 
-void Model::load_texture(const std::string &filename, const char *suffix, TGAImage &img) {
-    std::string texfile(filename);
-    size_t dot = texfile.find_last_of(".");
-    if (dot!=std::string::npos) {
-        texfile = texfile.substr(0,dot) + std::string(suffix);
-        std::cerr << "texture file " << texfile << " loading " << (img.read_tga_file(texfile.c_str()) ? "ok" : "failed") << std::endl;
-        img.flip_vertically();
-    }
+std::string Model::texture_path(const std::string &filename, TextureMap map) {
+    size_t dot = filename.find_last_of(".");
+    if (dot==std::string::npos) return {};
+    const char *suffix = map==DIFFUSE_MAP ? "_diffuse.tga" : map==NORMAL_MAP ? "_nm.tga" : "_spec.tga";
+    return filename.substr(0,dot) + std::string(suffix);
+}
+
+const TGAImage *Model::TextureSlot::get() const {
+    std::call_once(once, [this] {
+        if (!path.empty()) image = TexturePool::instance().acquire(path);
+    });
+    return image.get();
 }
 
 size_t Model::number_of_vertices() const {
@@ -79,13 +85,19 @@ Vec3f Model::vertex_at(size_t iface, size_t nth_vertex) const {
 }
 
 TGAColor Model::diffuse_at(const Vec2f &uvf) const {
-    Vec2i uv(uvf.x * diffusemap.get_width(), uvf.y * diffusemap.get_height());
-    return diffusemap.get(uv.x, uv.y);
+    const TGAImage *diffuse = diffusemap.get();
+    if (!diffuse) return {};
+    Vec2i uv(uvf.x * diffuse->get_width(), uvf.y * diffuse->get_height());
+    return diffuse->get(uv.x, uv.y);
 }
 
 Vec3f Model::normal_at(const Vec2f &uvf) const {
-    Vec2i uv(uvf.x *normalmap.get_width(), uvf.y * normalmap.get_height());
-    TGAColor c = normalmap.get(uv.x, uv.y);
+    const TGAImage *normals = normalmap.get();
+    TGAColor c;
+    if (normals) {
+        Vec2i uv(uvf.x * normals->get_width(), uvf.y * normals->get_height());
+        c = normals->get(uv.x, uv.y);
+    }
     Vec3f res;
     for (int i=0; i<3; i++)
         res[2-i] = static_cast<float>(c.raw[i])/255.f*2.f - 1.f;
@@ -97,8 +109,10 @@ Vec2f Model::uv_at(size_t iface, size_t nth_vertex) const {
 }
 
 float Model::specular_at(const Vec2f &uvf) const {
-    Vec2i uv(static_cast<int>(uvf.x) * specularmap.get_width(), static_cast<int>(uvf.y) * specularmap.get_height());
-    return specularmap.get(uv.x, uv.y).raw[0];
+    const TGAImage *specular = specularmap.get();
+    if (!specular) return 0;
+    Vec2i uv(static_cast<int>(uvf.x) * specular->get_width(), static_cast<int>(uvf.y) * specular->get_height());
+    return specular->get(uv.x, uv.y).raw[0];
 }
 
 Vec3f Model::normal_at(size_t iface, size_t nth_vertex) const {
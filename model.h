@@ -1,9 +1,11 @@
 #ifndef MILKY_TINYRENDERER_MODEL_H
 #define MILKY_TINYRENDERER_MODEL_H
+#include <mutex>
 #include <vector>
 #include <string>
 #include "vec.h"
 #include "tgaimage.h"
+#include "texture_pool.h"
 
 class Model {
     std::vector<Vec3f> vertices;
@@ -18,13 +20,24 @@ class Model {
     std::vector<std::vector<Id>> faces;
     std::vector<Vec3f> normals;
     std::vector<Vec2f> uv;
-    TGAImage diffusemap;
-    TGAImage normalmap;
-    TGAImage specularmap;
-    void load_texture(const std::string &filename, const char *suffix, TGAImage &img);
+    // textures are fetched from the shared pool the first time a shader samples them
+    struct TextureSlot {
+        std::string path;
+        mutable std::once_flag once;
+        mutable TexturePtr image;
+        [[nodiscard]] const TGAImage *get() const;
+    };
+    TextureSlot diffusemap;
+    TextureSlot normalmap;
+    TextureSlot specularmap;
 public:
+    enum TextureMap {
+        DIFFUSE_MAP = 1, NORMAL_MAP = 2, SPECULAR_MAP = 4, ALL_MAPS = 7
+    };
+
     explicit Model(const char *filename);
     ~Model();
+    [[nodiscard]] static std::string texture_path(const std::string &filename, TextureMap map);
     [[nodiscard]] size_t number_of_vertices() const;
     [[nodiscard]] size_t number_of_faces() const;
     [[nodiscard]] Vec3f normal_at(size_t iface, size_t nth_vertex) const;
@@ -0,0 +1,312 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <array>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "gl.h"
+#include "model.h"
+#include "profiler.h"
+#include "render_target.h"
+#include "scheduler.h"
+#include "utils.h"
+#include "vec.h"
+
+// How a face loop spreads over the Scheduler threads.
+// BINNED runs it in stages, each one a set of tasks: the vertex stage sets up every face,
+// binning sorts the screen triangles into BIN x BIN pixel bins, and each bin is rasterized
+// by one task that draws its faces in submission order.
+// PER_TRIANGLE sets up and draws face after face and splits large triangles by tile rows.
+// SORT_LAST gives every thread a contiguous range of faces and its own targets and
+// composites them by depth at the end.
+// All three give the result of a serial loop. BINNED is the default, MILKY_PARALLEL set to
+// per-triangle or sort-last selects the others
+enum ParallelMode { BINNED, PER_TRIANGLE, SORT_LAST };
+
+inline ParallelMode parallel_mode() {
+    static const ParallelMode mode = [] {
+        const char* env = std::getenv("MILKY_PARALLEL");
+        std::string name = env ? env : "";
+        if (name == "per-triangle") return PER_TRIANGLE;
+        if (name == "sort-last") return SORT_LAST;
+        return BINNED;
+    }();
+    return mode;
+}
+
+// a face in screen space: x and y in pixels, z as 8-bit depth
+using ScreenTriangle = std::array<Vec3i, 3>;
+
+// bin edge in pixels; four tile rows, so the rasterizer keeps a bin on one thread
+constexpr int BIN = 4 * RENDER_TILE;
+// faces binned by one task
+constexpr int BIN_CHUNK = 1024;
+
+// The vertex and binning stages' output for one draw, consumed by raster_bins
+struct BinnedFaces {
+    ScreenRect screen{};
+    int bins_x = 0;
+    int bins_y = 0;
+    std::vector<ScreenTriangle> triangles;
+    // face lists per chunk of BIN_CHUNK faces, then per bin
+    std::vector<std::vector<std::vector<int>>> bins;
+};
+
+// The pixels the rasterizer may touch for a face, x in [x0, x1) and y in [y0, y1), within
+// screen. Empty when the face lies off screen.
+inline ScreenRect face_bounds(ScreenTriangle const& t, ScreenRect const& screen) {
+    return {std::max(screen.x0, std::min(t[0].x, std::min(t[1].x, t[2].x))),
+            std::max(screen.y0, std::min(t[0].y, std::min(t[1].y, t[2].y))),
+            std::min(screen.x1, std::max(t[0].x, std::max(t[1].x, t[2].x)) + 1),
+            std::min(screen.y1, std::max(t[0].y, std::max(t[1].y, t[2].y)))};
+}
+
+inline bool on_screen(ScreenTriangle const& t, ScreenRect const& screen) {
+    ScreenRect bounds = face_bounds(t, screen);
+    return bounds.x0 < bounds.x1 && bounds.y0 < bounds.y1;
+}
+
+// vertex stage and binning: setup(face, ScreenTriangle&) as for draw_faces; with a mask of
+// bins_x * bins_y flags, faces only go to the bins set in it
+template <typename Setup>
+void bin_faces(int faces, ScreenRect const& screen, Setup const& setup, BinnedFaces& out,
+               std::vector<uint8_t> const* mask = nullptr) {
+    Scheduler& scheduler = Scheduler::instance();
+    out.screen = screen;
+    out.triangles.resize(faces);
+    PROFILE_COUNT(TRIANGLES_SUBMITTED, faces);
+    scheduler.parallel_for(0, faces, 256, [&](int first, int last) {
+        PROFILE_SCOPE("vertex");
+        for (int face = first; face < last; face++) {
+            setup(face, out.triangles[face]);
+        }
+    });
+
+    // every chunk of faces fills lists of its own, so the bins keep submission order without locks
+    out.bins_x = (screen.x1 + BIN - 1) / BIN;
+    out.bins_y = (screen.y1 + BIN - 1) / BIN;
+    const int chunks = (faces + BIN_CHUNK - 1) / BIN_CHUNK;
+    out.bins.assign(chunks, std::vector<std::vector<int>>(out.bins_x * out.bins_y));
+    scheduler.parallel_for(0, chunks, 1, [&](int first, int last) {
+        PROFILE_SCOPE("binning");
+        for (int chunk = first; chunk < last; chunk++) {
+            int end = std::min(faces, (chunk + 1) * BIN_CHUNK);
+            for (int face = chunk * BIN_CHUNK; face < end; face++) {
+                ScreenRect bounds = face_bounds(out.triangles[face], screen);
+                if (bounds.x0 >= bounds.x1 || bounds.y0 >= bounds.y1) {
+                    PROFILE_COUNT(TRIANGLES_CULLED, 1);
+                    continue;
+                }
+                PROFILE_COUNT(TRIANGLES_RASTERIZED, 1);
+                for (int by = bounds.y0 / BIN; by <= (bounds.y1 - 1) / BIN; by++) {
+                    for (int bx = bounds.x0 / BIN; bx <= (bounds.x1 - 1) / BIN; bx++) {
+                        if (mask && !(*mask)[by * out.bins_x + bx]) continue;
+                        out.bins[chunk][by * out.bins_x + bx].push_back(face);
+                    }
+                }
+            }
+        }
+    });
+}
+
+// draws the faces of one bin in submission order, raster(face, ScreenTriangle const&,
+// ScreenRect const& clip) clipped to the bin
+template <typename Raster>
+void raster_bin(BinnedFaces const& binned, int bin, Raster const& raster) {
+    PROFILE_SCOPE("raster bin");
+    const ScreenRect& screen = binned.screen;
+    int x0 = bin % binned.bins_x * BIN, y0 = bin / binned.bins_x * BIN;
+    ScreenRect clip{x0, y0, std::min(screen.x1, x0 + BIN), std::min(screen.y1, y0 + BIN)};
+    for (auto const& chunk : binned.bins) {
+        for (int face : chunk[bin]) {
+            raster(face, binned.triangles[face], clip);
+        }
+    }
+}
+
+// raster stage: one task per bin, each a raster_bin
+template <typename Raster>
+void raster_bins(BinnedFaces const& binned, Raster const& raster) {
+    Scheduler::instance().parallel_for(0, binned.bins_x * binned.bins_y, 1, [&](int first, int last) {
+        for (int bin = first; bin < last; bin++) raster_bin(binned, bin, raster);
+    });
+}
+
+// Draws faces [0, faces) into the targets.
+// setup(face, ScreenTriangle&) is the vertex stage of one face. It can run on any thread
+// and in any order, so it may only keep per-face state in slots of its own face.
+// raster(face, ScreenTriangle const&, ScreenRect const& clip, ColorTarget&, DepthTarget&)
+// draws the face, clipped to clip, into the targets it is given.
+template <typename Setup, typename Raster>
+void draw_faces(int faces, ColorTarget& framebuffer, DepthTarget& zbuffer, Setup const& setup, Raster const& raster) {
+    Scheduler& scheduler = Scheduler::instance();
+    const ScreenRect screen = framebuffer.bounds();
+    const ParallelMode mode = scheduler.threads() == 1 && parallel_mode() == SORT_LAST ? PER_TRIANGLE : parallel_mode();
+
+    if (mode == PER_TRIANGLE) {
+        PROFILE_SCOPE("draw faces");
+        PROFILE_COUNT(TRIANGLES_SUBMITTED, faces);
+        ScreenTriangle triangle;
+        for (int face = 0; face < faces; face++) {
+            setup(face, triangle);
+            PROFILE_COUNT(TRIANGLES_CULLED, !on_screen(triangle, screen));
+            PROFILE_COUNT(TRIANGLES_RASTERIZED, on_screen(triangle, screen));
+            raster(face, triangle, screen, framebuffer, zbuffer);
+        }
+        return;
+    }
+
+    if (mode == SORT_LAST) {
+        const int workers = std::max(1, std::min(scheduler.threads(), faces));
+        // the first range goes straight into the given targets, which may hold earlier draws
+        std::vector<ColorTarget> colors;
+        std::vector<DepthTarget> depths;
+        for (int k = 1; k < workers; k++) {
+            colors.emplace_back(framebuffer.get_width(), framebuffer.get_height());
+            depths.emplace_back(zbuffer.get_width(), zbuffer.get_height());
+        }
+        PROFILE_COUNT(TRIANGLES_SUBMITTED, faces);
+        scheduler.parallel_for(0, workers, 1, [&](int first, int last) {
+            // each worker already has a thread's share of the faces and targets of its own
+            SerialTiles serial;
+            for (int k = first; k < last; k++) {
+                PROFILE_SCOPE("draw range");
+                ColorTarget& color = k == 0 ? framebuffer : colors[k - 1];
+                DepthTarget& depth = k == 0 ? zbuffer : depths[k - 1];
+                ScreenTriangle triangle;
+                int end = static_cast<int>(static_cast<long>(faces) * (k + 1) / workers);
+                for (int face = static_cast<int>(static_cast<long>(faces) * k / workers); face < end; face++) {
+                    setup(face, triangle);
+                    PROFILE_COUNT(TRIANGLES_CULLED, !on_screen(triangle, screen));
+                    PROFILE_COUNT(TRIANGLES_RASTERIZED, on_screen(triangle, screen));
+                    raster(face, triangle, screen, color, depth);
+                }
+            }
+        });
+        PROFILE_SCOPE("composite");
+        for (int k = 1; k < workers; k++) {
+            composite(framebuffer, zbuffer, colors[k - 1], depths[k - 1]);
+        }
+        return;
+    }
+
+    BinnedFaces binned;
+    bin_faces(faces, screen, setup, binned);
+    raster_bins(binned, [&](int face, ScreenTriangle const& triangle, ScreenRect const& clip) {
+        raster(face, triangle, clip, framebuffer, zbuffer);
+    });
+}
+
+// MILKY_ZPREPASS=1 makes draw_shaded lay down depth before shading
+inline bool z_prepass() {
+    static const bool enabled = [] {
+        const char* env = std::getenv("MILKY_ZPREPASS");
+        return env && std::string(env) == "1";
+    }();
+    return enabled;
+}
+
+// Draws every face of the model with the shader; mvpscr takes model space to the screen.
+// With prepass the faces are binned once, a depth-only pass fills zbuffer and the shading
+// pass runs the fragment shader only where a face is the visible one. That shades every
+// pixel once instead of once per overdraw, at the cost of a second raster walk; pixels where
+// faces tie in depth may pick a different one than the plain path does.
+inline void draw_shaded(Model const& model, Shader const& shader, Mat4x4f const& mvpscr, ColorTarget& framebuffer,
+                        DepthTarget& zbuffer, bool prepass = z_prepass()) {
+    Varyings varyings(model.number_of_faces(), shader.varyings());
+    auto setup = [&](int face_id, ScreenTriangle& coords) {
+        VertexData vd = varyings.reset(face_id);
+        for (int j = 0; j < 3; j++) {
+            auto manu_coord = shader.eval_vertex(model, face_id, j, vd);
+            auto [x, y, z] = transform(manu_coord, mvpscr).view();
+            coords[j] = Vec3i(x, y, z);
+        }
+    };
+    if (!prepass) {
+        draw_faces(model.number_of_faces(), framebuffer, zbuffer, setup,
+                   [&](int face_id, ScreenTriangle const& coords, ScreenRect const& clip, ColorTarget& framebuffer, DepthTarget& zbuffer) {
+            shading_triangle(coords[0].x, coords[0].y, coords[0].z,
+                            coords[1].x, coords[1].y, coords[1].z,
+                            coords[2].x, coords[2].y, coords[2].z,
+                            model, framebuffer, zbuffer, clip, shader, varyings[face_id]);
+        });
+        return;
+    }
+
+    BinnedFaces binned;
+    bin_faces(model.number_of_faces(), framebuffer.bounds(), setup, binned);
+    {
+        PROFILE_SCOPE("z prepass");
+        raster_bins(binned, [&](int, ScreenTriangle const& coords, ScreenRect const& clip) {
+            depth_triangle(coords[0].x, coords[0].y, coords[0].z,
+                           coords[1].x, coords[1].y, coords[1].z,
+                           coords[2].x, coords[2].y, coords[2].z, zbuffer, clip);
+        });
+    }
+    raster_bins(binned, [&](int face_id, ScreenTriangle const& coords, ScreenRect const& clip) {
+        shading_triangle_equal(coords[0].x, coords[0].y, coords[0].z,
+                               coords[1].x, coords[1].y, coords[1].z,
+                               coords[2].x, coords[2].y, coords[2].z,
+                               model, framebuffer, zbuffer, clip, shader, varyings[face_id]);
+    });
+}
+
+// draw_shaded at the shading rates of rates, see shading_triangle_rates; returns the fragment
+// shader runs. normals, when given, receives the interpolated vertex normal of every pixel
+// drawn, mapped to [0, 255] per channel, for ShadingRates::from_pass on the next frame; under
+// MILKY_PARALLEL=sort-last it may hold a hidden face's normal where faces overlap. Rates for
+// another tile grid than the framebuffer's draw nothing and return 0.
+inline uint64_t draw_shaded_rates(Model const& model, Shader const& shader, Mat4x4f const& mvpscr,
+                                  ColorTarget& framebuffer, DepthTarget& zbuffer, ShadingRates const& rates,
+                                  ColorTarget* normals = nullptr) {
+    if (!rates.fits(framebuffer) || !rates.fits(zbuffer) || (normals && !rates.fits(*normals))) {
+        std::cerr << "shading rates for " << rates.get_tiles_x() << "x" << rates.get_tiles_y()
+                  << " tiles don't fit the " << framebuffer.get_tiles_x() << "x" << framebuffer.get_tiles_y()
+                  << " tiles of the target" << std::endl;
+        return 0;
+    }
+    std::atomic<uint64_t> invocations{0};
+    Varyings varyings(model.number_of_faces(), shader.varyings());
+    draw_faces(model.number_of_faces(), framebuffer, zbuffer, [&](int face_id, ScreenTriangle& coords) {
+        VertexData vd = varyings.reset(face_id);
+        for (int j = 0; j < 3; j++) {
+            auto [x, y, z] = transform(shader.eval_vertex(model, face_id, j, vd), mvpscr).view();
+            coords[j] = Vec3i(x, y, z);
+        }
+    }, [&](int face_id, ScreenTriangle const& coords, ScreenRect const& clip, ColorTarget& framebuffer, DepthTarget& zbuffer) {
+        const Vec3f n[3] = {model.normal_at(face_id, 0), model.normal_at(face_id, 1), model.normal_at(face_id, 2)};
+        shading_triangle_rates(coords[0].x, coords[0].y, coords[0].z,
+                               coords[1].x, coords[1].y, coords[1].z,
+                               coords[2].x, coords[2].y, coords[2].z,
+                               model, framebuffer, zbuffer, clip, shader, varyings[face_id], rates,
+                               [&](size_t index, Vec3d const& abg) {
+            if (!normals) return;
+            Vec3f normal = (n[0] * abg.x + n[1] * abg.y + n[2] * abg.z).normalized();
+            normals->data()[index] = pack_color(TGAColor(127.5f * (normal.x + 1), 127.5f * (normal.y + 1),
+                                                         127.5f * (normal.z + 1)));
+        }, &invocations);
+    });
+    return invocations;
+}
+
+// Renders the depth of every face of the model alone, e.g. a shadow map from the
+// light_space_transform of a light; no shader runs.
+inline void draw_depth(Model const& model, Mat4x4f const& mvpscr, DepthTarget& zbuffer) {
+    BinnedFaces binned;
+    bin_faces(model.number_of_faces(), zbuffer.bounds(), [&](int face_id, ScreenTriangle& coords) {
+        for (int j = 0; j < 3; j++) {
+            auto [x, y, z] = transform(model.vertex_at(face_id, j), mvpscr).view();
+            coords[j] = Vec3i(x, y, z);
+        }
+    }, binned);
+    PROFILE_SCOPE("depth pass");
+    raster_bins(binned, [&](int, ScreenTriangle const& coords, ScreenRect const& clip) {
+        depth_triangle(coords[0].x, coords[0].y, coords[0].z,
+                       coords[1].x, coords[1].y, coords[1].z,
+                       coords[2].x, coords[2].y, coords[2].z, zbuffer, clip);
+    });
+}
+
+#endif //PIPELINE_H
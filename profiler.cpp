@@ -0,0 +1,159 @@
+#ifdef MILKY_PROFILE
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include "image_codec.h"
+#include "profiler.h"
+#include "render_target.h"
+#include "scheduler.h"
+#include "tgaimage.h"
+
+// the report at exit writes images, which uses the scheduler, so that has to be constructed
+// first to be destroyed after the profiler
+Profiler::Profiler() {
+    Scheduler::instance();
+}
+
+Profiler &Profiler::instance() {
+    static Profiler profiler;
+    return profiler;
+}
+
+Profiler::ThreadLog &Profiler::thread_log() {
+    thread_local ThreadLog *log = [] {
+        Profiler &profiler = instance();
+        std::lock_guard lock(profiler.mutex);
+        profiler.threads.push_back(std::make_unique<ThreadLog>());
+        profiler.threads.back()->id = static_cast<int>(profiler.threads.size());
+        return profiler.threads.back().get();
+    }();
+    return *log;
+}
+
+void Profiler::record(const char *name, clock::time_point start, clock::time_point end) {
+    thread_log().events.push_back({name, start, end});
+}
+
+void Profiler::overdraw(size_t index, int width, int height) {
+    Profiler &profiler = instance();
+    if (!profiler.heatmap_ready.load(std::memory_order_acquire)) {
+        std::lock_guard lock(profiler.mutex);
+        if (!profiler.heatmap_ready.load(std::memory_order_relaxed)) {
+            int tiles_x = (width + RENDER_TILE - 1) / RENDER_TILE, tiles_y = (height + RENDER_TILE - 1) / RENDER_TILE;
+            profiler.heatmap = std::make_unique<std::atomic<uint32_t>[]>(size_t(tiles_x) * tiles_y * RENDER_TILE * RENDER_TILE);
+            profiler.heatmap_width = width;
+            profiler.heatmap_height = height;
+            profiler.heatmap_ready.store(true, std::memory_order_release);
+        }
+    }
+    if (width == profiler.heatmap_width && height == profiler.heatmap_height) {
+        profiler.heatmap[index].fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+Profiler::~Profiler() {
+    const char *trace = std::getenv("MILKY_TRACE");
+    write_trace(trace ? trace : "milky_trace.json");
+    write_summary();
+    if (heatmap_ready) write_heatmap("milky_overdraw.tga");
+}
+
+static double since(Profiler::clock::time_point origin, Profiler::clock::time_point t) {
+    return std::chrono::duration<double, std::micro>(t - origin).count();
+}
+
+void Profiler::write_trace(const char *filename) const {
+    FILE *out = std::fopen(filename, "w");
+    if (!out) {
+        std::fprintf(stderr, "can't write %s\n", filename);
+        return;
+    }
+    std::fprintf(out, "{\"traceEvents\": [\n");
+    bool first = true;
+    for (auto const &thread : threads) {
+        std::fprintf(out, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"thread %d\"}}",
+                     first ? "" : ",\n", thread->id, thread->id);
+        first = false;
+        for (auto const &event : thread->events) {
+            std::fprintf(out, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                         event.name, thread->id, since(started, event.start), since(event.start, event.end));
+        }
+    }
+    std::fprintf(out, "\n]}\n");
+    std::fclose(out);
+}
+
+void Profiler::write_summary() const {
+    static const char *const names[COUNTERS] = {"triangles submitted", "triangles culled", "triangles rasterized",
+                                                 "pixels tested", "depth rejects", "fragments shaded"};
+    struct Stage {
+        double total_ms = 0, max_ms = 0;
+        size_t calls = 0;
+    };
+    std::map<std::string, Stage> stages;
+    uint64_t counters[COUNTERS] = {};
+    for (auto const &thread : threads) {
+        for (auto const &event : thread->events) {
+            double ms = std::chrono::duration<double, std::milli>(event.end - event.start).count();
+            Stage &stage = stages[event.name];
+            stage.total_ms += ms;
+            stage.max_ms = std::max(stage.max_ms, ms);
+            stage.calls++;
+        }
+        for (int c = 0; c < COUNTERS; c++) counters[c] += thread->counters[c].load();
+    }
+
+    std::fprintf(stderr, "# %-24s %10s %8s %10s %10s\n", "stage", "total ms", "calls", "mean ms", "max ms");
+    for (auto const &[name, stage] : stages) {
+        std::fprintf(stderr, "# %-24s %10.3f %8zu %10.4f %10.3f\n", name.c_str(), stage.total_ms, stage.calls,
+                     stage.total_ms / stage.calls, stage.max_ms);
+    }
+    for (int c = 0; c < COUNTERS; c++) {
+        std::fprintf(stderr, "# %-24s %12llu\n", names[c], static_cast<unsigned long long>(counters[c]));
+    }
+    if (heatmap_ready) {
+        uint64_t written = 0, covered = 0;
+        uint32_t deepest = 0;
+        for (int y = 0; y < heatmap_height; y++) {
+            for (int x = 0; x < heatmap_width; x++) {
+                uint32_t n = heatmap[tile_index(x, y, (heatmap_width + RENDER_TILE - 1) / RENDER_TILE)].load();
+                written += n;
+                covered += n > 0;
+                deepest = std::max(deepest, n);
+            }
+        }
+        std::fprintf(stderr, "# overdraw %dx%d: %.2f writes per covered pixel, at most %u\n", heatmap_width,
+                     heatmap_height, covered ? double(written) / covered : 0., deepest);
+    }
+}
+
+// black where nothing was written, then blue through red up to the most overdrawn pixel
+void Profiler::write_heatmap(const char *filename) const {
+    const int tiles_x = (heatmap_width + RENDER_TILE - 1) / RENDER_TILE;
+    uint32_t deepest = 1;
+    for (int y = 0; y < heatmap_height; y++) {
+        for (int x = 0; x < heatmap_width; x++) deepest = std::max(deepest, heatmap[tile_index(x, y, tiles_x)].load());
+    }
+    TGAImage image(heatmap_width, heatmap_height, TGAImage::RGB);
+    for (int y = 0; y < heatmap_height; y++) {
+        for (int x = 0; x < heatmap_width; x++) {
+            uint32_t n = heatmap[tile_index(x, y, tiles_x)].load();
+            if (!n) continue;
+            auto t = static_cast<unsigned char>(255 * (n - 1) / std::max(1u, deepest - 1));
+            image.set(x, y, TGAColor(t, 64, 255 - t, 255));
+        }
+    }
+    image.flip_vertically();
+    // encoded by hand, since write_tga_file would record a scope into the dying profiler
+    std::vector<unsigned char> contents;
+    TgaEncoder().encode(image, contents);
+    if (FILE *out = std::fopen(filename, "wb")) {
+        std::fwrite(contents.data(), 1, contents.size(), out);
+        std::fclose(out);
+    }
+}
+
+#endif //MILKY_PROFILE
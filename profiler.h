@@ -0,0 +1,97 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+// Pipeline instrumentation, compiled in only with -DMILKY_PROFILE; otherwise every PROFILE_
+// macro expands to nothing and its arguments are not evaluated.
+//   PROFILE_SCOPE("stage")           times the enclosing scope on the calling thread
+//   PROFILE_COUNT(COUNTER, n)        adds n to one of the Profiler::Counter values
+//   PROFILE_OVERDRAW(target, index)  counts a write to the texel at index of a render target
+// At exit the timings go to a Chrome trace (chrome://tracing, Perfetto) named by
+// MILKY_TRACE or milky_trace.json, a per-stage summary and the counters to stderr, and the
+// overdraw of the first target size written to to milky_overdraw.tga.
+#ifdef MILKY_PROFILE
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class Profiler {
+public:
+    enum Counter {
+        TRIANGLES_SUBMITTED,  // faces handed to draw_faces
+        TRIANGLES_CULLED,     // of those, the ones lying off screen
+        TRIANGLES_RASTERIZED, // the others
+        PIXELS_TESTED,        // coverage tests in tiles the rasterizer did not skip
+        DEPTH_REJECTS,        // covered pixels failing the depth test
+        FRAGMENTS_SHADED,     // color_picker or eval_fragment calls
+        COUNTERS
+    };
+
+    using clock = std::chrono::steady_clock;
+
+    static void count(Counter counter, uint64_t n) {
+        auto &value = thread_log().counters[counter];
+        // only the owning thread writes, so no read-modify-write is needed
+        value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    static void record(const char *name, clock::time_point start, clock::time_point end);
+    static void overdraw(size_t index, int width, int height);
+
+    ~Profiler();
+
+private:
+    struct Event {
+        const char *name;
+        clock::time_point start, end;
+    };
+    struct ThreadLog {
+        int id;
+        std::vector<Event> events;
+        std::array<std::atomic<uint64_t>, COUNTERS> counters{};
+    };
+
+    clock::time_point started = clock::now();
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadLog>> threads;
+    std::atomic<bool> heatmap_ready{false};
+    int heatmap_width = 0, heatmap_height = 0;
+    std::unique_ptr<std::atomic<uint32_t>[]> heatmap;
+
+    Profiler();
+    static Profiler &instance();
+    static ThreadLog &thread_log();
+    void write_trace(const char *filename) const;
+    void write_summary() const;
+    void write_heatmap(const char *filename) const;
+};
+
+class ProfileScope {
+    const char *name;
+    Profiler::clock::time_point start;
+
+public:
+    explicit ProfileScope(const char *name) : name(name), start(Profiler::clock::now()) {}
+    ProfileScope(const ProfileScope &) = delete;
+    ProfileScope &operator=(const ProfileScope &) = delete;
+    ~ProfileScope() { Profiler::record(name, start, Profiler::clock::now()); }
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+#define PROFILE_COUNT(counter, n) Profiler::count(Profiler::counter, (n))
+#define PROFILE_OVERDRAW(target, index) Profiler::overdraw((index), (target).get_width(), (target).get_height())
+
+#else
+
+#define PROFILE_SCOPE(name) ((void)0)
+#define PROFILE_COUNT(counter, n) ((void)0)
+#define PROFILE_OVERDRAW(target, index) ((void)0)
+
+#endif //MILKY_PROFILE
+
+#endif //PROFILER_H
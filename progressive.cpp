@@ -0,0 +1,159 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include "gl.h"
+#include "pipeline.h"
+#include "profiler.h"
+#include "progressive.h"
+#include "utils.h"
+
+// faces the coarse pass draws between looks at the clock; the first chunk is smaller, so the
+// time per face is known before much of the budget is spent
+constexpr int COARSE_CHUNK = 2048;
+constexpr int FIRST_CHUNK = 256;
+// the share of the first image's budget kept for upsampling it
+constexpr double UPSAMPLE_SHARE = .25;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// milliseconds per face of the coarse pass and per pixel of each upsample, as the last call
+// measured them; the first call goes by these guesses, on the slow side
+std::atomic<double> face_ms{.002};
+std::atomic<double> nearest_pixel_ms{1e-5};
+std::atomic<double> bilinear_pixel_ms{3e-5};
+
+double since(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// draw_shaded's vertex stage for one face
+void setup_face(Model const& model, Shader const& shader, Mat4x4f const& mvpscr, int face, Varyings& varyings,
+                ScreenTriangle& coords) {
+    VertexData vd = varyings.reset(face);
+    for (int j = 0; j < 3; j++) {
+        auto [x, y, z] = transform(shader.eval_vertex(model, face, j, vd), mvpscr).view();
+        coords[j] = Vec3i(x, y, z);
+    }
+}
+
+} // namespace
+
+ProgressiveStats render_progressive(Model const& model, Shader const& coarse, Shader const& fine, Mat4x4f const& mvp,
+                                    int width, int height, ProgressiveOptions const& options,
+                                    ProgressCallback const& callback) {
+    const Clock::time_point start = Clock::now();
+    ProgressiveStats stats;
+    const int faces = model.number_of_faces();
+    // the coarse and the fine shader set up the same faces in turn
+    Varyings varyings(faces, std::max(coarse.varyings(), fine.varyings()));
+    auto shade = [&](Shader const& shader, int face, ScreenTriangle const& t, ScreenRect const& clip,
+                     ColorTarget& color, DepthTarget& depth) {
+        shading_triangle(t[0].x, t[0].y, t[0].z, t[1].x, t[1].y, t[1].z, t[2].x, t[2].y, t[2].z,
+                         model, color, depth, clip, shader, varyings[face]);
+    };
+
+    TGAImage image;
+    {
+        PROFILE_SCOPE("progressive coarse");
+        const int scale = std::max(1, options.coarse);
+        const int coarse_width = std::max(1, width / scale), coarse_height = std::max(1, height / scale);
+        const Mat4x4f mvpscr = viewport_transform(coarse_width, coarse_height, 255) * mvp;
+        ColorTarget color(coarse_width, coarse_height);
+        DepthTarget depth(coarse_width, coarse_height);
+        const double budget = options.first_ms * (1 - UPSAMPLE_SHARE);
+        const double draw_start = since(start);
+        for (int first = 0; first < faces;) {
+            const int count = std::min(faces - first, first ? COARSE_CHUNK : FIRST_CHUNK);
+            // the faces so far predict the next chunk, the last call's the first one
+            const double elapsed = since(start);
+            const double per_face = first ? (elapsed - draw_start) / first : face_ms.load();
+            if (elapsed + per_face * count > budget) break;
+            draw_faces(count, color, depth, [&](int face, ScreenTriangle& coords) {
+                setup_face(model, coarse, mvpscr, first + face, varyings, coords);
+            }, [&](int face, ScreenTriangle const& t, ScreenRect const& clip, ColorTarget& c, DepthTarget& d) {
+                shade(coarse, first + face, t, clip, c, d);
+            });
+            first += count;
+            stats.coarse_faces = first;
+        }
+        if (stats.coarse_faces) face_ms = (since(start) - draw_start) / stats.coarse_faces;
+        image = TGAImage(coarse_width, coarse_height, TGAImage::RGB);
+        resolve(color, image);
+        // bilinear when it fits in what is left of the budget, else nearest, else the coarse
+        // image goes out as it is
+        const double left = options.first_ms - since(start), pixels = static_cast<double>(width) * height;
+        for (auto [filter, cost] : {std::pair{TGAImage::BILINEAR, &bilinear_pixel_ms},
+                                    std::pair{TGAImage::NEAREST, &nearest_pixel_ms}}) {
+            if (cost->load() * pixels > left) continue;
+            const double resize_start = since(start);
+            image.resize(width, height, filter);
+            *cost = (since(start) - resize_start) / pixels;
+            break;
+        }
+    }
+    const int tile = BIN * std::max(1, options.tile_bins);
+    const int tiles_x = (width + tile - 1) / tile, tiles_y = (height + tile - 1) / tile;
+    stats.tiles = tiles_x * tiles_y;
+    stats.first_ms = stats.last_ms = since(start);
+    callback(image, 0, stats.tiles);
+
+    auto expired = [&](double next_ms) { return options.deadline_ms > 0 && since(start) + next_ms > options.deadline_ms; };
+    if (expired(0)) return stats;
+    if (image.get_width() != width || image.get_height() != height) image.resize(width, height, TGAImage::NEAREST);
+
+    PROFILE_SCOPE("progressive refine");
+    const Mat4x4f mvpscr = viewport_transform(width, height, 255) * mvp;
+    ColorTarget color(width, height);
+    DepthTarget depth(width, height);
+    BinnedFaces binned;
+    bin_faces(faces, color.bounds(), [&](int face, ScreenTriangle& coords) {
+        setup_face(model, fine, mvpscr, face, varyings, coords);
+    }, binned);
+
+    // the middle of the frame first, where the subject usually is
+    std::vector<int> order(stats.tiles);
+    for (int i = 0; i < stats.tiles; i++) order[i] = i;
+    auto distance = [&](int i) {
+        const int dx = (i % tiles_x * 2 + 1) * tile - width, dy = (i / tiles_x * 2 + 1) * tile - height;
+        return dx * dx + dy * dy;
+    };
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return distance(a) < distance(b); });
+
+    const double refine_start = since(start);
+    const int bins_per_tile = std::max(1, options.tile_bins);
+    for (int i : order) {
+        // the tiles so far predict the next
+        if (expired(stats.tiles_refined ? (since(start) - refine_start) / stats.tiles_refined : 0)) break;
+        const int bx0 = i % tiles_x * bins_per_tile, by0 = i / tiles_x * bins_per_tile;
+        const int bx1 = std::min(binned.bins_x, bx0 + bins_per_tile), by1 = std::min(binned.bins_y, by0 + bins_per_tile);
+        const int columns = bx1 - bx0;
+        Scheduler::instance().parallel_for(0, columns * (by1 - by0), 1, [&](int first, int last) {
+            for (int k = first; k < last; k++) {
+                raster_bin(binned, (by0 + k / columns) * binned.bins_x + bx0 + k % columns,
+                           [&](int face, ScreenTriangle const& t, ScreenRect const& clip) {
+                    shade(fine, face, t, clip, color, depth);
+                });
+            }
+        });
+
+        const int x0 = i % tiles_x * tile, y0 = i / tiles_x * tile;
+        const int x1 = std::min(width, x0 + tile), y1 = std::min(height, y0 + tile);
+        unsigned char* pixels = image.buffer();
+        for (int y = y0; y < y1; y++) {
+            unsigned char* dst = pixels + (static_cast<size_t>(y) * width + x0) * 3;
+            for (int x = x0; x < x1; x++, dst += 3) {
+                const uint32_t c = color.at(x, y);
+                dst[0] = static_cast<unsigned char>(c);
+                dst[1] = static_cast<unsigned char>(c >> 8);
+                dst[2] = static_cast<unsigned char>(c >> 16);
+            }
+        }
+        stats.tiles_refined++;
+        stats.last_ms = since(start);
+        callback(image, stats.tiles_refined, stats.tiles);
+    }
+    return stats;
+}
@@ -0,0 +1,49 @@
+#ifndef PROGRESSIVE_H
+#define PROGRESSIVE_H
+
+#include <functional>
+#include "matrix.h"
+#include "model.h"
+#include "shader.h"
+#include "tgaimage.h"
+
+struct ProgressiveOptions {
+    // the first image is drawn at 1/coarse of the size each way, then upsampled; 2 or 4
+    int coarse = 4;
+    // milliseconds from the call to the first image
+    double first_ms = 50;
+    // milliseconds from the call after which no refinement starts, 0 to refine everything
+    double deadline_ms = 0;
+    // edge of a refinement tile, in bins
+    int tile_bins = 2;
+};
+
+struct ProgressiveStats {
+    // when the first image and the last refinement were handed over
+    double first_ms = 0;
+    double last_ms = 0;
+    // faces in the first image, fewer than the model's when its budget ran out
+    int coarse_faces = 0;
+    int tiles_refined = 0;
+    int tiles = 0;
+};
+
+// called with the image, the tiles refined so far and the number of tiles
+using ProgressCallback = std::function<void(TGAImage const&, int, int)>;
+
+// Renders the model into a width x height RGB image in steps, for previews of models too
+// heavy to draw at once; mvp takes model space to clip space, without the viewport. The
+// coarse shader draws the whole frame at a fraction of the size, which is upsampled and
+// handed to the callback within options.first_ms: the faces are drawn in chunks and the
+// pass stops early, leaving faces out, when the next chunk would not fit, going by the
+// costs earlier calls measured. The upsample is bilinear when it fits in the time left,
+// nearest when only that does; when neither does the first image keeps the coarse size.
+// Then tiles, from the middle of the frame out, are drawn at full size with the fine shader
+// and replace the preview one at a time, each handed to the callback, until all are done or
+// the deadline passes. Image rows are bottom-up, like the render targets'. A finished image
+// equals draw_shaded with the fine shader and no z-prepass.
+ProgressiveStats render_progressive(Model const& model, Shader const& coarse, Shader const& fine, Mat4x4f const& mvp,
+                                    int width, int height, ProgressiveOptions const& options,
+                                    ProgressCallback const& callback);
+
+#endif //PROGRESSIVE_H
@@ -0,0 +1,185 @@
+#ifndef RENDER_TARGET_H
+#define RENDER_TARGET_H
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include "image_kernels.h"
+#include "profiler.h"
+#include "scheduler.h"
+#include "tgaimage.h"
+
+// A fixed-format 2D buffer for the rasterizer, stored as 8x8 tiles so a triangle touches
+// few cache lines and pages: a depth tile is exactly one cache line, a color tile four.
+// Tiles are laid out row-major, texels row-major inside a tile, so the 8 texels of one
+// tile row are contiguous. No bounds checks; row 0 is the bottom of the frame, like the
+// TGAImage framebuffers the rasterizer used to draw into. resolve() makes it linear.
+constexpr int RENDER_TILE = 8;
+
+// texel index of (x, y) in a tiled target that is tiles_x tiles wide
+inline size_t tile_index(int x, int y, int tiles_x) {
+    auto ux = static_cast<unsigned>(x), uy = static_cast<unsigned>(y);
+    return (static_cast<size_t>(uy / RENDER_TILE) * tiles_x + ux / RENDER_TILE) * RENDER_TILE * RENDER_TILE +
+           uy % RENDER_TILE * RENDER_TILE + ux % RENDER_TILE;
+}
+
+// half-open pixel rectangle [x0, x1) x [y0, y1)
+struct ScreenRect {
+    int x0, y0, x1, y1;
+};
+
+template <typename Texel> class RenderTarget {
+    struct Free {
+        void operator()(Texel *p) const { std::free(p); }
+    };
+
+    int width;
+    int height;
+    int tiles_x; // tiles per row of tiles, the size is padded up to whole tiles
+    int tiles_y;
+    std::unique_ptr<Texel[], Free> texels;
+
+public:
+    static constexpr int TILE = RENDER_TILE;
+    static constexpr int TILE_TEXELS = TILE * TILE;
+
+    RenderTarget(int w, int h) : width(w), height(h), tiles_x((w + TILE - 1) / TILE), tiles_y((h + TILE - 1) / TILE) {
+        size_t nbytes = std::max<size_t>(64, size() * sizeof(Texel));
+        texels.reset(static_cast<Texel *>(std::aligned_alloc(64, (nbytes + 63) / 64 * 64)));
+        if (!texels) throw std::bad_alloc();
+        clear();
+    }
+
+    [[nodiscard]] int get_width() const { return width; }
+    [[nodiscard]] int get_height() const { return height; }
+    [[nodiscard]] int get_tiles_x() const { return tiles_x; }
+    [[nodiscard]] int get_tiles_y() const { return tiles_y; }
+    [[nodiscard]] ScreenRect bounds() const { return {0, 0, width, height}; }
+    // texels including the padding of the edge tiles
+    [[nodiscard]] size_t size() const { return static_cast<size_t>(tiles_x) * tiles_y * TILE_TEXELS; }
+
+    Texel *data() { return texels.get(); }
+    const Texel *data() const { return texels.get(); }
+
+    // texels (x, y) up to the end of its tile row, (x | 7, y), are contiguous
+    Texel *span(int x, int y) { return texels.get() + tile_index(x, y, tiles_x); }
+    const Texel *span(int x, int y) const { return texels.get() + tile_index(x, y, tiles_x); }
+    Texel &at(int x, int y) { return *span(x, y); }
+    const Texel &at(int x, int y) const { return *span(x, y); }
+
+    // writes value to texels [x0, x1) of row y
+    void fill_span(int y, int x0, int x1, Texel value) {
+        while (x0 < x1) {
+            int end = std::min(x1, (x0 / TILE + 1) * TILE);
+            std::fill(span(x0, y), span(x0, y) + (end - x0), value);
+            x0 = end;
+        }
+    }
+
+    void clear(Texel value = Texel()) {
+        std::fill(texels.get(), texels.get() + size(), value);
+    }
+};
+
+// packed b | g << 8 | r << 16 | a << 24, the byte order TGA stores
+using ColorTarget = RenderTarget<uint32_t>;
+// 8-bit depth, larger is closer
+using DepthTarget = RenderTarget<uint8_t>;
+
+inline uint32_t pack_color(TGAColor const &c) {
+    return static_cast<uint32_t>(c.b) | static_cast<uint32_t>(c.g) << 8 |
+           static_cast<uint32_t>(c.r) << 16 | static_cast<uint32_t>(c.a) << 24;
+}
+
+// merges a second color and depth pair of the same size into the first, keeping the
+// closer fragment and the first pair's on equal depth. Merging the targets of consecutive
+// face ranges in order gives what drawing all faces into one target would
+inline void composite(ColorTarget &color, DepthTarget &depth, ColorTarget const &src_color, DepthTarget const &src_depth) {
+    constexpr size_t BLOCK = 64 * DepthTarget::TILE_TEXELS;
+    const int blocks = static_cast<int>((depth.size() + BLOCK - 1) / BLOCK);
+    Scheduler::instance().parallel_for(0, blocks, 4, [&](int b0, int b1) {
+        size_t begin = b0 * BLOCK;
+        size_t n = std::min(b1 * BLOCK, depth.size()) - begin;
+        composite_depth(color.data() + begin, depth.data() + begin, src_color.data() + begin, src_depth.data() + begin, n);
+    });
+}
+
+// whether image is a grayscale, RGB or RGBA image the size of the target
+template <typename Texel> bool resolves_into(RenderTarget<Texel> const &target, TGAImage const &image) {
+    const int bytespp = image.get_bytespp();
+    return image.get_width() == target.get_width() && image.get_height() == target.get_height() &&
+           (bytespp == TGAImage::GRAYSCALE || bytespp == TGAImage::RGB || bytespp == TGAImage::RGBA);
+}
+
+// copies the target into a linear image of the same size, one tile row at a time;
+// RGB images drop alpha. False, writing nothing, when resolves_into does not hold
+inline bool resolve(ColorTarget const &target, TGAImage &image) {
+    PROFILE_SCOPE("resolve");
+    assert(resolves_into(target, image));
+    if (!resolves_into(target, image)) return false;
+    constexpr int TILE = ColorTarget::TILE;
+    const int bytespp = image.get_bytespp();
+    const int width = target.get_width();
+    unsigned char *pixels = image.buffer();
+    Scheduler::instance().parallel_for(0, target.get_height(), TILE * 4, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++) {
+            unsigned char *dst = pixels + static_cast<size_t>(y) * width * bytespp;
+            for (int x0 = 0; x0 < width; x0 += TILE) {
+                const uint32_t *src = target.span(x0, y);
+                const int n = std::min(TILE, width - x0);
+                if (bytespp == TGAImage::RGBA) {
+                    memcpy(dst, src, static_cast<size_t>(n) * 4);
+                    dst += n * 4;
+                    continue;
+                }
+                for (int x = 0; x < n; x++) {
+                    uint32_t c = src[x];
+                    if (bytespp == TGAImage::GRAYSCALE) {
+                        *dst++ = static_cast<unsigned char>(c);
+                    } else {
+                        dst[0] = static_cast<unsigned char>(c);
+                        dst[1] = static_cast<unsigned char>(c >> 8);
+                        dst[2] = static_cast<unsigned char>(c >> 16);
+                        dst += 3;
+                    }
+                }
+            }
+        }
+    });
+    return true;
+}
+
+// writes depth as a gray level into every channel; false as for color
+inline bool resolve(DepthTarget const &target, TGAImage &image) {
+    assert(resolves_into(target, image));
+    if (!resolves_into(target, image)) return false;
+    constexpr int TILE = DepthTarget::TILE;
+    const int bytespp = image.get_bytespp();
+    const int width = target.get_width();
+    unsigned char *pixels = image.buffer();
+    Scheduler::instance().parallel_for(0, target.get_height(), TILE * 4, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++) {
+            unsigned char *dst = pixels + static_cast<size_t>(y) * width * bytespp;
+            for (int x0 = 0; x0 < width; x0 += TILE) {
+                const uint8_t *src = target.span(x0, y);
+                const int n = std::min(TILE, width - x0);
+                for (int x = 0; x < n; x++) {
+                    if (bytespp == TGAImage::GRAYSCALE) {
+                        *dst++ = src[x];
+                    } else {
+                        dst[0] = dst[1] = dst[2] = src[x];
+                        if (bytespp == TGAImage::RGBA) dst[3] = 0;
+                        dst += bytespp;
+                    }
+                }
+            }
+        }
+    });
+    return true;
+}
+
+#endif //RENDER_TARGET_H
@@ -0,0 +1,463 @@
+#include <algorithm>
+#include <cmath>
+#include "pipeline.h"
+#include "profiler.h"
+#include "scene.h"
+
+// objects per leaf; leaves stay small since refits can't split them
+constexpr int LEAF_OBJECTS = 4;
+// objects drawn between the occlusion tests reading the depth they left
+constexpr int OCCLUSION_BATCH = 64;
+
+namespace {
+
+enum class Cover { OUTSIDE, PARTIAL, INSIDE };
+
+// how much of a world box reaches the screen under vpscr, by the rectangle of its corners;
+// boxes wholly past the far end of the depth range are out as well
+Cover cover(const float lo[3], const float hi[3], Mat4x4f const& m, ScreenRect const& screen) {
+    float x0 = INFINITY, y0 = INFINITY, x1 = -INFINITY, y1 = -INFINITY;
+    int behind = 0, beyond = 0;
+    for (int corner = 0; corner < 8; corner++) {
+        float p[3] = {corner & 1 ? hi[0] : lo[0], corner & 2 ? hi[1] : lo[1], corner & 4 ? hi[2] : lo[2]};
+        float w = m[3][0] * p[0] + m[3][1] * p[1] + m[3][2] * p[2] + m[3][3];
+        if (w <= 0) {
+            behind++;
+            continue;
+        }
+        float x = (m[0][0] * p[0] + m[0][1] * p[1] + m[0][2] * p[2] + m[0][3]) / w;
+        float y = (m[1][0] * p[0] + m[1][1] * p[1] + m[1][2] * p[2] + m[1][3]) / w;
+        beyond += m[2][0] * p[0] + m[2][1] * p[1] + m[2][2] * p[2] + m[2][3] < 0;
+        x0 = std::min(x0, x);
+        x1 = std::max(x1, x);
+        y0 = std::min(y0, y);
+        y1 = std::max(y1, y);
+    }
+    // as in draw_instanced, boxes crossing the camera plane are kept but never taken whole
+    if (behind) return behind < 8 ? Cover::PARTIAL : Cover::OUTSIDE;
+    if (beyond == 8 || x1 < screen.x0 || x0 >= screen.x1 || y1 < screen.y0 || y0 >= screen.y1) return Cover::OUTSIDE;
+    if (x0 >= screen.x0 && x1 < screen.x1 && y0 >= screen.y0 && y1 < screen.y1) return Cover::INSIDE;
+    return Cover::PARTIAL;
+}
+
+// the pixels a world box may cover under vpscr, a pixel wider than its corners for the
+// rounding of the vertices inside; the whole screen when the box crosses the camera plane
+ScreenRect screen_bounds(const float lo[3], const float hi[3], Mat4x4f const& m, ScreenRect const& screen) {
+    float x0 = INFINITY, y0 = INFINITY, x1 = -INFINITY, y1 = -INFINITY;
+    for (int corner = 0; corner < 8; corner++) {
+        float p[3] = {corner & 1 ? hi[0] : lo[0], corner & 2 ? hi[1] : lo[1], corner & 4 ? hi[2] : lo[2]};
+        float w = m[3][0] * p[0] + m[3][1] * p[1] + m[3][2] * p[2] + m[3][3];
+        if (w <= 0) return screen;
+        float x = (m[0][0] * p[0] + m[0][1] * p[1] + m[0][2] * p[2] + m[0][3]) / w;
+        float y = (m[1][0] * p[0] + m[1][1] * p[1] + m[1][2] * p[2] + m[1][3]) / w;
+        x0 = std::min(x0, x);
+        x1 = std::max(x1, x);
+        y0 = std::min(y0, y);
+        y1 = std::max(y1, y);
+    }
+    auto clamp = [](float v, int low, int high) {
+        return static_cast<int>(std::clamp(v, static_cast<float>(low), static_cast<float>(high)));
+    };
+    return {clamp(std::floor(x0) - 1, screen.x0, screen.x1), clamp(std::floor(y0) - 1, screen.y0, screen.y1),
+            clamp(std::floor(x1) + 2, screen.x0, screen.x1), clamp(std::floor(y1) + 2, screen.y0, screen.y1)};
+}
+
+// the largest 8-bit depth a world box can be drawn with under vpscr; -1 when the box crosses
+// the camera plane or leaves the depth range, where drawn depths wrap around
+int nearest_depth(const float lo[3], const float hi[3], Mat4x4f const& m) {
+    float nearest = 0;
+    for (int corner = 0; corner < 8; corner++) {
+        float p[3] = {corner & 1 ? hi[0] : lo[0], corner & 2 ? hi[1] : lo[1], corner & 4 ? hi[2] : lo[2]};
+        float w = m[3][0] * p[0] + m[3][1] * p[1] + m[3][2] * p[2] + m[3][3];
+        if (w <= 0) return -1;
+        float z = (m[2][0] * p[0] + m[2][1] * p[1] + m[2][2] * p[2] + m[2][3]) / w;
+        if (z < 0 || z >= 256) return -1;
+        nearest = std::max(nearest, z);
+    }
+    return static_cast<int>(nearest);
+}
+
+// the farthest depth drawn in every RENDER_TILE tile of a depth target; cleared texels hold
+// 0, so tiles not wholly covered hide nothing
+class DepthTiles {
+public:
+    explicit DepthTiles(DepthTarget const& zbuffer)
+        : zbuffer(zbuffer), farthest(static_cast<size_t>(zbuffer.get_tiles_x()) * zbuffer.get_tiles_y()),
+          stale(farthest.size(), 1) {
+        refresh();
+    }
+
+    // whether every pixel of r holds at least depth, so that nothing drawn there with at most
+    // that depth passes the depth test. Tiles are taken whole by their farthest depth and
+    // read texel by texel only otherwise
+    [[nodiscard]] bool hides(ScreenRect const& r, int depth) const {
+        if (r.x0 >= r.x1 || r.y0 >= r.y1) return true;
+        for (int ty = r.y0 / RENDER_TILE; ty <= (r.y1 - 1) / RENDER_TILE; ty++) {
+            for (int tx = r.x0 / RENDER_TILE; tx <= (r.x1 - 1) / RENDER_TILE; tx++) {
+                const size_t tile = static_cast<size_t>(ty) * zbuffer.get_tiles_x() + tx;
+                if (farthest[tile] >= depth) continue;
+                const uint8_t* z = zbuffer.data() + tile * DepthTarget::TILE_TEXELS;
+                for (int y = std::max(r.y0, ty * RENDER_TILE); y < std::min(r.y1, (ty + 1) * RENDER_TILE); y++) {
+                    for (int x = std::max(r.x0, tx * RENDER_TILE); x < std::min(r.x1, (tx + 1) * RENDER_TILE); x++) {
+                        if (z[y % RENDER_TILE * RENDER_TILE + x % RENDER_TILE] < depth) return false;
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+    // the tiles under r are read again at the next refresh
+    void touch(ScreenRect const& r) {
+        if (r.x0 >= r.x1 || r.y0 >= r.y1) return;
+        for (int ty = r.y0 / RENDER_TILE; ty <= (r.y1 - 1) / RENDER_TILE; ty++) {
+            for (int tx = r.x0 / RENDER_TILE; tx <= (r.x1 - 1) / RENDER_TILE; tx++) {
+                stale[static_cast<size_t>(ty) * zbuffer.get_tiles_x() + tx] = 1;
+            }
+        }
+    }
+
+    void refresh() {
+        constexpr int TEXELS = DepthTarget::TILE_TEXELS;
+        for (size_t tile = 0; tile < farthest.size(); tile++) {
+            if (!stale[tile]) continue;
+            const uint8_t* z = zbuffer.data() + tile * TEXELS;
+            farthest[tile] = *std::min_element(z, z + TEXELS);
+            stale[tile] = 0;
+        }
+    }
+
+private:
+    DepthTarget const& zbuffer;
+    std::vector<uint8_t> farthest;
+    std::vector<uint8_t> stale;
+};
+
+float area(const float lo[3], const float hi[3]) {
+    float x = hi[0] - lo[0], y = hi[1] - lo[1], z = hi[2] - lo[2];
+    return 2 * (x * y + y * z + z * x);
+}
+
+} // namespace
+
+int SceneGraph::add(std::shared_ptr<const InstancedMesh> mesh, Mat4x4f const& transform, TGAColor color) {
+    int id = static_cast<int>(objects.size());
+    if (!free_ids.empty()) {
+        id = free_ids.back();
+        free_ids.pop_back();
+    } else {
+        objects.emplace_back();
+    }
+    objects[id] = {std::move(mesh), transform, color, {}, {}, {}, false};
+    world_bounds(objects[id]);
+    change(id);
+    rebuild = true;
+    return id;
+}
+
+void SceneGraph::remove(int id) {
+    if (!live(id)) return;
+    change(id);
+    objects[id].mesh.reset();
+    free_ids.push_back(id);
+    rebuild = true;
+}
+
+void SceneGraph::move(int id, Mat4x4f const& transform) {
+    if (!live(id)) return;
+    change(id);
+    objects[id].transform = transform;
+    world_bounds(objects[id]);
+    refit = true;
+}
+
+bool SceneGraph::live(int id) const {
+    return id >= 0 && id < static_cast<int>(objects.size()) && objects[id].mesh;
+}
+
+void SceneGraph::change(int id) {
+    Object& object = objects[id];
+    if (object.drawn.x0 < object.drawn.x1 && object.drawn.y0 < object.drawn.y1) damage.push_back(object.drawn);
+    object.drawn = {};
+    if (!object.changed) changed.push_back(id);
+    object.changed = true;
+}
+
+void SceneGraph::world_bounds(Object& object) {
+    const Vec3f lo = object.mesh->lower(), hi = object.mesh->upper();
+    Mat4x4f const& m = object.transform;
+    for (int a = 0; a < 3; a++) {
+        object.lo[a] = INFINITY;
+        object.hi[a] = -INFINITY;
+    }
+    for (int corner = 0; corner < 8; corner++) {
+        float p[3] = {corner & 1 ? hi.x : lo.x, corner & 2 ? hi.y : lo.y, corner & 4 ? hi.z : lo.z};
+        for (int a = 0; a < 3; a++) {
+            float v = m[a][0] * p[0] + m[a][1] * p[1] + m[a][2] * p[2] + m[a][3];
+            object.lo[a] = std::min(object.lo[a], v);
+            object.hi[a] = std::max(object.hi[a], v);
+        }
+    }
+}
+
+// splits at the median of the centers along their longest extent; the tree is refit far more
+// often than built, so a cheap build is worth more than a tight one
+int SceneGraph::build(int first, int count) {
+    const int index = static_cast<int>(nodes.size());
+    nodes.push_back({});
+    float lo[3] = {INFINITY, INFINITY, INFINITY}, hi[3] = {-INFINITY, -INFINITY, -INFINITY};
+    for (int i = first; i < first + count; i++) {
+        Object const& object = objects[items[i]];
+        for (int a = 0; a < 3; a++) {
+            lo[a] = std::min(lo[a], object.lo[a] + object.hi[a]);
+            hi[a] = std::max(hi[a], object.lo[a] + object.hi[a]);
+        }
+    }
+    if (count <= LEAF_OBJECTS) {
+        nodes[index].first = first;
+        nodes[index].count = count;
+        return index;
+    }
+    int axis = 0;
+    for (int a = 1; a < 3; a++) {
+        if (hi[a] - lo[a] > hi[axis] - lo[axis]) axis = a;
+    }
+    const int half = count / 2;
+    std::nth_element(items.begin() + first, items.begin() + first + half, items.begin() + first + count,
+                     [&](int a, int b) {
+        return objects[a].lo[axis] + objects[a].hi[axis] < objects[b].lo[axis] + objects[b].hi[axis];
+    });
+    build(first, half);
+    const int second = build(first + half, count - half);
+    nodes[index].first = second;
+    nodes[index].count = 0;
+    return index;
+}
+
+// children follow their parent, so one backward pass updates every node from its children
+float SceneGraph::refit_nodes() {
+    float cost = 0;
+    for (int n = static_cast<int>(nodes.size()) - 1; n >= 0; n--) {
+        Node& node = nodes[n];
+        for (int a = 0; a < 3; a++) {
+            node.lo[a] = INFINITY;
+            node.hi[a] = -INFINITY;
+        }
+        auto grow = [&](const float lo[3], const float hi[3]) {
+            for (int a = 0; a < 3; a++) {
+                node.lo[a] = std::min(node.lo[a], lo[a]);
+                node.hi[a] = std::max(node.hi[a], hi[a]);
+            }
+        };
+        if (node.count) {
+            for (int i = node.first; i < node.first + node.count; i++) grow(objects[items[i]].lo, objects[items[i]].hi);
+        } else {
+            grow(nodes[n + 1].lo, nodes[n + 1].hi);
+            grow(nodes[node.first].lo, nodes[node.first].hi);
+        }
+        cost += area(node.lo, node.hi);
+    }
+    return cost;
+}
+
+void SceneGraph::update() {
+    if (refit && !rebuild) {
+        PROFILE_SCOPE("scene refit");
+        rebuild = refit_nodes() > 2 * built_cost;
+    }
+    if (rebuild) {
+        PROFILE_SCOPE("scene build");
+        items.clear();
+        for (int id = 0; id < static_cast<int>(objects.size()); id++) {
+            if (objects[id].mesh) items.push_back(id);
+        }
+        nodes.clear();
+        if (!items.empty()) build(0, static_cast<int>(items.size()));
+        built_cost = refit_nodes();
+    }
+    rebuild = refit = false;
+}
+
+std::vector<int> SceneGraph::visible(Mat4x4f const& vpscr, ScreenRect const& screen, bool front_to_back,
+                                     SceneStats& stats) {
+    update();
+    PROFILE_SCOPE("scene culling");
+    std::vector<int> ids;
+    if (nodes.empty()) return ids;
+    // nodes with whether an ancestor was found entirely on screen
+    std::vector<std::pair<int, bool>> stack = {{0, false}};
+    while (!stack.empty()) {
+        auto [n, inside] = stack.back();
+        stack.pop_back();
+        Node const& node = nodes[n];
+        if (!inside) {
+            stats.nodes_visited++;
+            Cover c = cover(node.lo, node.hi, vpscr, screen);
+            if (c == Cover::OUTSIDE) continue;
+            inside = c == Cover::INSIDE;
+        }
+        if (node.count) {
+            for (int i = node.first; i < node.first + node.count; i++) {
+                Object const& object = objects[items[i]];
+                if (inside || node.count == 1 || cover(object.lo, object.hi, vpscr, screen) != Cover::OUTSIDE) {
+                    ids.push_back(items[i]);
+                }
+            }
+        } else {
+            stack.emplace_back(node.first, inside);
+            stack.emplace_back(n + 1, inside);
+        }
+    }
+    stats.objects_culled = size() - static_cast<int>(ids.size());
+
+    if (!front_to_back) {
+        std::sort(ids.begin(), ids.end());
+        return ids;
+    }
+    // by the camera distance of the bounds' centers, which is w up to a constant
+    std::vector<std::pair<float, int>> order;
+    order.reserve(ids.size());
+    for (int id : ids) {
+        Object const& object = objects[id];
+        float w = vpscr[3][3];
+        for (int a = 0; a < 3; a++) w += vpscr[3][a] * (object.lo[a] + object.hi[a]) / 2;
+        order.emplace_back(w, id);
+    }
+    std::sort(order.begin(), order.end());
+    for (size_t i = 0; i < order.size(); i++) ids[i] = order[i].second;
+    return ids;
+}
+
+std::vector<int> SceneGraph::visible_linear(Mat4x4f const& vpscr, ScreenRect const& screen, SceneStats& stats) const {
+    std::vector<int> ids;
+    for (int id = 0; id < static_cast<int>(objects.size()); id++) {
+        Object const& object = objects[id];
+        if (object.mesh && cover(object.lo, object.hi, vpscr, screen) != Cover::OUTSIDE) ids.push_back(id);
+    }
+    stats.objects_culled = size() - static_cast<int>(ids.size());
+    return ids;
+}
+
+SceneStats SceneGraph::draw(Mat4x4f const& vpscr, Vec3f const& light, ColorTarget& framebuffer, DepthTarget& zbuffer,
+                            bool front_to_back, bool occlusion) {
+    SceneStats stats;
+    const ScreenRect screen = framebuffer.bounds();
+    const std::vector<int> ids = visible(vpscr, screen, front_to_back || occlusion, stats);
+    if (!occlusion) {
+        stats.objects_drawn = draw_objects(ids, vpscr, light, framebuffer, zbuffer, nullptr);
+        stats.objects_culled = size() - stats.objects_drawn;
+        return stats;
+    }
+    DepthTiles tiles(zbuffer);
+    std::vector<int> batch;
+    std::vector<ScreenRect> rects;
+    for (size_t first = 0; first < ids.size(); first += OCCLUSION_BATCH) {
+        batch.clear();
+        rects.clear();
+        {
+            PROFILE_SCOPE("scene occlusion");
+            for (size_t i = first; i < std::min(ids.size(), first + OCCLUSION_BATCH); i++) {
+                Object const& object = objects[ids[i]];
+                const ScreenRect r = screen_bounds(object.lo, object.hi, vpscr, screen);
+                const int depth = nearest_depth(object.lo, object.hi, vpscr);
+                if (depth >= 0 && tiles.hides(r, depth)) {
+                    stats.objects_occluded++;
+                    continue;
+                }
+                batch.push_back(ids[i]);
+                rects.push_back(r);
+            }
+        }
+        stats.objects_drawn += draw_objects(batch, vpscr, light, framebuffer, zbuffer, nullptr);
+        {
+            PROFILE_SCOPE("scene occlusion");
+            for (ScreenRect const& r : rects) tiles.touch(r);
+            tiles.refresh();
+        }
+    }
+    stats.objects_culled = size() - stats.objects_drawn - stats.objects_occluded;
+    return stats;
+}
+
+// runs of one mesh in the draw order go to draw_instanced together
+int SceneGraph::draw_objects(std::vector<int> const& ids, Mat4x4f const& vpscr, Vec3f const& light,
+                             ColorTarget& framebuffer, DepthTarget& zbuffer, std::vector<uint8_t> const* bins) {
+    int drawn = 0;
+    std::vector<Instance> run;
+    for (size_t i = 0; i < ids.size();) {
+        InstancedMesh const& mesh = *objects[ids[i]].mesh;
+        run.clear();
+        for (; i < ids.size() && objects[ids[i]].mesh.get() == &mesh; i++) {
+            run.push_back({objects[ids[i]].transform, objects[ids[i]].color});
+        }
+        drawn += draw_instanced(mesh, run, vpscr, light, framebuffer, zbuffer, bins).drawn;
+    }
+    return drawn;
+}
+
+SceneStats SceneGraph::draw_incremental(Mat4x4f const& vpscr, Vec3f const& light, ColorTarget& framebuffer,
+                                        DepthTarget& zbuffer) {
+    PROFILE_SCOPE("draw incremental");
+    SceneStats stats;
+    const ScreenRect screen = framebuffer.bounds();
+    const int bins_x = (screen.x1 + BIN - 1) / BIN, bins_y = (screen.y1 + BIN - 1) / BIN;
+    stats.bins = bins_x * bins_y;
+
+    bool full = screen.x1 != drawn_screen.x1 || screen.y1 != drawn_screen.y1;
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) full = full || vpscr[i][j] != drawn_vpscr[i][j];
+    }
+    if (full) {
+        for (int id = 0; id < static_cast<int>(objects.size()); id++) {
+            if (objects[id].mesh && !objects[id].changed) change(id);
+        }
+        damage.assign(1, screen);
+        drawn_vpscr = vpscr;
+        drawn_screen = screen;
+    }
+
+    const std::vector<int> ids = visible(vpscr, screen, true, stats);
+    std::vector<uint8_t> dirty(stats.bins);
+    // the bins under a rectangle: set when mark is true, else whether any of them is set
+    auto bins_under = [&](ScreenRect const& r, bool mark) {
+        if (r.x0 >= r.x1 || r.y0 >= r.y1) return false;
+        for (int by = r.y0 / BIN; by <= (r.y1 - 1) / BIN; by++) {
+            for (int bx = r.x0 / BIN; bx <= (r.x1 - 1) / BIN; bx++) {
+                if (mark) dirty[by * bins_x + bx] = 1;
+                else if (dirty[by * bins_x + bx]) return true;
+            }
+        }
+        return false;
+    };
+    for (ScreenRect const& r : damage) bins_under(r, true);
+    for (int id : ids) {
+        Object& object = objects[id];
+        if (!object.changed) continue;
+        object.drawn = screen_bounds(object.lo, object.hi, vpscr, screen);
+        bins_under(object.drawn, true);
+    }
+    for (int id : changed) objects[id].changed = false;
+    changed.clear();
+    damage.clear();
+
+    // the objects reaching a dirty bin, in draw order
+    std::vector<int> redraw;
+    for (int id : ids) {
+        if (bins_under(objects[id].drawn, false)) redraw.push_back(id);
+    }
+    {
+        PROFILE_SCOPE("clear dirty bins");
+        for (int bin = 0; bin < stats.bins; bin++) {
+            if (!dirty[bin]) continue;
+            stats.bins_drawn++;
+            const int x0 = bin % bins_x * BIN, y0 = bin / bins_x * BIN;
+            for (int y = y0; y < std::min(screen.y1, y0 + BIN); y++) {
+                framebuffer.fill_span(y, x0, std::min(screen.x1, x0 + BIN), 0);
+                zbuffer.fill_span(y, x0, std::min(screen.x1, x0 + BIN), 0);
+            }
+        }
+    }
+    stats.objects_drawn = draw_objects(redraw, vpscr, light, framebuffer, zbuffer, &dirty);
+    stats.objects_culled = size() - static_cast<int>(ids.size());
+    return stats;
+}
@@ -0,0 +1,109 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "instancing.h"
+#include "matrix.h"
+#include "render_target.h"
+#include "tgaimage.h"
+#include "vec.h"
+
+struct SceneStats {
+    int nodes_visited = 0;
+    int objects_culled = 0;
+    // draw with occlusion: the objects on screen dropped as hidden behind those drawn before
+    int objects_occluded = 0;
+    int objects_drawn = 0;
+    // draw_incremental: the BIN x BIN bins redrawn, of all bins of the screen
+    int bins_drawn = 0;
+    int bins = 0;
+};
+
+// Many objects, each a shared InstancedMesh under a world transform, in a bounding volume
+// hierarchy over their world bounds. Moving objects only refits the bounds of the tree, until
+// the refits have loosened it to twice its built cost; adding or removing them rebuilds it.
+// Drawing walks the tree against the view, so whole subtrees off screen or behind the camera
+// are dropped at once and subtrees entirely on screen are taken without testing their
+// objects, then draws the survivors, nearest first when asked, so the depth test rejects
+// hidden fragments before they are shaded. With occlusion, objects whose screen bounds lie
+// behind the depth already drawn in every tile they reach are not drawn at all.
+class SceneGraph {
+public:
+    // returns the id of the object, which stays valid until it is removed; remove and move
+    // ignore ids that are not live
+    int add(std::shared_ptr<const InstancedMesh> mesh, Mat4x4f const& transform,
+            TGAColor color = TGAColor(255, 255, 255));
+    void remove(int id);
+    void move(int id, Mat4x4f const& transform);
+
+    [[nodiscard]] int size() const { return static_cast<int>(objects.size() - free_ids.size()); }
+
+    // the ids of the objects reaching the screen under vpscr, ordered front to back or by id
+    std::vector<int> visible(Mat4x4f const& vpscr, ScreenRect const& screen, bool front_to_back, SceneStats& stats);
+    // the same without the tree: every object tested on its own
+    std::vector<int> visible_linear(Mat4x4f const& vpscr, ScreenRect const& screen, SceneStats& stats) const;
+
+    // draws the visible objects with draw_instanced, Gouraud-lit by a directional light.
+    // Occlusion draws front to back in batches and tests the nearest depth of each object
+    // against the farthest depth drawn so far in the RENDER_TILE tiles it reaches; the image
+    // is the same either way.
+    // It needs a depth range enclosing the objects, as camera_transform gives, and tests only
+    // objects wholly inside it
+    SceneStats draw(Mat4x4f const& vpscr, Vec3f const& light, ColorTarget& framebuffer, DepthTarget& zbuffer,
+                    bool front_to_back = true, bool occlusion = false);
+
+    // Redraws only what changed since the last call, into targets that still hold the image
+    // it left: the bins under the old and new screen bounds of every object added, removed or
+    // moved since are cleared, then drawn again with the objects reaching them, the rest is
+    // kept. A new vpscr or target size redraws everything. The image equals that of draw.
+    SceneStats draw_incremental(Mat4x4f const& vpscr, Vec3f const& light, ColorTarget& framebuffer,
+                                DepthTarget& zbuffer);
+
+    // brings the tree up to date with the objects; draw and visible do this themselves
+    void update();
+
+private:
+    struct Object {
+        std::shared_ptr<const InstancedMesh> mesh;
+        Mat4x4f transform;
+        TGAColor color;
+        float lo[3], hi[3];
+        // the screen bounds at the last draw_incremental, empty when it was not drawn
+        ScreenRect drawn{};
+        bool changed = false;
+    };
+    // leaves have count > 0 entries of items from first; inner nodes have their children at
+    // index + 1 and first
+    struct Node {
+        float lo[3], hi[3];
+        int first, count;
+    };
+
+    std::vector<Object> objects;
+    std::vector<int> free_ids;
+    std::vector<Node> nodes;
+    // the live object ids in leaf order
+    std::vector<int> items;
+    bool rebuild = false;
+    bool refit = false;
+    // the summed surface area of the nodes when built, against which refits are measured
+    float built_cost = 0;
+    // what draw_incremental must redraw: the objects changed since its last call and the
+    // screen bounds they were drawn with then, and the view and size it drew
+    std::vector<int> changed;
+    std::vector<ScreenRect> damage;
+    Mat4x4f drawn_vpscr;
+    ScreenRect drawn_screen{};
+
+    [[nodiscard]] bool live(int id) const;
+    void world_bounds(Object& object);
+    void change(int id);
+    int draw_objects(std::vector<int> const& ids, Mat4x4f const& vpscr, Vec3f const& light, ColorTarget& framebuffer,
+                     DepthTarget& zbuffer, std::vector<uint8_t> const* bins);
+    int build(int first, int count);
+    float refit_nodes();
+};
+
+#endif //SCENE_H
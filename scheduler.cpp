@@ -0,0 +1,154 @@
+#include <algorithm>
+#include <cstdlib>
+#include "scheduler.h"
+
+// the scheduler whose worker the current thread is, and its queue
+static thread_local const Scheduler *worker_of = nullptr;
+static thread_local size_t worker_queue = 0;
+
+Scheduler::TaskGroup::TaskGroup(Scheduler &scheduler) : scheduler(scheduler) {
+}
+
+Scheduler::TaskGroup::~TaskGroup() {
+    drain();
+}
+
+void Scheduler::TaskGroup::run(std::function<void()> task) {
+    pending.fetch_add(1, std::memory_order_relaxed);
+    scheduler.push({std::move(task), this});
+}
+
+void Scheduler::TaskGroup::drain() {
+    const size_t home = scheduler.home_queue();
+    while (pending.load(std::memory_order_acquire) > 0) {
+        if (!scheduler.run_one(home)) std::this_thread::yield();
+    }
+}
+
+void Scheduler::TaskGroup::wait() {
+    drain();
+    std::exception_ptr thrown;
+    {
+        std::lock_guard lock(error_mutex);
+        thrown.swap(error);
+    }
+    if (thrown) std::rethrow_exception(thrown);
+}
+
+Scheduler &Scheduler::instance() {
+    static Scheduler scheduler([] {
+        const char *env = std::getenv("MILKY_THREADS");
+        int threads = env ? std::atoi(env) : 0;
+        return threads > 0 ? threads : static_cast<int>(std::thread::hardware_concurrency());
+    }());
+    return scheduler;
+}
+
+Scheduler::Scheduler(int threads) {
+    start(threads);
+}
+
+Scheduler::~Scheduler() {
+    stop();
+}
+
+void Scheduler::set_threads(int threads) {
+    stop();
+    start(threads);
+}
+
+int Scheduler::threads() const {
+    return static_cast<int>(workers.size()) + 1;
+}
+
+void Scheduler::start(int threads) {
+    threads = std::max(threads, 1);
+    stopping = false;
+    queues.clear();
+    for (int i = 0; i < threads; i++) queues.push_back(std::make_unique<Queue>());
+    for (int i = 0; i + 1 < threads; i++) workers.emplace_back(&Scheduler::worker_loop, this, i);
+}
+
+void Scheduler::stop() {
+    {
+        std::lock_guard lock(sleep_mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto &worker : workers) worker.join();
+    workers.clear();
+}
+
+size_t Scheduler::home_queue() const {
+    return worker_of == this ? worker_queue : queues.size() - 1;
+}
+
+void Scheduler::push(Task task) {
+    Queue &queue = *queues[home_queue()];
+    {
+        std::lock_guard lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+    queued.fetch_add(1, std::memory_order_release);
+    // taking the lock orders this with a worker that is about to sleep
+    { std::lock_guard lock(sleep_mutex); }
+    wake.notify_one();
+}
+
+bool Scheduler::run_one(size_t home) {
+    Task task;
+    bool found = false;
+    for (size_t i = 0; i < queues.size() && !found; i++) {
+        Queue &queue = *queues[(home + i) % queues.size()];
+        std::lock_guard lock(queue.mutex);
+        if (queue.tasks.empty()) continue;
+        // newest from our own deque, oldest when stealing
+        if (i == 0) {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        } else {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+        found = true;
+    }
+    if (!found) return false;
+    queued.fetch_sub(1, std::memory_order_relaxed);
+    // the task counts as done however it ends, or its group would wait forever
+    struct Done {
+        TaskGroup *group;
+        ~Done() { group->pending.fetch_sub(1, std::memory_order_release); }
+    } done{task.group};
+    try {
+        task.run();
+    } catch (...) {
+        std::lock_guard lock(task.group->error_mutex);
+        if (!task.group->error) task.group->error = std::current_exception();
+    }
+    return true;
+}
+
+void Scheduler::worker_loop(size_t index) {
+    worker_of = this;
+    worker_queue = index;
+    for (;;) {
+        if (run_one(index)) continue;
+        std::unique_lock lock(sleep_mutex);
+        wake.wait(lock, [this] { return stopping || queued.load(std::memory_order_acquire) > 0; });
+        if (stopping && queued.load(std::memory_order_acquire) == 0) return;
+    }
+}
+
+void Scheduler::split(int begin, int end, int grain, std::function<void(int, int)> const &body) {
+    // a few chunks per thread so that stealing can even out uneven chunks
+    const long n = end - begin;
+    const long chunks = std::min<long>((n + grain - 1) / std::max(grain, 1), 4L * threads());
+    TaskGroup group(*this);
+    for (long i = 1; i < chunks; i++) {
+        int b = begin + static_cast<int>(n * i / chunks);
+        int e = begin + static_cast<int>(n * (i + 1) / chunks);
+        group.run([&body, b, e] { body(b, e); });
+    }
+    body(begin, begin + static_cast<int>(n / chunks));
+    group.wait();
+}
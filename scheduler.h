@@ -0,0 +1,94 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A persistent pool of worker threads with one task deque each. A worker pushes and pops
+// the back of its own deque and steals from the front of the others when it runs dry.
+// Threads outside the pool submit through one shared deque. Whoever waits for tasks runs
+// queued tasks meanwhile, so nested parallel_for calls never leave a thread blocked.
+class Scheduler {
+public:
+    // tasks that are waited for together; the first exception a task throws is kept and
+    // rethrown by wait
+    class TaskGroup {
+        friend class Scheduler;
+        Scheduler &scheduler;
+        std::atomic<int> pending{0};
+        std::mutex error_mutex;
+        std::exception_ptr error;
+
+        void drain();
+
+    public:
+        explicit TaskGroup(Scheduler &scheduler = Scheduler::instance());
+        TaskGroup(const TaskGroup &) = delete;
+        TaskGroup &operator=(const TaskGroup &) = delete;
+        // waits for the tasks but drops their exception
+        ~TaskGroup();
+
+        void run(std::function<void()> task);
+        void wait();
+    };
+
+    // threads come from MILKY_THREADS, or the hardware thread count when it is not set
+    static Scheduler &instance();
+
+    explicit Scheduler(int threads);
+    Scheduler(const Scheduler &) = delete;
+    Scheduler &operator=(const Scheduler &) = delete;
+    ~Scheduler();
+
+    // the number of threads running tasks, counting the thread that waits for them.
+    // Restarts the workers, so only call it while no tasks are queued
+    void set_threads(int threads);
+    [[nodiscard]] int threads() const;
+
+    // calls body(chunk_begin, chunk_end) over [begin, end) split into chunks of at least
+    // grain items and returns once all are done; ranges of at most grain run inline
+    template <typename Body>
+    void parallel_for(int begin, int end, int grain, Body const &body) {
+        if (end - begin <= std::max(grain, 1) || threads() == 1) {
+            if (begin < end) body(begin, end);
+            return;
+        }
+        split(begin, end, grain, std::cref(body));
+    }
+
+private:
+    struct Task {
+        std::function<void()> run;
+        TaskGroup *group;
+    };
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    // one per worker, then the one shared by outside threads
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    std::atomic<int> queued{0};
+    bool stopping = false;
+
+    void start(int threads);
+    void stop();
+    void push(Task task);
+    bool run_one(size_t home);
+    void worker_loop(size_t index);
+    [[nodiscard]] size_t home_queue() const;
+    void split(int begin, int end, int grain, std::function<void(int, int)> const &body);
+};
+
+#endif //SCHEDULER_H
@@ -0,0 +1,314 @@
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "image_codec.h"
+#include "server.h"
+
+void LatencyHistogram::record(double ms) {
+    double us = ms * 1000;
+    int bucket = us < 2 ? 0 : std::min(BUCKETS - 1, static_cast<int>(std::log2(us)));
+    buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::count() const {
+    uint64_t n = 0;
+    for (auto const &bucket : buckets) n += bucket.load(std::memory_order_relaxed);
+    return n;
+}
+
+double LatencyHistogram::percentile(double p) const {
+    const uint64_t n = count();
+    uint64_t seen = 0;
+    for (int k = 0; k < BUCKETS; k++) {
+        seen += buckets[k].load(std::memory_order_relaxed);
+        if (n && seen >= p * n) return std::ldexp(1.0, k + 1) / 1000;
+    }
+    return 0;
+}
+
+void LatencyHistogram::print(std::ostream &out, const char *name) const {
+    out << name << ": " << count() << " requests, p50 <= " << percentile(.5) << " ms, p90 <= " << percentile(.9)
+        << " ms, p99 <= " << percentile(.99) << " ms\n";
+    for (int k = 0; k < BUCKETS; k++) {
+        uint64_t n = buckets[k].load(std::memory_order_relaxed);
+        if (n) out << "  < " << std::setw(10) << std::ldexp(1.0, k + 1) / 1000 << " ms " << n << "\n";
+    }
+}
+
+RenderServer::RenderServer(size_t queue_capacity, int renderers)
+: capacity(std::max<size_t>(queue_capacity, 1)) {
+    for (int i = 0; i < std::max(renderers, 1); i++) {
+        this->renderers.emplace_back(&RenderServer::render_loop, this);
+    }
+}
+
+RenderServer::~RenderServer() {
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    queued.notify_all();
+    for (auto &renderer : renderers) renderer.join();
+}
+
+void RenderServer::render_loop() {
+    for (;;) {
+        Request request;
+        {
+            std::unique_lock lock(mutex);
+            queued.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (queue.empty()) return;
+            request = std::move(queue.front());
+            queue.pop_front();
+        }
+        Reply reply;
+        try {
+            reply = render(request);
+        } catch (std::exception const &e) {
+            reply = {std::string("error ") + e.what() + "\n", {}};
+        }
+        request.reply.set_value(std::move(reply));
+    }
+}
+
+RenderServer::Reply RenderServer::render(Request &request) {
+    auto start = clock::now();
+    waited.record(std::chrono::duration<double, std::milli>(start - request.received).count());
+    RenderJob const &job = request.job;
+    Reply reply;
+
+    auto model = cache.get(job.model).get();
+    if (model->number_of_faces() == 0) {
+        reply.header = "error can't load " + job.model + "\n";
+    } else {
+        auto image = render_image(job, *model);
+        const ImageEncoder &encoder = encoder_for(job.output.c_str());
+        if (job.output[0] == '-') {
+            encoder.encode(*image, reply.body);
+            reply.header = "ok " + std::to_string(reply.body.size()) + "\n";
+        } else if (image->write_image_file(job.output.c_str(), encoder)) {
+            reply.header = "ok 0\n";
+        } else {
+            reply.header = "error can't write " + job.output + "\n";
+        }
+    }
+
+    auto end = clock::now();
+    rendered.record(std::chrono::duration<double, std::milli>(end - start).count());
+    total.record(std::chrono::duration<double, std::milli>(end - request.received).count());
+    return reply;
+}
+
+void RenderServer::print_stats(std::ostream &out) const {
+    out << "rejected: " << rejected.load() << " requests\n";
+    waited.print(out, "queue wait");
+    rendered.print(out, "render");
+    total.print(out, "total");
+}
+
+// buffered line reads from a file descriptor
+class LineReader {
+    int fd;
+    std::string buffer;
+    size_t start = 0;
+
+public:
+    explicit LineReader(int fd) : fd(fd) {}
+
+    bool next(std::string &line) {
+        for (;;) {
+            auto end = buffer.find('\n', start);
+            if (end != std::string::npos) {
+                line.assign(buffer, start, end - start);
+                start = end + 1;
+                return true;
+            }
+            buffer.erase(0, start);
+            start = 0;
+            char chunk[4096];
+            ssize_t n = ::read(fd, chunk, sizeof(chunk));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                // a last line without a newline still counts
+                line.swap(buffer);
+                buffer.clear();
+                return !line.empty();
+            }
+            buffer.append(chunk, n);
+        }
+    }
+};
+
+static bool write_all(int fd, const void *data, size_t size) {
+    auto bytes = static_cast<const char *>(data);
+    while (size) {
+        ssize_t n = ::write(fd, bytes, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+void RenderServer::serve(int in_fd, int out_fd) {
+    // replies go out in request order from a writer of their own, so the reader keeps
+    // queueing requests while earlier ones render
+    std::deque<std::future<Reply>> pending;
+    std::mutex pending_mutex;
+    std::condition_variable pending_changed;
+    bool reading = true;
+    std::thread writer([&] {
+        bool open = true;
+        for (;;) {
+            std::future<Reply> next;
+            {
+                std::unique_lock lock(pending_mutex);
+                pending_changed.wait(lock, [&] { return !pending.empty() || !reading; });
+                if (pending.empty()) return;
+                next = std::move(pending.front());
+                pending.pop_front();
+            }
+            Reply reply = next.get();
+            // after a failed write the remaining replies are only drained
+            open = open && write_all(out_fd, reply.header.data(), reply.header.size())
+                        && write_all(out_fd, reply.body.data(), reply.body.size());
+        }
+    });
+    auto send = [&](std::future<Reply> reply) {
+        std::lock_guard lock(pending_mutex);
+        pending.push_back(std::move(reply));
+        pending_changed.notify_one();
+    };
+    auto answer = [&](Reply reply) {
+        std::promise<Reply> ready;
+        ready.set_value(std::move(reply));
+        send(ready.get_future());
+    };
+
+    LineReader lines(in_fd);
+    std::string line;
+    while (lines.next(line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty()) continue;
+        if (line == "stats") {
+            std::ostringstream text;
+            print_stats(text);
+            std::string body = text.str();
+            answer({"stats " + std::to_string(body.size()) + "\n", {body.begin(), body.end()}});
+            continue;
+        }
+        if (line == "shutdown") {
+            request_shutdown();
+            answer({"ok 0\n", {}});
+            break;
+        }
+
+        Request request;
+        std::string error;
+        if (!parse_job(line, request.job, error)) {
+            answer({"error " + error + "\n", {}});
+            continue;
+        }
+        request.received = clock::now();
+        auto reply = request.reply.get_future();
+        bool accepted = false;
+        {
+            std::lock_guard lock(mutex);
+            if (queue.size() < capacity) {
+                queue.push_back(std::move(request));
+                accepted = true;
+            }
+        }
+        if (accepted) {
+            queued.notify_one();
+            send(std::move(reply));
+        } else {
+            rejected++;
+            answer({"error busy\n", {}});
+        }
+    }
+
+    {
+        std::lock_guard lock(pending_mutex);
+        reading = false;
+    }
+    pending_changed.notify_one();
+    writer.join();
+}
+
+void RenderServer::request_shutdown() {
+    int fd = listen_fd.exchange(-1);
+    if (fd >= 0) ::shutdown(fd, SHUT_RDWR);
+    // the other connections read no further requests but still get their replies
+    std::lock_guard lock(connections_mutex);
+    closing = true;
+    for (int connection : connections) ::shutdown(connection, SHUT_RD);
+}
+
+bool RenderServer::listen(const std::string &path) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        std::cerr << "socket path too long: " << path << std::endl;
+        return false;
+    }
+    std::strcpy(address.sun_path, path.c_str());
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    ::unlink(path.c_str());
+    if (fd < 0 || ::bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 || ::listen(fd, 16) < 0) {
+        std::cerr << "can't listen on " << path << ": " << std::strerror(errno) << std::endl;
+        if (fd >= 0) ::close(fd);
+        return false;
+    }
+    listen_fd = fd;
+
+    // a thread per connection, joined once it says it is done at the next accept
+    struct Client {
+        std::thread thread;
+        std::shared_ptr<std::atomic<bool>> done;
+    };
+    std::vector<Client> clients;
+    for (;;) {
+        int client = ::accept(fd, nullptr, nullptr);
+        if (client < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        std::erase_if(clients, [](Client &c) {
+            if (!c.done->load()) return false;
+            c.thread.join();
+            return true;
+        });
+        {
+            std::lock_guard lock(connections_mutex);
+            if (closing) {
+                ::close(client);
+                break;
+            }
+            connections.insert(client);
+        }
+        auto done = std::make_shared<std::atomic<bool>>(false);
+        clients.push_back({std::thread([this, client, done] {
+            serve(client, client);
+            {
+                std::lock_guard lock(connections_mutex);
+                connections.erase(client);
+            }
+            ::close(client);
+            *done = true;
+        }), done});
+    }
+    for (auto &client : clients) client.thread.join();
+    ::close(fd);
+    ::unlink(path.c_str());
+    return true;
+}
@@ -0,0 +1,92 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <ostream>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include "batch.h"
+#include "scheduler.h"
+
+// Counts latencies in power-of-two buckets of microseconds; safe to record from any thread.
+class LatencyHistogram {
+    static constexpr int BUCKETS = 32;
+    std::array<std::atomic<uint64_t>, BUCKETS> buckets{};
+
+public:
+    void record(double ms);
+    [[nodiscard]] uint64_t count() const;
+    // upper bound in ms of the bucket holding the p-th fraction of the samples
+    [[nodiscard]] double percentile(double p) const;
+    void print(std::ostream &out, const char *name) const;
+};
+
+// A long-lived renderer that keeps every model it has loaded resident.
+// A client sends one request per line and gets one reply per request, in request order.
+// A request is a job line as parse_job reads it. Its output is a path the server writes,
+// or "-" / "-.png" / "-.qoi" to get the image back encoded as TGA, PNG or QOI.
+// Replies are "ok <bytes>\n" followed by that many bytes of image (none for a path), or
+// "error <message>\n". "stats" replies with "stats <bytes>\n" and the latency histograms
+// as text, "shutdown" stops a listening server once its connections are done.
+// Requests wait in one bounded queue for the render threads; a request that finds the
+// queue full is answered "error busy" right away instead of piling up latency.
+class RenderServer {
+public:
+    explicit RenderServer(size_t queue_capacity = 64, int renderers = Scheduler::instance().threads());
+    RenderServer(const RenderServer &) = delete;
+    RenderServer &operator=(const RenderServer &) = delete;
+    ~RenderServer();
+
+    // serves one connection until the peer closes its end
+    void serve(int in_fd, int out_fd);
+    // accepts connections on a Unix domain socket until a client sends "shutdown"
+    bool listen(const std::string &path);
+    void print_stats(std::ostream &out) const;
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    struct Reply {
+        std::string header;
+        std::vector<unsigned char> body;
+    };
+    struct Request {
+        RenderJob job;
+        clock::time_point received;
+        std::promise<Reply> reply;
+    };
+
+    ModelCache cache;
+    size_t capacity;
+    std::deque<Request> queue;
+    std::mutex mutex;
+    std::condition_variable queued;
+    bool stopping = false;
+    std::vector<std::thread> renderers;
+
+    // open connections, and whether request_shutdown has closed them for reading; both under
+    // connections_mutex, so a connection accepted during shutdown is either closed by it or
+    // turned away
+    std::mutex connections_mutex;
+    std::set<int> connections;
+    bool closing = false;
+    std::atomic<int> listen_fd{-1};
+
+    LatencyHistogram waited, rendered, total;
+    std::atomic<uint64_t> rejected{0};
+
+    void render_loop();
+    Reply render(Request &request);
+    void request_shutdown();
+};
+
+#endif //SERVER_H
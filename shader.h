@@ -1,6 +1,8 @@
 #ifndef SHADER_H
 #define SHADER_H
 
+#include <algorithm>
+#include <vector>
 #include "model.h"
 #include "vec.h"
 
@@ -10,10 +12,43 @@ static constexpr size_t PHONG_VARYING_UV1 = 1;
 static constexpr size_t PHONG_VARYING_UV2 = 2;
 static constexpr size_t PHONG_VARYING_UV3 = 3;
 
+// the slots every shader has; the ones past them belong to the shader that asks for them
+// with Shader::varyings, so they overlap between shaders
 static constexpr size_t VARYINGS = PHONG_VARYING_UV3 + 1;
 
+// vertex positions in the shadow map, when PhongShader has one
+static constexpr size_t PHONG_VARYING_SHADOW1 = 4;
+static constexpr size_t PHONG_VARYING_SHADOW2 = 5;
+static constexpr size_t PHONG_VARYING_SHADOW3 = 6;
+
+// world positions of the vertices, for LitShader's lights
+static constexpr size_t LIT_VARYING_POSITION1 = 4;
+static constexpr size_t LIT_VARYING_POSITION2 = 5;
+static constexpr size_t LIT_VARYING_POSITION3 = 6;
+
+// the varyings of one face, a view of its slots in a Varyings
 struct VertexData {
-    std::array<Vec3f, VARYINGS> data;
+    Vec3f* data;
+};
+
+// the varyings of every face of a draw, as many slots per face as its shaders use, so draws
+// with shaders that need few of them stay small
+class Varyings {
+    size_t slots = VARYINGS;
+    std::vector<Vec3f> values;
+
+public:
+    Varyings() = default;
+    Varyings(int faces, size_t slots) : slots(slots), values(static_cast<size_t>(faces) * slots) {}
+
+    VertexData operator[](int face) { return {values.data() + static_cast<size_t>(face) * slots}; }
+    // the face's slots for its vertex shader: intensity (1, 1, 1), the rest zero
+    VertexData reset(int face) {
+        Vec3f* data = values.data() + static_cast<size_t>(face) * slots;
+        std::fill(data, data + slots, Vec3f(0, 0, 0));
+        data[VARYING_INTENSITY] = Vec3f(1, 1, 1);
+        return {data};
+    }
 };
 
 struct FragementData {
@@ -21,6 +56,14 @@ struct FragementData {
     bool keep;
 };
 
+// per-draw values shaders read, recorded by CommandBuffer::set_uniforms
+struct Uniforms {
+    Mat4x4f view;
+    Mat4x4f projection;
+    Vec3f camera;
+    Vec3f light;
+};
+
 class Shader {
     public:
     Vec3f lightDirection;
@@ -28,6 +71,11 @@ class Shader {
     Shader();
     virtual ~Shader();
 
+    virtual void set_uniforms(Uniforms const& uniforms);
+
+    // the varying slots per face eval_vertex and eval_fragment use
+    [[nodiscard]] virtual size_t varyings() const { return VARYINGS; }
+
     [[nodiscard]] virtual Vec4f const eval_vertex(Model const& model, int iface, int nth_vert, VertexData& vertex_data) const = 0;
 
     [[nodiscard]] virtual FragementData const eval_fragment(Model const & model, VertexData const& vertex_data,
@@ -37,6 +85,10 @@ class Shader {
 inline Shader::Shader() = default;
 inline Shader::~Shader() {}
 
+inline void Shader::set_uniforms(Uniforms const& uniforms) {
+    lightDirection = uniforms.light;
+}
+
 
 
 #endif //SHADER_H
@@ -46,12 +46,29 @@ ToonShader::~ToonShader() = default;
     };
 }
 
+// in steps of the 8-bit depth
+static constexpr float SHADOW_BIAS = 3;
+
 PhongShader::PhongShader() = default;
 PhongShader::~PhongShader() = default;
 
+void PhongShader::set_uniforms(Uniforms const& uniforms) {
+    Shader::set_uniforms(uniforms);
+    mvp = uniforms.projection * uniforms.view;
+    mvp_inv = mvp.inverse().transpose();
+    cam_pos = uniforms.camera;
+}
+
+size_t PhongShader::varyings() const {
+    return shadow_map ? PHONG_VARYING_SHADOW3 + 1 : VARYINGS;
+}
+
 [[nodiscard]] Vec4f const PhongShader::eval_vertex(Model const & model, int iface, int nth_vert, VertexData & out_vertex_data) const {
     auto uv = model.uv_at(iface, nth_vert);
     out_vertex_data.data[PHONG_VARYING_UV1 + nth_vert] = Vec3f(uv.x, uv.y, 0);
+    if (shadow_map) {
+        out_vertex_data.data[PHONG_VARYING_SHADOW1 + nth_vert] = transform(model.vertex_at(iface, nth_vert), shadow_mvpscr);
+    }
     out_vertex_data.data[VARYING_INTENSITY][nth_vert] = std::max(0.f, model.normal_at(iface, nth_vert).dot(lightDirection)); // get diffuse lighting intensity
     Vec4f gl_Vertex = into_homo(model.vertex_at(iface, nth_vert)); // read the vertex from .obj file
     return gl_Vertex;
@@ -71,9 +88,105 @@ PhongShader::~PhongShader() = default;
     // we assume a directional light with constant intensity 1
 
     float intensity = /* diffuse */std::max(0.f, n.dot(l)) + /*specular*/std::pow(std::max(0.f, n.dot(h)), 50);
+    if (light_map) {
+        TGAColor baked = light_map->get(uv.x * light_map->get_width(), uv.y * light_map->get_height());
+        intensity *= (.3f + .7f * baked.g / 255.f) * baked.r / 255.f;
+    } else if (shadow_map) {
+        Vec3f p = vertex_data.data[PHONG_VARYING_SHADOW1] * v3f.x + vertex_data.data[PHONG_VARYING_SHADOW2] * v3f.y
+                + vertex_data.data[PHONG_VARYING_SHADOW3] * v3f.z;
+        int x = static_cast<int>(p.x), y = static_cast<int>(p.y);
+        // larger depth is closer to the light; the bias keeps surfaces from shadowing themselves
+        if (x >= 0 && y >= 0 && x < shadow_map->get_width() && y < shadow_map->get_height()
+            && shadow_map->at(x, y) > p.z + SHADOW_BIAS) {
+            intensity *= .3f;
+        }
+    }
     return {
         model.diffuse_at(uv) * intensity, true
     };
 }
 
+LitShader::LitShader() = default;
+LitShader::~LitShader() = default;
+
+void LitShader::set_uniforms(Uniforms const& uniforms) {
+    Shader::set_uniforms(uniforms);
+    cam_pos = uniforms.camera;
+}
+
+size_t LitShader::varyings() const {
+    return LIT_VARYING_POSITION3 + 1;
+}
+
+[[nodiscard]] Vec4f const LitShader::eval_vertex(Model const & model, int iface, int nth_vert, VertexData & out_vertex_data) const {
+    auto uv = model.uv_at(iface, nth_vert);
+    out_vertex_data.data[PHONG_VARYING_UV1 + nth_vert] = Vec3f(uv.x, uv.y, 0);
+    out_vertex_data.data[LIT_VARYING_POSITION1 + nth_vert] = model.vertex_at(iface, nth_vert);
+    return into_homo(model.vertex_at(iface, nth_vert));
+}
 
+Vec3f LitShader::shade(Light const& light, Vec3f const& p, Vec3f const& n, Vec3f const& v) const {
+    Vec3f to_light = light.position - p;
+    const float d2 = to_light.dot(to_light);
+    if (d2 >= light.radius * light.radius) return Vec3f(0, 0, 0);
+    const float d = std::sqrt(d2);
+    Vec3f l = to_light * (1 / std::max(d, 1e-6f));
+    // falls off with the square of the distance's share of the radius, to nothing at the radius
+    float falloff = 1 - d2 / (light.radius * light.radius);
+    falloff *= falloff;
+    if (light.cos_outer > -1) {
+        const float c = -l.dot(light.direction);
+        if (c <= light.cos_outer) return Vec3f(0, 0, 0);
+        falloff *= std::min(1.f, (c - light.cos_outer) / std::max(light.cos_inner - light.cos_outer, 1e-6f));
+    }
+    const float diffuse = n.dot(l);
+    if (diffuse <= 0) return Vec3f(0, 0, 0);
+    const float specular = std::pow(std::max(0.f, n.dot((v + l).normalized())), 50);
+    return light.color * (falloff * (diffuse + specular));
+}
+
+template <typename Each>
+FragementData LitShader::lit(Model const& model, VertexData const& vertex_data, Vec3d const& alphabetagamma,
+                             Each const& each) const {
+    auto v3f = Vec3f(alphabetagamma.x, alphabetagamma.y, alphabetagamma.z);
+    Vec2f uv(vertex_data.data[PHONG_VARYING_UV1].x * v3f.x + vertex_data.data[PHONG_VARYING_UV2].x * v3f.y
+             + vertex_data.data[PHONG_VARYING_UV3].x * v3f.z,
+             vertex_data.data[PHONG_VARYING_UV1].y * v3f.x + vertex_data.data[PHONG_VARYING_UV2].y * v3f.y
+             + vertex_data.data[PHONG_VARYING_UV3].y * v3f.z);
+    Vec3f p = vertex_data.data[LIT_VARYING_POSITION1] * v3f.x + vertex_data.data[LIT_VARYING_POSITION2] * v3f.y
+            + vertex_data.data[LIT_VARYING_POSITION3] * v3f.z;
+    Vec3f n = model.normal_at(uv).normalized();
+    Vec3f v = (cam_pos - p).normalized();
+    Vec3f light(ambient, ambient, ambient);
+    each([&](Light const& l) { light += shade(l, p, n, v); });
+    TGAColor diffuse = model.diffuse_at(uv);
+    auto channel = [](unsigned char c, float k) { return static_cast<unsigned char>(std::min(255.f, c * k)); };
+    return {
+        TGAColor(channel(diffuse.r, light.x), channel(diffuse.g, light.y), channel(diffuse.b, light.z)), true
+    };
+}
+
+[[nodiscard]] FragementData const LitShader::eval_fragment(Model const & model, VertexData const& vertex_data,
+                                                           Vec3d const& alphabetagamma) const {
+    return lit(model, vertex_data, alphabetagamma, [&](auto const& add) {
+        if (!lights) return;
+        for (Light const& l : *lights) add(l);
+    });
+}
+
+[[nodiscard]] FragementData const LitShader::eval_fragment(Model const & model, VertexData const& vertex_data,
+                                                           Vec3d const& alphabetagamma,
+                                                           std::span<const int> indices) const {
+    return lit(model, vertex_data, alphabetagamma, [&](auto const& add) {
+        for (int i : indices) add((*lights)[i]);
+    });
+}
+
+std::unique_ptr<Shader> make_shader(ShaderType type) {
+    switch (type) {
+        case GOURAUD_SHADER: return std::make_unique<GouraudShader>();
+        case TOON_SHADER: return std::make_unique<ToonShader>();
+        case PHONG_SHADER: return std::make_unique<PhongShader>();
+    }
+    return nullptr;
+}
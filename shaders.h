@@ -4,6 +4,11 @@
 
 #ifndef SHADERS_H
 #define SHADERS_H
+#include <memory>
+#include <span>
+#include <vector>
+#include "lights.h"
+#include "render_target.h"
 #include "shader.h"
 
 struct GouraudShader : public Shader {
@@ -25,11 +30,53 @@ public:
     Mat4x4f mvp;
     Mat4x4f mvp_inv;
     Vec3f cam_pos;
+    // optional shadow map drawn by draw_depth with shadow_mvpscr, e.g. a light_space_transform
+    DepthTarget const* shadow_map = nullptr;
+    Mat4x4f shadow_mvpscr;
+    // optional ambient occlusion and shadow terms from bake_lighting, in place of shadow_map
+    TGAImage const* light_map = nullptr;
 
     PhongShader();
     ~PhongShader() override;
+    void set_uniforms(Uniforms const& uniforms) override;
+    // the shadow map positions only with a shadow map
+    [[nodiscard]] size_t varyings() const override;
     FragementData const eval_fragment(Model const & model, VertexData const &vertex_data, Vec3d const &alphabetagamma) const override;
     Vec4f const eval_vertex(Model const &model, int iface, int nth_vert, VertexData &vertex_data) const override;
 };
 
+// Lit by point and spot lights in world space, the model's, on top of an ambient term:
+// diffuse and specular from the normal map for every light that reaches the pixel. Without a
+// list it tries every light; draw_lit hands it the lights of the pixel's tile.
+struct LitShader : public Shader {
+public:
+    std::vector<Light> const* lights = nullptr;
+    Vec3f cam_pos;
+    float ambient = .1f;
+
+    LitShader();
+    ~LitShader() override;
+    void set_uniforms(Uniforms const& uniforms) override;
+    [[nodiscard]] size_t varyings() const override;
+    FragementData const eval_fragment(Model const & model, VertexData const &vertex_data, Vec3d const &alphabetagamma) const override;
+    // lit by the lights of the given indices alone
+    FragementData const eval_fragment(Model const & model, VertexData const &vertex_data, Vec3d const &alphabetagamma,
+                                      std::span<const int> indices) const;
+    Vec4f const eval_vertex(Model const &model, int iface, int nth_vert, VertexData &vertex_data) const override;
+
+private:
+    // the fragment lit by the lights each(add) hands to add
+    template <typename Each>
+    FragementData lit(Model const& model, VertexData const& vertex_data, Vec3d const& alphabetagamma,
+                      Each const& each) const;
+    // the light's diffuse and specular at the point, zero past its radius and cone
+    [[nodiscard]] Vec3f shade(Light const& light, Vec3f const& p, Vec3f const& n, Vec3f const& v) const;
+};
+
+enum ShaderType {
+    GOURAUD_SHADER, TOON_SHADER, PHONG_SHADER
+};
+
+std::unique_ptr<Shader> make_shader(ShaderType type);
+
 #endif //SHADERS_H
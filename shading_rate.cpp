@@ -0,0 +1,84 @@
+#include <algorithm>
+#include <cmath>
+#include "shading_rate.h"
+
+// from_pass: tiles whose depth spans more steps than this shade every pixel
+constexpr int DEPTH_SPAN = 4;
+// and the mean squared distance of the normals from their mean above which tiles shade
+// every pixel and 2 x 2 blocks
+constexpr float NORMAL_VARIANCE_FULL = .01f;
+constexpr float NORMAL_VARIANCE_HALF = .002f;
+// the same for the variance of the luma of the pass's color, when given, in steps squared
+constexpr float LUMA_VARIANCE_FULL = 200;
+constexpr float LUMA_VARIANCE_HALF = 50;
+
+ShadingRates::ShadingRates(int tiles_x, int tiles_y, uint8_t rate)
+: tiles_x(tiles_x), tiles_y(tiles_y), rates(static_cast<size_t>(tiles_x) * tiles_y, valid(rate)) {}
+
+ShadingRates ShadingRates::from_image(TGAImage const& image, int tiles_x, int tiles_y) {
+    ShadingRates rates(tiles_x, tiles_y);
+    if (image.get_width() <= 0 || image.get_height() <= 0) return rates;
+    for (int ty = 0; ty < tiles_y; ty++) {
+        for (int tx = 0; tx < tiles_x; tx++) {
+            const int x = static_cast<int>(static_cast<long>(tx) * image.get_width() / tiles_x);
+            const int y = static_cast<int>(static_cast<long>(ty) * image.get_height() / tiles_y);
+            rates.set(tx, ty, image.get(x, y).raw[0]);
+        }
+    }
+    return rates;
+}
+
+ShadingRates ShadingRates::from_pass(DepthTarget const& depth, ColorTarget const& normals, ColorTarget const* color) {
+    constexpr int TEXELS = DepthTarget::TILE_TEXELS;
+    ShadingRates rates(depth.get_tiles_x(), depth.get_tiles_y(), 4);
+    for (size_t tile = 0; tile < rates.rates.size(); tile++) {
+        const uint8_t* z = depth.data() + tile * TEXELS;
+        const uint32_t* n = normals.data() + tile * TEXELS;
+        int covered = 0, z0 = 255, z1 = 0;
+        float sum[3] = {}, squares = 0, luma = 0, luma_squares = 0;
+        for (int i = 0; i < TEXELS; i++) {
+            // nothing was drawn where the depth is still clear
+            if (!z[i]) continue;
+            covered++;
+            z0 = std::min<int>(z0, z[i]);
+            z1 = std::max<int>(z1, z[i]);
+            for (int c = 0; c < 3; c++) {
+                const float v = (n[i] >> 8 * c & 255) / 127.5f - 1;
+                sum[c] += v;
+                squares += v * v;
+            }
+            if (color) {
+                const uint32_t c = color->data()[tile * TEXELS + i];
+                const float y = .114f * (c & 255) + .587f * (c >> 8 & 255) + .299f * (c >> 16 & 255);
+                luma += y;
+                luma_squares += y * y;
+            }
+        }
+        if (!covered) continue;
+        // the mean squared distance from the mean, E[n^2] - E[n]^2
+        const float variance = (squares - (sum[0] * sum[0] + sum[1] * sum[1] + sum[2] * sum[2]) / covered) / covered;
+        const float luma_variance = (luma_squares - luma * luma / covered) / covered;
+        if (z1 - z0 > DEPTH_SPAN || variance > NORMAL_VARIANCE_FULL || luma_variance > LUMA_VARIANCE_FULL) {
+            rates.rates[tile] = 1;
+        } else if (variance > NORMAL_VARIANCE_HALF || luma_variance > LUMA_VARIANCE_HALF) {
+            rates.rates[tile] = 2;
+        }
+    }
+    return rates;
+}
+
+double psnr(ColorTarget const& reference, ColorTarget const& frame) {
+    double error = 0;
+    for (int y = 0; y < reference.get_height(); y++) {
+        for (int x = 0; x < reference.get_width(); x++) {
+            const uint32_t a = reference.at(x, y), b = frame.at(x, y);
+            for (int c = 0; c < 3; c++) {
+                const int d = static_cast<int>(a >> 8 * c & 255) - static_cast<int>(b >> 8 * c & 255);
+                error += d * d;
+            }
+        }
+    }
+    if (error == 0) return INFINITY;
+    const double mse = error / (3.0 * reference.get_width() * reference.get_height());
+    return 10 * std::log10(255 * 255 / mse);
+}
@@ -0,0 +1,50 @@
+#ifndef SHADING_RATE_H
+#define SHADING_RATE_H
+
+#include <cstdint>
+#include <vector>
+#include "render_target.h"
+#include "tgaimage.h"
+
+// The shading rate of every RENDER_TILE x RENDER_TILE tile of a target: 1 runs the fragment
+// shader for every pixel, 2 and 4 once per 2 x 2 and 4 x 4 block of pixels a triangle covers.
+class ShadingRates {
+public:
+    // rates other than 1, 2 and 4 count as the next lower one, and 0 as 1
+    ShadingRates(int tiles_x, int tiles_y, uint8_t rate = 1);
+
+    // the rates of a tiles_x x tiles_y grid from a rate image whose first channel holds them;
+    // an image of another size is stretched over the grid, nearest pixel
+    static ShadingRates from_image(TGAImage const& image, int tiles_x, int tiles_y);
+    // the rates the depth and normals of a previous pass call for, as draw_shaded_rates
+    // writes them: tiles whose depth spans several steps or whose normals vary shade every
+    // pixel, flatter ones 2 x 2 blocks and the flattest, or empty ones, 4 x 4 blocks. With
+    // the pass's color the variance of its luma counts as well, which catches texture detail
+    // the normals don't show
+    static ShadingRates from_pass(DepthTarget const& depth, ColorTarget const& normals,
+                                  ColorTarget const* color = nullptr);
+
+    [[nodiscard]] int get_tiles_x() const { return tiles_x; }
+    [[nodiscard]] int get_tiles_y() const { return tiles_y; }
+    // by the tile's index in a target's texels divided by its TILE_TEXELS
+    [[nodiscard]] uint8_t at_tile(size_t tile) const { return rates[tile]; }
+    [[nodiscard]] uint8_t at(int tx, int ty) const { return rates[static_cast<size_t>(ty) * tiles_x + tx]; }
+    void set(int tx, int ty, uint8_t rate) { rates[static_cast<size_t>(ty) * tiles_x + tx] = valid(rate); }
+    // whether the rates are for the tiles of the target
+    template <typename Target> [[nodiscard]] bool fits(Target const& target) const {
+        return tiles_x == target.get_tiles_x() && tiles_y == target.get_tiles_y();
+    }
+
+private:
+    static uint8_t valid(uint8_t rate) { return rate >= 4 ? 4 : rate >= 2 ? 2 : 1; }
+
+    int tiles_x;
+    int tiles_y;
+    std::vector<uint8_t> rates;
+};
+
+// the peak signal-to-noise ratio of a frame against a reference of the same size, in dB over
+// the color channels; infinite when they are equal
+double psnr(ColorTarget const& reference, ColorTarget const& frame);
+
+#endif //SHADING_RATE_H
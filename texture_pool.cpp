@@ -0,0 +1,125 @@
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include "profiler.h"
+#include "texture_pool.h"
+
+TexturePool::TexturePool() : budget(DEFAULT_BUDGET), resident(0), hits(0), misses(0) {
+}
+
+TexturePool &TexturePool::instance() {
+    // never destroyed, as the references it hands out call back into it when released
+    static TexturePool *pool = new TexturePool;
+    return *pool;
+}
+
+TexturePtr TexturePool::load(const std::string &path) {
+    PROFILE_SCOPE("decode texture");
+    auto img = std::make_shared<TGAImage>();
+    // uncompressed files are viewed in place, so the flip below only changes the row stride
+    bool ok = img->map_tga_file(path.c_str()) || img->read_tga_file(path.c_str());
+    std::cerr << "texture file " << path << " loading " << (ok ? "ok" : "failed") << std::endl;
+    if (!ok) return nullptr;
+    img->flip_vertically();
+    return img;
+}
+
+TexturePtr TexturePool::acquire(const std::string &path) {
+    std::error_code ec;
+    auto stamp = std::filesystem::last_write_time(path, ec);
+    if (ec) {
+        std::cerr << "texture file " << path << " missing" << std::endl;
+        return nullptr;
+    }
+    long long mtime = stamp.time_since_epoch().count();
+
+    std::promise<TexturePtr> promise;
+    {
+        std::unique_lock lock(mutex);
+        auto found = index.find(path);
+        if (found != index.end()) {
+            auto it = found->second;
+            if (it->mtime == mtime) {
+                hits++;
+                lru.splice(lru.begin(), lru, it);
+                auto pending = it->image;
+                lock.unlock();
+                return share(pending.get());
+            }
+            // the file changed on disk, forget the stale decode
+            resident -= it->bytes;
+            lru.erase(it);
+            index.erase(found);
+        }
+        misses++;
+        lru.push_front({path, mtime, 0, promise.get_future().share()});
+        index[path] = lru.begin();
+    }
+
+    TexturePtr img = load(path);
+    promise.set_value(img);
+    {
+        std::lock_guard lock(mutex);
+        auto found = index.find(path);
+        if (found != index.end() && found->second->mtime == mtime) {
+            if (!img) {
+                lru.erase(found->second);
+                index.erase(found);
+            } else {
+                found->second->bytes = static_cast<size_t>(img->get_width()) * img->get_height() * img->get_bytespp();
+                resident += found->second->bytes;
+                evict_locked();
+            }
+        }
+    }
+    return share(std::move(img));
+}
+
+// the pool's image under a reference of its own, whose release drops what the budget no
+// longer has room for now that the image may be unused
+TexturePtr TexturePool::share(TexturePtr image) {
+    if (!image) return nullptr;
+    const TGAImage *raw = image.get();
+    return TexturePtr(raw, [this, image = std::move(image)](const TGAImage *) mutable {
+        image.reset();
+        std::lock_guard lock(mutex);
+        evict_locked();
+    });
+}
+
+void TexturePool::evict_locked() {
+    auto it = lru.end();
+    while (resident > budget && it != lru.begin()) {
+        --it;
+        if (it->image.wait_for(std::chrono::seconds(0)) != std::future_status::ready) continue;
+        // a model still holds it, dropping our reference would free nothing
+        if (it->image.get().use_count() > 1) continue;
+        resident -= it->bytes;
+        index.erase(it->path);
+        it = lru.erase(it);
+    }
+}
+
+void TexturePool::set_budget(size_t bytes) {
+    std::lock_guard lock(mutex);
+    budget = bytes;
+    evict_locked();
+}
+
+TexturePool::Stats TexturePool::stats() const {
+    std::lock_guard lock(mutex);
+    return {lru.size(), resident, budget, hits, misses};
+}
+
+void TexturePool::clear() {
+    std::lock_guard lock(mutex);
+    for (auto it = lru.begin(); it != lru.end();) {
+        if (it->image.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            ++it;
+            continue;
+        }
+        resident -= it->bytes;
+        index.erase(it->path);
+        it = lru.erase(it);
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef TEXTURE_POOL_H
+#define TEXTURE_POOL_H
+
+#include <cstddef>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "tgaimage.h"
+
+using TexturePtr = std::shared_ptr<const TGAImage>;
+
+// Process-wide cache of decoded textures, keyed by path and modification time.
+// Images are stored flipped to a bottom-left origin, the way Model samples them.
+// Entries still referenced by a model are never evicted; the rest are dropped
+// least recently used first once the resident size exceeds the budget, checked
+// whenever a load finishes and whenever a model lets go of a texture. Failed
+// loads are not kept, so the next acquire tries the file again.
+class TexturePool {
+    struct Entry {
+        std::string path;
+        long long mtime;
+        size_t bytes;
+        std::shared_future<TexturePtr> image;
+    };
+
+    std::list<Entry> lru; // front is the most recently used
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    size_t budget;
+    size_t resident;
+    size_t hits;
+    size_t misses;
+    mutable std::mutex mutex;
+
+    TexturePool();
+    void evict_locked();
+    TexturePtr share(TexturePtr image);
+    static TexturePtr load(const std::string &path);
+
+public:
+    static constexpr size_t DEFAULT_BUDGET = size_t(256) << 20;
+
+    struct Stats {
+        size_t entries;
+        size_t resident_bytes;
+        size_t budget_bytes;
+        size_t hits;
+        size_t misses;
+    };
+
+    TexturePool(const TexturePool &) = delete;
+    TexturePool &operator=(const TexturePool &) = delete;
+
+    static TexturePool &instance();
+
+    // Returns the decoded image, or nullptr if the file does not exist or fails to decode.
+    // Concurrent requests for the same file wait for a single decode.
+    TexturePtr acquire(const std::string &path);
+    void set_budget(size_t bytes);
+    [[nodiscard]] Stats stats() const;
+    void clear();
+};
+
+#endif //TEXTURE_POOL_H
@@ -1,87 +1,300 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
 #include <iostream>
+#include <new>
 #include <fstream>
 #include <string.h>
 #include <time.h>
 #include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 #include "tgaimage.h"
+#include "image_codec.h"
+#include "profiler.h"
+#include "image_kernels.h"
+#include "scheduler.h"
 
-TGAImage::TGAImage() : data(NULL), width(0), height(0), bytespp(0) {
+static std::atomic<bool> huge_pages(false);
+
+// pixel storage starts on a cache line; large buffers may ask for transparent huge pages
+static unsigned char *alloc_pixels(size_t nbytes) {
+	const size_t huge_page = size_t(2)<<20;
+	size_t align = huge_pages && nbytes>=huge_page ? huge_page : 64;
+	size_t rounded = (nbytes+align-1)/align*align;
+	void *p = aligned_alloc(align, rounded ? rounded : align);
+	if (!p) throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+	if (align==huge_page) madvise(p, rounded, MADV_HUGEPAGE);
+#endif
+	return (unsigned char *)p;
+}
+
+static void free_pixels(unsigned char *p) {
+	free(p);
+}
+
+void TGAImage::use_huge_pages(bool enable) {
+	huge_pages = enable;
+}
+
+TGAImage::TGAImage() : data(NULL), width(0), height(0), bytespp(0), origin(NULL), stride(0), mapping(NULL), mapping_size(0) {
 }
 
-TGAImage::TGAImage(int w, int h, int bpp) : data(NULL), width(w), height(h), bytespp(bpp) {
+TGAImage::TGAImage(int w, int h, int bpp) : data(NULL), width(w), height(h), bytespp(bpp), origin(NULL), stride(0), mapping(NULL), mapping_size(0) {
 	unsigned long nbytes = width*height*bytespp;
-	data = new unsigned char[nbytes];
+	data = alloc_pixels(nbytes);
 	memset(data, 0, nbytes);
+	reset_layout();
 }
 
-TGAImage::TGAImage(const TGAImage &img) {
+TGAImage::TGAImage(const TGAImage &img) : data(NULL), origin(NULL), stride(0), mapping(NULL), mapping_size(0) {
 	width = img.width;
 	height = img.height;
 	bytespp = img.bytespp;
 	unsigned long nbytes = width*height*bytespp;
-	data = new unsigned char[nbytes];
-	memcpy(data, img.data, nbytes);
+	data = alloc_pixels(nbytes);
+	unsigned long bytes_per_line = width*bytespp;
+	for (int j=0; img.origin && j<height; j++) {
+		memcpy(data+j*bytes_per_line, img.row(j), bytes_per_line);
+	}
+	reset_layout();
+}
+
+TGAImage::TGAImage(TGAImage &&img) noexcept : data(img.data), width(img.width), height(img.height), bytespp(img.bytespp),
+	origin(img.origin), stride(img.stride), mapping(img.mapping), mapping_size(img.mapping_size) {
+	img.data = NULL;
+	img.origin = NULL;
+	img.mapping = NULL;
+	img.mapping_size = 0;
+	img.width = img.height = img.bytespp = 0;
+	img.stride = 0;
 }
 
 TGAImage::~TGAImage() {
-	if (data) delete [] data;
+	if (data) free_pixels(data);
+	unmap();
 }
 
 TGAImage & TGAImage::operator =(const TGAImage &img) {
 	if (this != &img) {
-		if (data) delete [] data;
+		if (data) free_pixels(data);
+		unmap();
 		width  = img.width;
 		height = img.height;
 		bytespp = img.bytespp;
 		unsigned long nbytes = width*height*bytespp;
-		data = new unsigned char[nbytes];
-		memcpy(data, img.data, nbytes);
+		data = alloc_pixels(nbytes);
+		unsigned long bytes_per_line = width*bytespp;
+		for (int j=0; img.origin && j<height; j++) {
+			memcpy(data+j*bytes_per_line, img.row(j), bytes_per_line);
+		}
+		reset_layout();
 	}
 	return *this;
 }
 
-bool TGAImage::read_tga_file(const char *filename) {
-	if (data) delete [] data;
+TGAImage & TGAImage::operator =(TGAImage &&img) noexcept {
+	if (this != &img) {
+		if (data) free_pixels(data);
+		unmap();
+		data = img.data;
+		width = img.width;
+		height = img.height;
+		bytespp = img.bytespp;
+		origin = img.origin;
+		stride = img.stride;
+		mapping = img.mapping;
+		mapping_size = img.mapping_size;
+		img.data = NULL;
+		img.origin = NULL;
+		img.mapping = NULL;
+		img.mapping_size = 0;
+		img.width = img.height = img.bytespp = 0;
+		img.stride = 0;
+	}
+	return *this;
+}
+
+void TGAImage::reset_layout() {
+	origin = data;
+	stride = (long)width*bytespp;
+}
+
+void TGAImage::unmap() {
+#if defined(__unix__) || defined(__APPLE__)
+	if (mapping) munmap(mapping, mapping_size);
+#endif
+	mapping = NULL;
+	mapping_size = 0;
+}
+
+// turns a mapped view into an owned top-down copy before it gets modified
+bool TGAImage::detach() {
+	if (!mapping) return data!=NULL;
+	unsigned long bytes_per_line = width*bytespp;
+	unsigned char *copy = alloc_pixels(bytes_per_line*height);
+	for (int j=0; j<height; j++) {
+		memcpy(copy+j*bytes_per_line, row(j), bytes_per_line);
+	}
+	unmap();
+	data = copy;
+	reset_layout();
+	return true;
+}
+
+bool TGAImage::map_tga_file(const char *filename) {
+#if defined(__unix__) || defined(__APPLE__)
+	int fd = open(filename, O_RDONLY);
+	if (fd<0) {
+		std::cerr << "can't open file " << filename << "\n";
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st)<0 || st.st_size<(off_t)sizeof(TGA_Header)) {
+		close(fd);
+		return false;
+	}
+	void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (addr==MAP_FAILED) return false;
+	TGA_Header header;
+	memcpy(&header, addr, sizeof(header));
+	int bpp = header.bitsperpixel>>3;
+	size_t offset = sizeof(header) + (unsigned char)header.idlength;
+	unsigned long nbytes = (unsigned long)bpp*header.width*header.height;
+	// only uncompressed images can be used in place, the caller falls back to read_tga_file
+	if ((2!=header.datatypecode && 3!=header.datatypecode) || header.width<=0 || header.height<=0 ||
+		(bpp!=GRAYSCALE && bpp!=RGB && bpp!=RGBA) || offset+nbytes>(size_t)st.st_size) {
+		munmap(addr, st.st_size);
+		return false;
+	}
+	if (data) free_pixels(data);
 	data = NULL;
+	unmap();
+	mapping = addr;
+	mapping_size = st.st_size;
+	width   = header.width;
+	height  = header.height;
+	bytespp = bpp;
+	origin  = (const unsigned char *)addr + offset;
+	stride  = (long)width*bytespp;
+	if (!(header.imagedescriptor & 0x20)) {
+		flip_vertically();
+	}
+	if (header.imagedescriptor & 0x10) {
+		flip_horizontally();
+	}
+	std::cerr << width << "x" << height << "/" << bytespp*8 << " mapped\n";
+	return true;
+#else
+	return false;
+#endif
+}
+
+static bool read_contents(const char *filename, std::vector<unsigned char> &contents) {
 	std::ifstream in;
-	in.open (filename, std::ios::binary);
+	in.open (filename, std::ios::binary | std::ios::ate);
 	if (!in.is_open()) {
 		std::cerr << "can't open file " << filename << "\n";
 		in.close();
 		return false;
 	}
-	TGA_Header header;
-	in.read((char *)&header, sizeof(header));
+	std::streamsize size = in.tellg();
+	contents.resize(size>0 ? size : 0);
+	in.seekg(0);
+	in.read((char *)contents.data(), contents.size());
 	if (!in.good()) {
 		in.close();
+		std::cerr << "an error occured while reading the file\n";
+		return false;
+	}
+	in.close();
+	return true;
+}
+
+static bool write_contents(const char *filename, const std::vector<unsigned char> &contents) {
+	std::ofstream out;
+	out.open (filename, std::ios::binary);
+	if (!out.is_open()) {
+		std::cerr << "can't open file " << filename << "\n";
+		out.close();
+		return false;
+	}
+	out.write((char *)contents.data(), contents.size());
+	if (!out.good()) {
+		std::cerr << "can't dump the image file\n";
+		out.close();
+		return false;
+	}
+	out.close();
+	return true;
+}
+
+bool TGAImage::read_tga_file(const char *filename) {
+	if (data) free_pixels(data);
+	data = NULL;
+	unmap();
+	reset_layout();
+	std::vector<unsigned char> contents;
+	if (!read_contents(filename, contents)) return false;
+	return decode_tga(contents.data(), contents.size());
+}
+
+bool TGAImage::read_image_file(const char *filename) {
+	std::vector<unsigned char> contents;
+	if (!read_contents(filename, contents)) return false;
+	if (contents.size()>=4 && !memcmp(contents.data(), "qoif", 4)) {
+		return decode_qoi(contents.data(), contents.size(), *this);
+	}
+	if (data) free_pixels(data);
+	data = NULL;
+	unmap();
+	reset_layout();
+	return decode_tga(contents.data(), contents.size());
+}
+
+bool TGAImage::decode_tga(const unsigned char *in, size_t size) {
+	TGA_Header header;
+	if (size<sizeof(header)) {
 		std::cerr << "an error occured while reading the header\n";
 		return false;
 	}
+	memcpy(&header, in, sizeof(header));
 	width   = header.width;
 	height  = header.height;
 	bytespp = header.bitsperpixel>>3;
 	if (width<=0 || height<=0 || (bytespp!=GRAYSCALE && bytespp!=RGB && bytespp!=RGBA)) {
-		in.close();
 		std::cerr << "bad bpp (or width/height) value\n";
 		return false;
 	}
+	size_t offset = sizeof(header) + (unsigned char)header.idlength;
+	if (offset>size) {
+		std::cerr << "an error occured while reading the header\n";
+		return false;
+	}
 	unsigned long nbytes = bytespp*width*height;
-	data = new unsigned char[nbytes];
+	data = alloc_pixels(nbytes);
+	reset_layout();
 	if (3==header.datatypecode || 2==header.datatypecode) {
-		in.read((char *)data, nbytes);
-		if (!in.good()) {
-			in.close();
+		if (size-offset<nbytes) {
 			std::cerr << "an error occured while reading the data\n";
 			return false;
 		}
+		memcpy(data, in+offset, nbytes);
 	} else if (10==header.datatypecode||11==header.datatypecode) {
-		if (!load_rle_data(in)) {
-			in.close();
+		if (!load_rle_data(in+offset, size-offset)) {
 			std::cerr << "an error occured while reading the data\n";
 			return false;
 		}
 	} else {
-		in.close();
 		std::cerr << "unknown file format " << (int)header.datatypecode << "\n";
 		return false;
 	}
@@ -92,70 +305,84 @@ bool TGAImage::read_tga_file(const char *filename) {
 		flip_horizontally();
 	}
 	std::cerr << width << "x" << height << "/" << bytespp*8 << "\n";
-	in.close();
 	return true;
 }
 
-bool TGAImage::load_rle_data(std::ifstream &in) {
-	unsigned long pixelcount = width*height;
-	unsigned long currentpixel = 0;
-	unsigned long currentbyte  = 0;
-	TGAColor colorbuffer;
-	do {
-		unsigned char chunkheader = 0;
-		chunkheader = in.get();
-		if (!in.good()) {
+// replicates the pixel at dst over count pixels, doubling the copied span each step
+static void fill_pixels(unsigned char *dst, int bytespp, unsigned long count) {
+	if (1==bytespp) {
+		memset(dst+1, dst[0], count-1);
+		return;
+	}
+	unsigned long total = count*bytespp;
+	unsigned long done = bytespp;
+	while (done<total) {
+		unsigned long n = done<total-done ? done : total-done;
+		memcpy(dst+done, dst, n);
+		done += n;
+	}
+}
+
+bool TGAImage::load_rle_data(const unsigned char *in, size_t size) {
+	unsigned long nbytes = width*height*bytespp;
+	unsigned long currentbyte = 0;
+	size_t pos = 0;
+	while (currentbyte<nbytes) {
+		if (pos>=size) {
 			std::cerr << "an error occured while reading the data\n";
 			return false;
 		}
-		if (chunkheader<128) {
-			chunkheader++;
-			for (int i=0; i<chunkheader; i++) {
-				in.read((char *)colorbuffer.raw, bytespp);
-				if (!in.good()) {
-					std::cerr << "an error occured while reading the header\n";
-					return false;
-				}
-				for (int t=0; t<bytespp; t++)
-					data[currentbyte++] = colorbuffer.raw[t];
-				currentpixel++;
-				if (currentpixel>pixelcount) {
-					std::cerr << "Too many pixels read\n";
-					return false;
-				}
-			}
-		} else {
-			chunkheader -= 127;
-			in.read((char *)colorbuffer.raw, bytespp);
-			if (!in.good()) {
-				std::cerr << "an error occured while reading the header\n";
-				return false;
-			}
-			for (int i=0; i<chunkheader; i++) {
-				for (int t=0; t<bytespp; t++)
-					data[currentbyte++] = colorbuffer.raw[t];
-				currentpixel++;
-				if (currentpixel>pixelcount) {
-					std::cerr << "Too many pixels read\n";
-					return false;
-				}
-			}
+		unsigned char chunkheader = in[pos++];
+		unsigned long count = (chunkheader & 0x7f) + 1;
+		unsigned long chunkbytes = count*bytespp;
+		if (currentbyte+chunkbytes>nbytes) {
+			std::cerr << "Too many pixels read\n";
+			return false;
+		}
+		unsigned long packetbytes = chunkheader<128 ? chunkbytes : bytespp;
+		if (size-pos<packetbytes) {
+			std::cerr << "an error occured while reading the header\n";
+			return false;
+		}
+		memcpy(data+currentbyte, in+pos, packetbytes);
+		if (chunkheader>=128) {
+			fill_pixels(data+currentbyte, bytespp, count);
 		}
-	} while (currentpixel < pixelcount);
+		pos += packetbytes;
+		currentbyte += chunkbytes;
+	}
 	return true;
 }
 
 bool TGAImage::write_tga_file(const char *filename, bool rle) {
-	unsigned char developer_area_ref[4] = {0, 0, 0, 0};
-	unsigned char extension_area_ref[4] = {0, 0, 0, 0};
-	unsigned char footer[18] = {'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0'};
-	std::ofstream out;
-	out.open (filename, std::ios::binary);
-	if (!out.is_open()) {
-		std::cerr << "can't open file " << filename << "\n";
-		out.close();
-		return false;
+	PROFILE_SCOPE("write image");
+	std::vector<unsigned char> contents;
+	encode_tga(contents, rle);
+	return write_contents(filename, contents);
+}
+
+bool TGAImage::write_image_file(const char *filename, const ImageEncoder &encoder) const {
+	PROFILE_SCOPE("write image");
+	std::vector<unsigned char> contents;
+	encoder.encode(*this, contents);
+	return write_contents(filename, contents);
+}
+
+// rows per independently compressed band; fixed so the output does not depend on the thread count
+static int rle_band_rows(int width) {
+	int rows = (1<<16)/(width>0 ? width : 1);
+	return rows>0 ? rows : 1;
+}
+
+void TGAImage::encode_tga(std::vector<unsigned char> &out, bool rle) const {
+	if (mapping) {
+		TGAImage copy(*this);
+		copy.encode_tga(out, rle);
+		return;
 	}
+	const unsigned char developer_area_ref[4] = {0, 0, 0, 0};
+	const unsigned char extension_area_ref[4] = {0, 0, 0, 0};
+	const unsigned char footer[18] = {'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0'};
 	TGA_Header header;
 	memset((void *)&header, 0, sizeof(header));
 	header.bitsperpixel = bytespp<<3;
@@ -163,100 +390,108 @@ bool TGAImage::write_tga_file(const char *filename, bool rle) {
 	header.height = height;
 	header.datatypecode = (bytespp==GRAYSCALE?(rle?11:3):(rle?10:2));
 	header.imagedescriptor = 0x20; // top-left origin
-	out.write((char *)&header, sizeof(header));
-	if (!out.good()) {
-		out.close();
-		std::cerr << "can't dump the tga file\n";
-		return false;
-	}
+
+	unsigned long nbytes = width*height*bytespp;
+	out.resize(sizeof(header));
+	memcpy(out.data(), &header, sizeof(header));
 	if (!rle) {
-		out.write((char *)data, width*height*bytespp);
-		if (!out.good()) {
-			std::cerr << "can't unload raw data\n";
-			out.close();
-			return false;
-		}
+		out.insert(out.end(), data, data+nbytes);
 	} else {
-		if (!unload_rle_data(out)) {
-			out.close();
-			std::cerr << "can't unload rle data\n";
-			return false;
-		}
+		int band_rows = rle_band_rows(width);
+		int nbands = (height+band_rows-1)/band_rows;
+		std::vector<std::vector<unsigned char>> bands(nbands);
+		Scheduler::instance().parallel_for(0, nbands, 1, [&](int first, int last) {
+			for (int i=first; i<last; i++) {
+				int y0 = i*band_rows;
+				int y1 = std::min(height, y0+band_rows);
+				unsigned long npixels = (unsigned long)width*(y1-y0);
+				// a packet never costs more than one header byte per pixel it covers
+				bands[i].resize(npixels*(bytespp+1));
+				bands[i].resize(unload_rle_data(bands[i].data(), y0, y1));
+			}
+		});
+		size_t total = out.size();
+		for (auto const &band : bands) total += band.size();
+		out.reserve(total + sizeof(developer_area_ref) + sizeof(extension_area_ref) + sizeof(footer));
+		for (auto const &band : bands) out.insert(out.end(), band.begin(), band.end());
 	}
-	out.write((char *)developer_area_ref, sizeof(developer_area_ref));
-	if (!out.good()) {
-		std::cerr << "can't dump the tga file\n";
-		out.close();
-		return false;
+	out.insert(out.end(), developer_area_ref, developer_area_ref+sizeof(developer_area_ref));
+	out.insert(out.end(), extension_area_ref, extension_area_ref+sizeof(extension_area_ref));
+	out.insert(out.end(), footer, footer+sizeof(footer));
+}
+
+// number of leading bytes for which a and b agree, at most n
+static unsigned long equal_prefix(const unsigned char *a, const unsigned char *b, unsigned long n) {
+	unsigned long i = 0;
+#ifdef __SSE2__
+	for (; i+16<=n; i+=16) {
+		__m128i va = _mm_loadu_si128((const __m128i *)(a+i));
+		__m128i vb = _mm_loadu_si128((const __m128i *)(b+i));
+		unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) ^ 0xffffu;
+		if (mask) return i + __builtin_ctz(mask);
 	}
-	out.write((char *)extension_area_ref, sizeof(extension_area_ref));
-	if (!out.good()) {
-		std::cerr << "can't dump the tga file\n";
-		out.close();
-		return false;
+#endif
+	while (i<n && a[i]==b[i]) i++;
+	return i;
+}
+
+static bool same_pixel(const unsigned char *a, const unsigned char *b, int bytespp) {
+	if (4==bytespp) {
+		unsigned int va, vb;
+		memcpy(&va, a, 4);
+		memcpy(&vb, b, 4);
+		return va==vb;
 	}
-	out.write((char *)footer, sizeof(footer));
-	if (!out.good()) {
-		std::cerr << "can't dump the tga file\n";
-		out.close();
-		return false;
+	for (int t=0; t<bytespp; t++) {
+		if (a[t]!=b[t]) return false;
 	}
-	out.close();
 	return true;
 }
 
+// compresses rows [y0, y1) into out, returns the number of bytes written
 // TODO: it is not necessary to break a raw chunk for two equal pixels (for the matter of the resulting size)
-bool TGAImage::unload_rle_data(std::ofstream &out) {
-	const unsigned char max_chunk_length = 128;
-	unsigned long npixels = width*height;
+size_t TGAImage::unload_rle_data(unsigned char *out, int y0, int y1) const {
+	const unsigned long max_chunk_length = 128;
+	const unsigned char *pixels = data + (unsigned long)y0*width*bytespp;
+	unsigned long npixels = (unsigned long)width*(y1-y0);
 	unsigned long curpix = 0;
+	unsigned char *dst = out;
 	while (curpix<npixels) {
-		unsigned long chunkstart = curpix*bytespp;
-		unsigned long curbyte = curpix*bytespp;
-		unsigned char run_length = 1;
-		bool raw = true;
-		while (curpix+run_length<npixels && run_length<max_chunk_length) {
-			bool succ_eq = true;
-			for (int t=0; succ_eq && t<bytespp; t++) {
-				succ_eq = (data[curbyte+t]==data[curbyte+t+bytespp]);
-			}
-			curbyte += bytespp;
-			if (1==run_length) {
-				raw = !succ_eq;
-			}
-			if (raw && succ_eq) {
-				run_length--;
-				break;
-			}
-			if (!raw && !succ_eq) {
-				break;
+		const unsigned char *chunk = pixels + curpix*bytespp;
+		unsigned long limit = std::min(max_chunk_length, npixels-curpix);
+		unsigned long run_length = 1;
+		bool raw = limit<2 || !same_pixel(chunk, chunk+bytespp, bytespp);
+		if (raw) {
+			while (run_length<limit) {
+				const unsigned char *p = chunk + run_length*bytespp;
+				if (same_pixel(p-bytespp, p, bytespp)) {
+					run_length--;
+					break;
+				}
+				run_length++;
 			}
-			run_length++;
+		} else {
+			// pixels curpix..curpix+k are equal iff the chunk matches itself shifted by one pixel over k pixels
+			run_length += equal_prefix(chunk, chunk+bytespp, (limit-1)*bytespp)/bytespp;
 		}
 		curpix += run_length;
-		out.put(raw?run_length-1:run_length+127);
-		if (!out.good()) {
-			std::cerr << "can't dump the tga file\n";
-			return false;
-		}
-		out.write((char *)(data+chunkstart), (raw?run_length*bytespp:bytespp));
-		if (!out.good()) {
-			std::cerr << "can't dump the tga file\n";
-			return false;
-		}
+		*dst++ = raw ? run_length-1 : run_length+127;
+		unsigned long nbytes = raw ? run_length*bytespp : bytespp;
+		memcpy(dst, chunk, nbytes);
+		dst += nbytes;
 	}
-	return true;
+	return dst-out;
 }
 
 TGAColor TGAImage::get(int x, int y) const {
-	if (!data || x<0 || y<0 || x>=width || y>=height) {
+	if (!origin || x<0 || y<0 || x>=width || y>=height) {
 		return TGAColor();
 	}
-	return TGAColor(data+(x+y*width)*bytespp, bytespp);
+	return TGAColor(origin+y*stride+x*bytespp, bytespp);
 }
 
 bool TGAImage::set(int x, int y, TGAColor c) {
-	if (!data || x<0 || y<0 || x>=width || y>=height) {
+	if (x<0 || y<0 || x>=width || y>=height || !detach()) {
 		return false;
 	}
 	memcpy(data+(x+y*width)*bytespp, c.raw, bytespp);
@@ -275,47 +510,102 @@ int TGAImage::get_height() const {
 	return height;
 }
 
+bool TGAImage::is_mapped() const {
+	return mapping!=NULL;
+}
+
+const unsigned char *TGAImage::row(int y) const {
+	return origin+y*stride;
+}
+
 bool TGAImage::flip_horizontally() {
-	if (!data) return false;
-	int half = width>>1;
-	for (int i=0; i<half; i++) {
-		for (int j=0; j<height; j++) {
-			TGAColor c1 = get(i, j);
-			TGAColor c2 = get(width-1-i, j);
-			set(i, j, c2);
-			set(width-1-i, j, c1);
+	if (!detach()) return false;
+	unsigned long bytes_per_line = width*bytespp;
+	Scheduler::instance().parallel_for(0, height, 64, [&](int first, int last) {
+		for (int j=first; j<last; j++) {
+			reverse_pixels(data+j*bytes_per_line, width, bytespp);
 		}
-	}
+	});
 	return true;
 }
 
 bool TGAImage::flip_vertically() {
+	if (mapping) {
+		// a view flips by walking its rows the other way
+		origin += (height-1)*stride;
+		stride = -stride;
+		return true;
+	}
 	if (!data) return false;
 	unsigned long bytes_per_line = width*bytespp;
-	unsigned char *line = new unsigned char[bytes_per_line];
 	int half = height>>1;
-	for (int j=0; j<half; j++) {
-		unsigned long l1 = j*bytes_per_line;
-		unsigned long l2 = (height-1-j)*bytes_per_line;
-		memmove((void *)line,      (void *)(data+l1), bytes_per_line);
-		memmove((void *)(data+l1), (void *)(data+l2), bytes_per_line);
-		memmove((void *)(data+l2), (void *)line,      bytes_per_line);
-	}
-	delete [] line;
+	Scheduler::instance().parallel_for(0, half, 64, [&](int first, int last) {
+		for (int j=first; j<last; j++) {
+			swap_rows(data+j*bytes_per_line, data+(height-1-j)*bytes_per_line, bytes_per_line);
+		}
+	});
+	return true;
+}
+
+bool TGAImage::swap_red_blue() {
+	if (bytespp<RGB || !detach()) return false;
+	unsigned long bytes_per_line = width*bytespp;
+	Scheduler::instance().parallel_for(0, height, 64, [&](int first, int last) {
+		for (int j=first; j<last; j++) {
+			::swap_red_blue(data+j*bytes_per_line, width, bytespp);
+		}
+	});
+	return true;
+}
+
+bool TGAImage::convert(Format format) {
+	if (!origin) return false;
+	if (format==bytespp) return true;
+	unsigned char *tdata = alloc_pixels(width*height*format);
+	Scheduler::instance().parallel_for(0, height, 64, [&](int first, int last) {
+		for (int j=first; j<last; j++) {
+			convert_pixels(row(j), bytespp, tdata+j*width*format, format, width);
+		}
+	});
+	if (data) free_pixels(data);
+	unmap();
+	data = tdata;
+	bytespp = format;
+	reset_layout();
+	return true;
+}
+
+bool TGAImage::resize(int w, int h, Filter filter) {
+	if (NEAREST==filter) return scale(w, h);
+	if (w<=0 || h<=0 || !origin) return false;
+	unsigned char *tdata = alloc_pixels(w*h*bytespp);
+	if (BOX==filter) {
+		resize_box(origin, stride, width, height, tdata, (long)w*bytespp, w, h, bytespp);
+	} else {
+		resize_bilinear(origin, stride, width, height, tdata, (long)w*bytespp, w, h, bytespp);
+	}
+	if (data) free_pixels(data);
+	unmap();
+	data = tdata;
+	width = w;
+	height = h;
+	reset_layout();
 	return true;
 }
 
 unsigned char *TGAImage::buffer() {
+	detach();
 	return data;
 }
 
 void TGAImage::clear() {
+	if (!detach()) return;
 	memset((void *)data, 0, width*height*bytespp);
 }
 
 bool TGAImage::scale(int w, int h) {
-	if (w<=0 || h<=0 || !data) return false;
-	unsigned char *tdata = new unsigned char[w*h*bytespp];
+	if (w<=0 || h<=0 || !detach()) return false;
+	unsigned char *tdata = alloc_pixels(w*h*bytespp);
 	int nscanline = 0;
 	int oscanline = 0;
 	int erry = 0;
@@ -343,10 +633,11 @@ bool TGAImage::scale(int w, int h) {
 			nscanline += nlinebytes;
 		}
 	}
-	delete [] data;
+	free_pixels(data);
 	data = tdata;
 	width = w;
 	height = h;
+	reset_layout();
 	return true;
 }
 
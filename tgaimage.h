@@ -1,7 +1,9 @@
 #ifndef __IMAGE_H__
 #define __IMAGE_H__
 
+#include <cstddef>
 #include <fstream>
+#include <vector>
 
 #pragma pack(push,1)
 struct TGA_Header {
@@ -72,35 +74,63 @@ struct TGAColor {
 };
 
 
+class ImageEncoder;
+
 class TGAImage {
+	friend class TgaEncoder;
 protected:
-	unsigned char* data;
+	unsigned char* data; // owned pixels, NULL while the image is a mapped view
 	int width;
 	int height;
 	int bytespp;
-
-	bool   load_rle_data(std::ifstream &in);
-	bool unload_rle_data(std::ofstream &out);
+	const unsigned char* origin; // first row
+	long stride; // bytes from one row to the next, negative for views stored bottom-up
+	void* mapping;
+	size_t mapping_size;
+
+	void reset_layout();
+	bool detach();
+	void unmap();
+	bool   load_rle_data(const unsigned char *in, size_t size);
+	size_t unload_rle_data(unsigned char *out, int y0, int y1) const;
+	bool decode_tga(const unsigned char *in, size_t size);
+	void encode_tga(std::vector<unsigned char> &out, bool rle) const;
 public:
 	enum Format {
 		GRAYSCALE=1, RGB=3, RGBA=4
 	};
+	enum Filter {
+		NEAREST, BOX, BILINEAR
+	};
 
 	TGAImage();
 	TGAImage(int w, int h, int bpp);
 	TGAImage(const TGAImage &img);
+	TGAImage(TGAImage &&img) noexcept;
 	bool read_tga_file(const char *filename);
+	bool map_tga_file(const char *filename);
 	bool write_tga_file(const char *filename, bool rle=true);
+	// reads TGA or QOI, whichever the file contains
+	bool read_image_file(const char *filename);
+	bool write_image_file(const char *filename, const ImageEncoder &encoder) const;
 	bool flip_horizontally();
 	bool flip_vertically();
 	bool scale(int w, int h);
+	bool resize(int w, int h, Filter filter);
+	bool convert(Format format);
+	bool swap_red_blue();
 	TGAColor get(int x, int y) const;
 	bool set(int x, int y, TGAColor c);
 	~TGAImage();
 	TGAImage & operator =(const TGAImage &img);
+	TGAImage & operator =(TGAImage &&img) noexcept;
+	// back new pixel buffers of 2 MiB and more with transparent huge pages where available
+	static void use_huge_pages(bool enable);
 	[[nodiscard]] int get_width() const;
 	[[nodiscard]] int get_height() const;
 	[[nodiscard]] int get_bytespp() const;
+	[[nodiscard]] bool is_mapped() const;
+	[[nodiscard]] const unsigned char *row(int y) const;
 	unsigned char *buffer();
 	void clear();
 };
@@ -24,6 +24,17 @@ inline Mat4x4f model_transform() {
     return Mat4x4f::identity<4>();
 }
 
+// scales by scale, turns by yaw radians about y, then moves to position
+inline Mat4x4f model_transform(Vec3f const& position, float yaw, float scale) {
+    const float c = std::cos(yaw) * scale, s = std::sin(yaw) * scale;
+    return Mat4x4f({{
+        {    c,      0,      s, position.x},
+        {    0,  scale,      0, position.y},
+        {   -s,      0,      c, position.z},
+        {    0,      0,      0,          1}
+    }});
+}
+
 inline Mat4x4f view_transform(Vec3f const& target, Vec3f const& where, Vec3f const& up) {
     //       ^ y
     //       |
@@ -82,4 +93,29 @@ inline Vec3f transform(const Vec4f& v, const Mat4x4f& matrix) {
     return from_homo(from_column(matrix * v.column_into()));
 }
 
+// Takes world space to the pixels and depth of a width x height target seen from where
+// looking at target, with the usual projection. The 8-bit depth spans the distances
+// [z_near, z_far] in front of the camera, closer is larger; viewport_transform's depth
+// would leave that range for anything more than a unit away.
+inline Mat4x4f camera_transform(Vec3f const& where, Vec3f const& target, Vec3f const& up, int width, int height,
+                                float z_near, float z_far) {
+    const Mat4x4f perspective = perspective_transform(-1, 1, 1);
+    const float d_near = transform(Vec3f(0, 0, z_near), perspective).z;
+    const float d_far = transform(Vec3f(0, 0, z_far), perspective).z;
+    const float scale = 255 / (d_near - d_far);
+    Mat4x4f m = Mat4x4f({{
+        {width/2.f,         0,     0,      width/2.f},
+        {        0, height/2.f,    0,     height/2.f},
+        {        0,         0, scale, -scale * d_far},
+        {        0,         0,     0,              1}
+    }});
+    return m * perspective * view_transform(target, where, up);
+}
+
+// the camera_transform of a light drawing a size x size shadow map
+inline Mat4x4f light_space_transform(Vec3f const& where, Vec3f const& target, Vec3f const& up, int size,
+                                     float z_near, float z_far) {
+    return camera_transform(where, target, up, size, size, z_near, z_far);
+}
+
 #endif